@@ -0,0 +1,411 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The thumbnail atlas keeps the device icons already scaled, so that the
+ * GUI maps one file instead of opening and decoding every thumbnail:
+ *
+ *   header  BaconAtlasHeader
+ *   entries `n_entries' BaconAtlasEntry records, one per slot
+ *   pixels  `n_entries' slots of `slot_height' rows, each row
+ *           `slot_width' RGBA pixels; the icon is in the top left corner
+ *           of its slot and the rest is zero
+ *
+ * An entry only stands for its thumbnail while the file it was scaled
+ * from keeps the modification time recorded in it. Everything is stored
+ * in host byte order, an atlas written elsewhere fails the magic check
+ * and is rebuilt.
+ */
+
+#include "bacon.h"
+
+#ifdef BACON_GTK
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bacon-atlas.h"
+#include "bacon-device.h"
+#include "bacon-out.h"
+
+#define BACON_ATLAS_MAGIC      0x42415441U
+#define BACON_ATLAS_VERSION    1
+#define BACON_ATLAS_CHANNELS   4
+#define BACON_ATLAS_TMP_SUFFIX ".tmp"
+
+typedef struct BaconAtlasHeader BaconAtlasHeader;
+typedef struct BaconAtlasEntry  BaconAtlasEntry;
+typedef struct BaconAtlasAdded  BaconAtlasAdded;
+
+struct BaconAtlasHeader {
+  guint32 magic;
+  guint32 version;
+  guint32 n_entries;
+  guint32 slot_width;
+  guint32 slot_height;
+  guint32 entries;
+  guint32 pixels;
+  guint32 reserved;
+};
+
+struct BaconAtlasEntry {
+  gchar codename[BACON_DEVICE_NAME_MAX];
+  gint64 mtime;
+  guint32 width;
+  guint32 height;
+};
+
+/* An icon scaled during this run, written out by bacon_atlas_close() */
+struct BaconAtlasAdded {
+  gint64 mtime;
+  GdkPixbuf *pixbuf;
+};
+
+static gchar *                 s_path        = NULL;
+static GMappedFile *           s_map         = NULL;
+static const guint8 *          s_pixels      = NULL;
+static const BaconAtlasEntry * s_entries     = NULL;
+static guint                   s_n_entries   = 0;
+static GdkPixbuf *             s_atlas       = NULL;
+static GHashTable *            s_index       = NULL;
+static GHashTable *            s_added       = NULL;
+static gint                    s_slot_width  = 0;
+static gint                    s_slot_height = 0;
+
+static gsize
+bacon_atlas_slot_size (void)
+{
+  return (gsize) s_slot_width * s_slot_height * BACON_ATLAS_CHANNELS;
+}
+
+static void
+bacon_atlas_release (guchar *pixels, gpointer map)
+{
+  g_mapped_file_unref ((GMappedFile *) map);
+}
+
+static void
+bacon_atlas_free_added (gpointer data)
+{
+  BaconAtlasAdded *added;
+
+  added = (BaconAtlasAdded *) data;
+  g_object_unref (added->pixbuf);
+  g_free (added);
+}
+
+/* Sizes are checked against the file length, and every codename must
+   end inside its record */
+static gboolean
+bacon_atlas_is_valid (const gchar *data, gsize length)
+{
+  guint32 x;
+  const BaconAtlasHeader *header;
+  const BaconAtlasEntry *entries;
+
+  if (length < sizeof (BaconAtlasHeader))
+    return FALSE;
+
+  header = (const BaconAtlasHeader *) data;
+  if ((header->magic != BACON_ATLAS_MAGIC) ||
+      (header->version != BACON_ATLAS_VERSION) ||
+      (header->slot_width != (guint32) s_slot_width) ||
+      (header->slot_height != (guint32) s_slot_height) ||
+      (header->entries != sizeof (BaconAtlasHeader)) ||
+      (header->n_entries >
+       ((length - header->entries) / sizeof (BaconAtlasEntry))) ||
+      (header->pixels != (header->entries +
+                          (header->n_entries * sizeof (BaconAtlasEntry)))) ||
+      ((length - header->pixels) !=
+       (header->n_entries * bacon_atlas_slot_size ())))
+    return FALSE;
+
+  entries = (const BaconAtlasEntry *) (data + header->entries);
+  for (x = 0; x < header->n_entries; ++x)
+    if (!memchr (entries[x].codename, '\0', BACON_DEVICE_NAME_MAX) ||
+        !entries[x].width || (entries[x].width > header->slot_width) ||
+        !entries[x].height || (entries[x].height > header->slot_height))
+      return FALSE;
+  return TRUE;
+}
+
+/* Maps the atlas at `path' and indexes it by codename. A missing or
+   unusable atlas is not an error, it is written anew on close. */
+gboolean
+bacon_atlas_open (const gchar *path, gint slot_width, gint slot_height)
+{
+  guint x;
+  gsize length;
+  const gchar *data;
+  const BaconAtlasHeader *header;
+  GError *error;
+
+  if (s_path)
+    return FALSE;
+
+  s_path = g_strdup (path);
+  s_slot_width = slot_width;
+  s_slot_height = slot_height;
+  s_index = g_hash_table_new (g_str_hash, g_str_equal);
+  s_added = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                   g_free, bacon_atlas_free_added);
+
+  error = NULL;
+  s_map = g_mapped_file_new (path, FALSE, &error);
+  if (!s_map) {
+    g_error_free (error);
+    return FALSE;
+  }
+
+  data = g_mapped_file_get_contents (s_map);
+  length = g_mapped_file_get_length (s_map);
+  if (!data || !bacon_atlas_is_valid (data, length)) {
+    bacon_debug ("ignoring invalid thumbnail atlas `%s'", path);
+    g_mapped_file_unref (s_map);
+    s_map = NULL;
+    return FALSE;
+  }
+
+  header = (const BaconAtlasHeader *) data;
+  s_n_entries = header->n_entries;
+  if (!s_n_entries)
+    return TRUE;
+
+  s_entries = (const BaconAtlasEntry *) (data + header->entries);
+  s_pixels = (const guint8 *) (data + header->pixels);
+  for (x = 0; x < s_n_entries; ++x)
+    if (!g_hash_table_lookup (s_index, s_entries[x].codename))
+      g_hash_table_insert (s_index, (gpointer) s_entries[x].codename,
+                           GUINT_TO_POINTER (x + 1));
+
+  /* the whole pixel area is one pixbuf, each icon a view into it; the
+     map stays until the last of them is gone */
+  s_atlas = gdk_pixbuf_new_from_data (s_pixels, GDK_COLORSPACE_RGB, TRUE, 8,
+                                      s_slot_width,
+                                      s_slot_height * (gint) s_n_entries,
+                                      s_slot_width * BACON_ATLAS_CHANNELS,
+                                      bacon_atlas_release,
+                                      g_mapped_file_ref (s_map));
+  return TRUE;
+}
+
+/* Returns a new reference to the icon of `codename', or NULL when there
+   is none or its thumbnail has changed since it was scaled */
+GdkPixbuf *
+bacon_atlas_lookup (const gchar *codename, gint64 mtime)
+{
+  guint slot;
+  const BaconAtlasEntry *entry;
+
+  if (!s_atlas)
+    return NULL;
+
+  slot = GPOINTER_TO_UINT (g_hash_table_lookup (s_index, codename));
+  if (!slot)
+    return NULL;
+
+  entry = &s_entries[slot - 1];
+  if (entry->mtime != mtime)
+    return NULL;
+  return gdk_pixbuf_new_subpixbuf (s_atlas, 0, (slot - 1) * s_slot_height,
+                                   (gint) entry->width,
+                                   (gint) entry->height);
+}
+
+/* Keeps `pixbuf', scaled from a thumbnail last modified at `mtime', for
+   the next atlas */
+void
+bacon_atlas_add (const gchar *codename, gint64 mtime, GdkPixbuf *pixbuf)
+{
+  BaconAtlasAdded *added;
+
+  if (!s_added || (strlen (codename) >= BACON_DEVICE_NAME_MAX) ||
+      (gdk_pixbuf_get_colorspace (pixbuf) != GDK_COLORSPACE_RGB) ||
+      (gdk_pixbuf_get_bits_per_sample (pixbuf) != 8) ||
+      (gdk_pixbuf_get_width (pixbuf) > s_slot_width) ||
+      (gdk_pixbuf_get_height (pixbuf) > s_slot_height))
+    return;
+
+  added = g_new (BaconAtlasAdded, 1);
+  added->mtime = mtime;
+  if (gdk_pixbuf_get_has_alpha (pixbuf))
+    added->pixbuf = g_object_ref (pixbuf);
+  else
+    added->pixbuf = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+  g_hash_table_replace (s_added, g_strdup (codename), added);
+}
+
+static gboolean
+bacon_atlas_write_entry (FILE *fp,
+                         const gchar *codename,
+                         gint64 mtime,
+                         gint width,
+                         gint height)
+{
+  BaconAtlasEntry entry;
+
+  memset (&entry, 0, sizeof (BaconAtlasEntry));
+  g_strlcpy (entry.codename, codename, BACON_DEVICE_NAME_MAX);
+  entry.mtime = mtime;
+  entry.width = (guint32) width;
+  entry.height = (guint32) height;
+  return (fwrite (&entry, sizeof (BaconAtlasEntry), 1, fp) == 1);
+}
+
+/* Pads the icon out to a whole slot with `blank', a zeroed slot row */
+static gboolean
+bacon_atlas_write_slot (FILE *fp, GdkPixbuf *pixbuf, const guint8 *blank)
+{
+  gint y;
+  gsize row;
+  gsize used;
+  gint width;
+  gint height;
+  gint rowstride;
+  const guint8 *pixels;
+
+  row = (gsize) s_slot_width * BACON_ATLAS_CHANNELS;
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  used = (gsize) width * BACON_ATLAS_CHANNELS;
+
+  for (y = 0; y < s_slot_height; ++y) {
+    if (y < height) {
+      if ((fwrite (pixels + (y * rowstride), 1, used, fp) != used) ||
+          ((used < row) &&
+           (fwrite (blank, 1, row - used, fp) != (row - used))))
+        return FALSE;
+    } else if (fwrite (blank, 1, row, fp) != row)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Old slots whose device was scaled again are left out, the rest are
+   copied as they are. Written to a temporary file first, the old atlas
+   is still mapped. */
+static gboolean
+bacon_atlas_write (void)
+{
+  guint x;
+  guint n;
+  gboolean ok;
+  gchar *tmp;
+  guint8 *blank;
+  FILE *fp;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  BaconAtlasAdded *added;
+  BaconAtlasHeader header;
+
+  n = g_hash_table_size (s_added);
+  for (x = 0; x < s_n_entries; ++x)
+    if (!g_hash_table_lookup (s_added, s_entries[x].codename))
+      ++n;
+
+  memset (&header, 0, sizeof (BaconAtlasHeader));
+  header.magic = BACON_ATLAS_MAGIC;
+  header.version = BACON_ATLAS_VERSION;
+  header.n_entries = n;
+  header.slot_width = (guint32) s_slot_width;
+  header.slot_height = (guint32) s_slot_height;
+  header.entries = sizeof (BaconAtlasHeader);
+  header.pixels = header.entries + (n * sizeof (BaconAtlasEntry));
+
+  tmp = g_strdup_printf ("%s%s", s_path, BACON_ATLAS_TMP_SUFFIX);
+  blank = g_malloc0 ((gsize) s_slot_width * BACON_ATLAS_CHANNELS);
+  ok = FALSE;
+  fp = fopen (tmp, "wb");
+  if (fp) {
+    ok = (fwrite (&header, sizeof (BaconAtlasHeader), 1, fp) == 1);
+
+    g_hash_table_iter_init (&iter, s_added);
+    while (ok && g_hash_table_iter_next (&iter, &key, &value)) {
+      added = (BaconAtlasAdded *) value;
+      ok = bacon_atlas_write_entry (fp, (const gchar *) key, added->mtime,
+                                    gdk_pixbuf_get_width (added->pixbuf),
+                                    gdk_pixbuf_get_height (added->pixbuf));
+    }
+    for (x = 0; ok && (x < s_n_entries); ++x)
+      if (!g_hash_table_lookup (s_added, s_entries[x].codename))
+        ok = bacon_atlas_write_entry (fp, s_entries[x].codename,
+                                      s_entries[x].mtime,
+                                      (gint) s_entries[x].width,
+                                      (gint) s_entries[x].height);
+
+    g_hash_table_iter_init (&iter, s_added);
+    while (ok && g_hash_table_iter_next (&iter, &key, &value))
+      ok = bacon_atlas_write_slot (fp, ((BaconAtlasAdded *) value)->pixbuf,
+                                   blank);
+    for (x = 0; ok && (x < s_n_entries); ++x)
+      if (!g_hash_table_lookup (s_added, s_entries[x].codename))
+        ok = (fwrite (s_pixels + (x * bacon_atlas_slot_size ()),
+                      bacon_atlas_slot_size (), 1, fp) == 1);
+
+    if (fclose (fp) != 0)
+      ok = FALSE;
+#ifndef BACON_OS_UNIX
+    if (ok)
+      remove (s_path);
+#endif
+    if (ok && (rename (tmp, s_path) != 0))
+      ok = FALSE;
+  }
+
+  if (!ok) {
+    bacon_debug ("failed to write thumbnail atlas `%s' (%s)",
+                 s_path, strerror (errno));
+    remove (tmp);
+  }
+  g_free (blank);
+  g_free (tmp);
+  return ok;
+}
+
+/* Writes the atlas out if anything was scaled since it was opened */
+void
+bacon_atlas_close (void)
+{
+  if (!s_path)
+    return;
+
+  if (g_hash_table_size (s_added))
+    bacon_atlas_write ();
+
+  if (s_atlas)
+    g_object_unref (s_atlas);
+  if (s_map)
+    g_mapped_file_unref (s_map);
+  g_hash_table_destroy (s_added);
+  g_hash_table_destroy (s_index);
+  g_free (s_path);
+  s_path = NULL;
+  s_map = NULL;
+  s_atlas = NULL;
+  s_index = NULL;
+  s_added = NULL;
+  s_entries = NULL;
+  s_pixels = NULL;
+  s_n_entries = 0;
+}
+#endif /* BACON_GTK */
@@ -0,0 +1,48 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BACON_ATLAS_H
+#define BACON_ATLAS_H
+
+#ifdef BACON_GTK
+# include <gdk-pixbuf/gdk-pixbuf.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+# define BACON_ATLAS_FILENAME "thumbs.atlas"
+
+gboolean bacon_atlas_open (const gchar *path,
+                           gint slot_width,
+                           gint slot_height);
+GdkPixbuf *bacon_atlas_lookup (const gchar *codename, gint64 mtime);
+void bacon_atlas_add (const gchar *codename,
+                      gint64 mtime,
+                      GdkPixbuf *pixbuf);
+void bacon_atlas_close (void);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
+
+#endif /* BACON_ATLAS_H */
@@ -60,12 +60,16 @@ __bacon_color_str (int colorp, const char *str)
 {
   size_t x;
 
+  /* an empty slot counts as free, the next caller would take it over */
+  if (!g_use_color && !*str)
+    return "";
+
+  x = bacon_get_pos_from_table ();
   if (!g_use_color) {
     snprintf (s_table[x].colorized, BACON_COLORIZED_STRING_MAX, "%s", str);
     return s_table[x].colorized;
   }
 
-  x = bacon_get_pos_from_table ();
   snprintf (s_table[x].colorized,
             BACON_COLORIZED_STRING_MAX,
             "%s%s%s%s%s",
@@ -90,12 +94,12 @@ __bacon_color_char (int colorp, char c)
 {
   size_t x;
 
+  x = bacon_get_pos_from_table ();
   if (!g_use_color) {
     snprintf (s_table[x].colorized, BACON_COLORIZED_STRING_MAX, "%c", c);
     return s_table[x].colorized;
   }
 
-  x = bacon_get_pos_from_table ();
   snprintf (s_table[x].colorized,
             BACON_COLORIZED_STRING_MAX,
             "%s%s%s%c%s",
@@ -120,12 +124,12 @@ __bacon_color_int (int colorp, int n)
 {
   size_t x;
 
+  x = bacon_get_pos_from_table ();
   if (!g_use_color) {
     snprintf (s_table[x].colorized, BACON_COLORIZED_STRING_MAX, "%i", n);
     return s_table[x].colorized;
   }
 
-  x = bacon_get_pos_from_table ();
   snprintf (s_table[x].colorized,
             BACON_COLORIZED_STRING_MAX,
             "%s%s%s%i%s",
@@ -0,0 +1,479 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The device database is a binary copy of devicelist.txt that is mapped
+ * and used in place, so loading it costs no parsing at all:
+ *
+ *   header   BaconDevDbHeader
+ *   records  `n_devices' BaconDevDbRecord entries
+ *   index    `n_slots' record numbers (plus one, zero for empty) forming an
+ *            open addressing table over the lowercased codenames
+ *   trigrams `n_trigrams' BaconSearchTrigram entries sorted by key
+ *   postings `n_postings' document numbers; device n is document 2n for
+ *            its fullname and 2n + 1 for its codename
+ *   strings  NUL-terminated names, referenced by offset from the records
+ *
+ * Everything is stored in host byte order. A database written elsewhere
+ * fails the magic check and is regenerated from the text list.
+ */
+
+#include "bacon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#if defined (HAVE_MMAP) && defined (HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define BACON_DEVDB_USE_MMAP 1
+#endif
+
+#include "bacon-devdb.h"
+#include "bacon-out.h"
+#include "bacon-str.h"
+#include "bacon-util.h"
+
+#define BACON_DEVDB_MAGIC      0x42444256U
+#define BACON_DEVDB_VERSION    3
+#define BACON_DEVDB_MIN_SLOTS  16
+#define BACON_DEVDB_TMP_SUFFIX ".tmp"
+
+typedef struct BaconDevDbHeader BaconDevDbHeader;
+typedef struct BaconDevDbRecord BaconDevDbRecord;
+
+struct BaconDevDbHeader {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int n_devices;
+  unsigned int records;
+  unsigned int index;
+  unsigned int n_slots;
+  unsigned int trigrams;
+  unsigned int n_trigrams;
+  unsigned int postings;
+  unsigned int n_postings;
+  unsigned int strings;
+  unsigned int n_strings;
+};
+
+/* `key' is the lowercased codename and `hash' its bacon_strhashci(). */
+struct BaconDevDbRecord {
+  unsigned int codename;
+  unsigned int fullname;
+  unsigned int key;
+  unsigned int hash;
+};
+
+static unsigned char *            s_map      = NULL;
+static size_t                     s_map_size = 0;
+static BaconBoolean               s_mapped   = BACON_FALSE;
+static BaconDeviceList *          s_list     = NULL;
+static const BaconDevDbHeader *   s_header   = NULL;
+static const BaconDevDbRecord *   s_records  = NULL;
+static const unsigned int *       s_slots    = NULL;
+static const BaconSearchTrigram * s_trigrams = NULL;
+static const unsigned int *       s_postings = NULL;
+static const char *               s_strings  = NULL;
+
+BaconBoolean
+bacon_devdb_is_stale (const char *path, const char *text_path)
+{
+  struct stat db;
+  struct stat text;
+
+  memset (&db, 0, sizeof (struct stat));
+  memset (&text, 0, sizeof (struct stat));
+  if (stat (path, &db) != 0)
+    return BACON_TRUE;
+  if (stat (text_path, &text) != 0)
+    return BACON_FALSE;
+  return (text.st_mtime > db.st_mtime) ? BACON_TRUE : BACON_FALSE;
+}
+
+static BaconBoolean
+bacon_devdb_write_strings (FILE *fp, BaconDeviceList *list)
+{
+  size_t n;
+  BaconDeviceList *p;
+
+  for (p = list; p; p = p->next) {
+    n = strlen (p->device->codename);
+    {
+      char key[n + 1];
+      bacon_strtolower (key, n, p->device->codename);
+      key[n] = '\0';
+      if ((fwrite (p->device->codename, n + 1, 1, fp) != 1) ||
+          (fwrite (p->device->fullname,
+                   strlen (p->device->fullname) + 1, 1, fp) != 1) ||
+          (fwrite (key, n + 1, 1, fp) != 1))
+        return BACON_FALSE;
+    }
+    if (!p->next)
+      break;
+  }
+  return BACON_TRUE;
+}
+
+/* The table is kept at most half full. The first device with a given
+   codename wins, like a linear scan of the list would. */
+static unsigned int *
+bacon_devdb_make_index (const BaconDevDbRecord *records,
+                        BaconDevice **devices,
+                        size_t n,
+                        size_t *n_slots)
+{
+  size_t r;
+  size_t x;
+  size_t mask;
+  unsigned int *slots;
+
+  *n_slots = BACON_DEVDB_MIN_SLOTS;
+  while (*n_slots < (n * 2))
+    *n_slots *= 2;
+  mask = *n_slots - 1;
+
+  slots = bacon_newa (unsigned int, *n_slots * sizeof (unsigned int));
+  memset (slots, 0, *n_slots * sizeof (unsigned int));
+
+  for (r = 0; r < n; ++r) {
+    for (x = records[r].hash & mask; slots[x]; x = (x + 1) & mask)
+      if ((records[slots[x] - 1].hash == records[r].hash) &&
+          bacon_streqci (devices[slots[x] - 1]->codename,
+                         devices[r]->codename))
+        break;
+    if (!slots[x])
+      slots[x] = (unsigned int) (r + 1);
+  }
+  return slots;
+}
+
+/* Writes to a temporary file first so that a database another bacon
+   process has mapped is never truncated underneath it. `search' must
+   index the documents of `list' as described at the top of this file. */
+BaconBoolean
+bacon_devdb_write (const char *path,
+                   BaconDeviceList *list,
+                   const BaconSearchIndex *search)
+{
+  size_t n;
+  size_t x;
+  size_t pos;
+  size_t n_slots;
+  char *tmp;
+  FILE *fp;
+  BaconBoolean ok;
+  BaconDevDbHeader header;
+  BaconDevDbRecord *records;
+  BaconDevice **devices;
+  BaconDeviceList *p;
+  unsigned int *slots;
+
+  n = (size_t) bacon_device_list_total (list);
+  records = NULL;
+  devices = NULL;
+  if (n) {
+    records = bacon_newa (BaconDevDbRecord, n * sizeof (BaconDevDbRecord));
+    devices = bacon_newa (BaconDevice *, n * sizeof (BaconDevice *));
+  }
+
+  x = 0;
+  pos = 0;
+  for (p = list; p; p = p->next) {
+    devices[x] = p->device;
+    records[x].codename = (unsigned int) pos;
+    pos += strlen (p->device->codename) + 1;
+    records[x].fullname = (unsigned int) pos;
+    pos += strlen (p->device->fullname) + 1;
+    records[x].key = (unsigned int) pos;
+    pos += strlen (p->device->codename) + 1;
+    records[x].hash = bacon_strhashci (p->device->codename);
+    ++x;
+    if (!p->next)
+      break;
+  }
+  slots = bacon_devdb_make_index (records, devices, n, &n_slots);
+
+  memset (&header, 0, sizeof (BaconDevDbHeader));
+  header.magic = BACON_DEVDB_MAGIC;
+  header.version = BACON_DEVDB_VERSION;
+  header.n_devices = (unsigned int) n;
+  header.records = (unsigned int) sizeof (BaconDevDbHeader);
+  header.index = (unsigned int) (header.records +
+                                 (n * sizeof (BaconDevDbRecord)));
+  header.n_slots = (unsigned int) n_slots;
+  header.trigrams = (unsigned int) (header.index +
+                                    (n_slots * sizeof (unsigned int)));
+  header.n_trigrams = (unsigned int) search->n_trigrams;
+  header.postings = (unsigned int) (header.trigrams +
+                                    (search->n_trigrams *
+                                     sizeof (BaconSearchTrigram)));
+  header.n_postings = (unsigned int) search->n_postings;
+  header.strings = (unsigned int) (header.postings +
+                                   (search->n_postings *
+                                    sizeof (unsigned int)));
+  header.n_strings = (unsigned int) pos;
+
+  tmp = bacon_strf ("%s%s", path, BACON_DEVDB_TMP_SUFFIX);
+  ok = BACON_FALSE;
+  fp = fopen (tmp, "wb");
+  if (fp) {
+    ok = ((fwrite (&header, sizeof (BaconDevDbHeader), 1, fp) == 1) &&
+          (!n || (fwrite (records, sizeof (BaconDevDbRecord), n, fp) == n)) &&
+          (fwrite (slots, sizeof (unsigned int), n_slots, fp) == n_slots) &&
+          (!search->n_trigrams ||
+           (fwrite (search->trigrams, sizeof (BaconSearchTrigram),
+                    search->n_trigrams, fp) == search->n_trigrams)) &&
+          (!search->n_postings ||
+           (fwrite (search->postings, sizeof (unsigned int),
+                    search->n_postings, fp) == search->n_postings)) &&
+          bacon_devdb_write_strings (fp, list))
+         ? BACON_TRUE : BACON_FALSE;
+    if (fclose (fp) != 0)
+      ok = BACON_FALSE;
+#ifndef BACON_OS_UNIX
+    if (ok)
+      remove (path);
+#endif
+    if (ok && (rename (tmp, path) != 0))
+      ok = BACON_FALSE;
+  }
+
+  if (!ok) {
+    bacon_debug ("failed to write device database `%s' (%s)",
+                 path, strerror (errno));
+    remove (tmp);
+  }
+  bacon_free (tmp);
+  bacon_free (slots);
+  bacon_free (devices);
+  bacon_free (records);
+  return ok;
+}
+
+static void
+bacon_devdb_unload (void)
+{
+#ifdef BACON_DEVDB_USE_MMAP
+  if (s_mapped) {
+    munmap (s_map, s_map_size);
+    s_map = NULL;
+    s_mapped = BACON_FALSE;
+  }
+#endif
+  bacon_free (s_map);
+  s_map_size = 0;
+  s_header = NULL;
+  s_records = NULL;
+  s_slots = NULL;
+  s_trigrams = NULL;
+  s_postings = NULL;
+  s_strings = NULL;
+}
+
+static BaconBoolean
+bacon_devdb_load (const char *path)
+{
+  FILE *fp;
+  struct stat s;
+
+  fp = fopen (path, "rb");
+  if (!fp)
+    return BACON_FALSE;
+
+  memset (&s, 0, sizeof (struct stat));
+  if ((fstat (fileno (fp), &s) != 0) ||
+      (((size_t) s.st_size) < sizeof (BaconDevDbHeader))) {
+    fclose (fp);
+    return BACON_FALSE;
+  }
+
+  s_map_size = (size_t) s.st_size;
+#ifdef BACON_DEVDB_USE_MMAP
+  s_map = (unsigned char *) mmap (NULL, s_map_size, PROT_READ, MAP_PRIVATE,
+                                  fileno (fp), 0);
+  if (s_map != MAP_FAILED) {
+    s_mapped = BACON_TRUE;
+    fclose (fp);
+    return BACON_TRUE;
+  }
+  s_map = NULL;
+#endif
+  s_map = bacon_newa (unsigned char, s_map_size);
+  if (fread (s_map, 1, s_map_size, fp) != s_map_size) {
+    fclose (fp);
+    bacon_devdb_unload ();
+    return BACON_FALSE;
+  }
+  fclose (fp);
+  return BACON_TRUE;
+}
+
+/* Only bounds are checked; every offset is below `n_strings' and the table
+   ends in a NUL, so each name is terminated inside the map. Index slots
+   are checked as they are probed, so the index is never read in full. */
+static BaconBoolean
+bacon_devdb_is_valid (void)
+{
+  size_t x;
+  const BaconDevDbHeader *header;
+  const BaconDevDbRecord *records;
+
+  header = (const BaconDevDbHeader *) s_map;
+  if ((header->magic != BACON_DEVDB_MAGIC) ||
+      (header->version != BACON_DEVDB_VERSION) ||
+      (header->records != sizeof (BaconDevDbHeader)) ||
+      (header->n_devices >
+       ((s_map_size - header->records) / sizeof (BaconDevDbRecord))) ||
+      (header->index != (header->records +
+                         (header->n_devices * sizeof (BaconDevDbRecord)))) ||
+      (header->n_slots <= header->n_devices) ||
+      (header->n_slots & (header->n_slots - 1)) ||
+      (header->n_slots >
+       ((s_map_size - header->index) / sizeof (unsigned int))) ||
+      (header->trigrams != (header->index +
+                            (header->n_slots * sizeof (unsigned int)))) ||
+      (header->n_trigrams >
+       ((s_map_size - header->trigrams) / sizeof (BaconSearchTrigram))) ||
+      (header->postings != (header->trigrams +
+                            (header->n_trigrams *
+                             sizeof (BaconSearchTrigram)))) ||
+      (header->n_postings >
+       ((s_map_size - header->postings) / sizeof (unsigned int))) ||
+      (header->strings != (header->postings +
+                           (header->n_postings * sizeof (unsigned int)))) ||
+      (header->n_strings != (s_map_size - header->strings)) ||
+      !header->n_strings ||
+      (s_map[s_map_size - 1] != '\0'))
+    return BACON_FALSE;
+
+  records = (const BaconDevDbRecord *) (s_map + header->records);
+  for (x = 0; x < header->n_devices; ++x)
+    if ((records[x].codename >= header->n_strings) ||
+        (records[x].fullname >= header->n_strings) ||
+        (records[x].key >= header->n_strings))
+      return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+/* The returned list is a single allocation whose names point into the
+   map; it must be released with bacon_devdb_close(). */
+BaconDeviceList *
+bacon_devdb_open (const char *path)
+{
+  size_t n;
+  size_t x;
+  char *strings;
+  BaconDevice *devices;
+  BaconDeviceList *nodes;
+
+  if (s_list || !bacon_devdb_load (path))
+    return NULL;
+  if (!bacon_devdb_is_valid ()) {
+    bacon_debug ("ignoring invalid device database `%s'", path);
+    bacon_devdb_unload ();
+    return NULL;
+  }
+
+  s_header = (const BaconDevDbHeader *) s_map;
+  n = s_header->n_devices;
+  if (!n) {
+    bacon_devdb_unload ();
+    return NULL;
+  }
+  s_records = (const BaconDevDbRecord *) (s_map + s_header->records);
+  s_slots = (const unsigned int *) (s_map + s_header->index);
+  s_trigrams = (const BaconSearchTrigram *) (s_map + s_header->trigrams);
+  s_postings = (const unsigned int *) (s_map + s_header->postings);
+  s_strings = (const char *) (s_map + s_header->strings);
+  strings = (char *) (s_map + s_header->strings);
+
+  nodes = bacon_newa (BaconDeviceList,
+                      n * (sizeof (BaconDeviceList) + sizeof (BaconDevice)));
+  devices = (BaconDevice *) (nodes + n);
+  for (x = 0; x < n; ++x) {
+    devices[x].codename = strings + s_records[x].codename;
+    devices[x].fullname = strings + s_records[x].fullname;
+    nodes[x].device = &devices[x];
+    nodes[x].prev = x ? &nodes[x - 1] : NULL;
+    nodes[x].next = ((x + 1) < n) ? &nodes[x + 1] : NULL;
+  }
+  s_list = nodes;
+  bacon_debug ("mapped %lu devices from `%s'", (unsigned long) n, path);
+  return nodes;
+}
+
+/* Returns false when `list' is not the mapped list, otherwise stores the
+   device whose codename matches `id' (ignoring case) or NULL. */
+BaconBoolean
+bacon_devdb_find (const BaconDeviceList *list,
+                  const char *id,
+                  BaconDevice **device)
+{
+  size_t x;
+  size_t n;
+  size_t mask;
+  unsigned int r;
+  unsigned int hash;
+
+  if (!list || (list != s_list))
+    return BACON_FALSE;
+
+  *device = NULL;
+  hash = bacon_strhashci (id);
+  mask = s_header->n_slots - 1;
+  x = hash & mask;
+  for (n = 0; n < s_header->n_slots; ++n) {
+    r = s_slots[x];
+    if (!r || (r > s_header->n_devices))
+      break;
+    if ((s_records[r - 1].hash == hash) &&
+        bacon_streqlower (s_strings + s_records[r - 1].key, id)) {
+      *device = s_list[r - 1].device;
+      break;
+    }
+    x = (x + 1) & mask;
+  }
+  return BACON_TRUE;
+}
+
+/* Wraps the stored trigram index for the mapped list; NULL for any other
+   list. The index checks each trigram's range as it is looked up. */
+BaconSearchIndex *
+bacon_devdb_search_index (const BaconDeviceList *list,
+                          const char **documents,
+                          size_t n_documents)
+{
+  if (!list || (list != s_list) ||
+      (n_documents != (2 * ((size_t) s_header->n_devices))))
+    return NULL;
+  return bacon_search_index_view (documents, n_documents,
+                                  s_trigrams, s_header->n_trigrams,
+                                  s_postings, s_header->n_postings);
+}
+
+BaconBoolean
+bacon_devdb_close (BaconDeviceList *list)
+{
+  if (!list || (list != s_list))
+    return BACON_FALSE;
+  bacon_free (s_list);
+  bacon_devdb_unload ();
+  return BACON_TRUE;
+}
@@ -0,0 +1,51 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BACON_DEVDB_H
+#define BACON_DEVDB_H
+
+#include "bacon.h"
+#include "bacon-device.h"
+#include "bacon-search.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BACON_DEVDB_FILENAME "devicelist.db"
+
+BaconBoolean bacon_devdb_is_stale (const char *path, const char *text_path);
+BaconBoolean bacon_devdb_write (const char *path,
+                                BaconDeviceList *list,
+                                const BaconSearchIndex *search);
+BaconDeviceList *bacon_devdb_open (const char *path);
+BaconBoolean bacon_devdb_find (const BaconDeviceList *list,
+                               const char *id,
+                               BaconDevice **device);
+BaconSearchIndex *bacon_devdb_search_index (const BaconDeviceList *list,
+                                            const char **documents,
+                                            size_t n_documents);
+BaconBoolean bacon_devdb_close (BaconDeviceList *list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BACON_DEVDB_H */
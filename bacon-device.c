@@ -22,6 +22,7 @@
 
 #include <string.h>
 
+#include "bacon-devdb.h"
 #include "bacon-device.h"
 #include "bacon-net.h"
 #include "bacon-out.h"
@@ -30,9 +31,30 @@
 #include "bacon-util.h"
 
 #define BACON_DEVICE_LIST_LOCAL_FILENAME "devicelist.txt"
+#define BACON_DEVICE_INDEX_MIN_SLOTS     16
+
+typedef struct BaconDeviceIndexSlot BaconDeviceIndexSlot;
+
+/* One slot of the codename index; `key' is the lowercased codename. */
+struct BaconDeviceIndexSlot {
+  unsigned int hash;
+  const char *key;
+  BaconDevice *device;
+};
 
 extern char *g_program_data_path;
 static char *s_local_device_list_path = NULL;
+static char *s_local_device_db_path = NULL;
+
+static const BaconDeviceList * s_index_list = NULL;
+static BaconDeviceIndexSlot *  s_index      = NULL;
+static size_t                  s_index_mask = 0;
+static char *                  s_index_keys = NULL;
+
+static const BaconDeviceList * s_search_list      = NULL;
+static BaconDevice **          s_search_devices   = NULL;
+static const char **           s_search_documents = NULL;
+static BaconSearchIndex *      s_search_index     = NULL;
 
 static void
 bacon_set_local_device_list_path (void)
@@ -41,6 +63,10 @@ bacon_set_local_device_list_path (void)
                                          g_program_data_path,
                                          BACON_PATH_SEP,
                                          BACON_DEVICE_LIST_LOCAL_FILENAME);
+  s_local_device_db_path = bacon_strf ("%s%c%s",
+                                       g_program_data_path,
+                                       BACON_PATH_SEP,
+                                       BACON_DEVDB_FILENAME);
 }
 
 static BaconBoolean
@@ -67,9 +93,7 @@ bacon_write_local_device_list (BaconDeviceList *list)
 static char *
 bacon_device_local_data (void)
 {
-  int c;
   size_t n;
-  size_t x;
   char *data;
   FILE *fp;
   struct stat s;
@@ -79,20 +103,135 @@ bacon_device_local_data (void)
   if (stat (s_local_device_list_path, &s) == 0)
     n = ((size_t) s.st_size);
 
-  data = bacon_newa (char, n);
+  data = bacon_newa (char, n + 1);
   fp = bacon_env_fopen (s_local_device_list_path, "r");
+  n = fread (data, 1, n, fp);
+  data[n] = '\0';
+  bacon_env_fclose (fp);
+  return data;
+}
+
+static void
+bacon_device_index_clear (void)
+{
+  bacon_free (s_index);
+  bacon_free (s_index_keys);
+  s_index_mask = 0;
+  s_index_list = NULL;
+}
+
+static BaconDeviceIndexSlot *
+bacon_device_index_find (const char *id, unsigned int hash)
+{
+  size_t x;
+
+  for (x = hash & s_index_mask; s_index[x].device;
+       x = (x + 1) & s_index_mask)
+    if ((s_index[x].hash == hash) &&
+        bacon_streqlower (s_index[x].key, id))
+      return &s_index[x];
+  return &s_index[x];
+}
+
+/* Lists that did not come from the device database get the same kind of
+   index in memory: open addressing with linear probing over the lowercased
+   codenames, at most half full. The first device with a given codename
+   wins, like the linear scan it replaces. */
+static void
+bacon_device_index_build (const BaconDeviceList *list)
+{
+  size_t n;
+  size_t len;
+  size_t n_keys;
+  size_t n_slots;
+  char *key;
+  unsigned int hash;
+  const BaconDeviceList *p;
+  BaconDeviceIndexSlot *slot;
+
+  bacon_device_index_clear ();
+
+  n = 0;
+  n_keys = 0;
+  for (p = list; p; p = p->next) {
+    ++n;
+    n_keys += strlen (p->device->codename) + 1;
+    if (!p->next)
+      break;
+  }
+
+  n_slots = BACON_DEVICE_INDEX_MIN_SLOTS;
+  while (n_slots < (n * 2))
+    n_slots *= 2;
+
+  s_index = bacon_newa (BaconDeviceIndexSlot,
+                        n_slots * sizeof (BaconDeviceIndexSlot));
+  memset (s_index, 0, n_slots * sizeof (BaconDeviceIndexSlot));
+  s_index_mask = n_slots - 1;
+  s_index_keys = bacon_newa (char, n_keys + 1);
+
+  key = s_index_keys;
+  for (p = list; p; p = p->next) {
+    len = strlen (p->device->codename);
+    bacon_strtolower (key, len, p->device->codename);
+    key[len] = '\0';
+    hash = bacon_strhashci (key);
+    slot = bacon_device_index_find (key, hash);
+    if (!slot->device) {
+      slot->hash = hash;
+      slot->key = key;
+      slot->device = p->device;
+    }
+    key += len + 1;
+    if (!p->next)
+      break;
+  }
+  s_index_list = list;
+}
 
+static void
+bacon_device_search_clear (void)
+{
+  bacon_search_index_destroy (s_search_index);
+  s_search_index = NULL;
+  bacon_free (s_search_devices);
+  bacon_free (s_search_documents);
+  s_search_list = NULL;
+}
+
+/* Each device is two documents in the search index: its fullname at 2n
+   and its codename at 2n + 1. A mapped list reuses the index stored in
+   the database; any other list gets one built here. */
+static void
+bacon_device_search_prepare (BaconDeviceList *list)
+{
+  size_t n;
+  size_t x;
+  BaconDeviceList *p;
+
+  if (list == s_search_list)
+    return;
+  bacon_device_search_clear ();
+
+  n = (size_t) bacon_device_list_total (list);
+  s_search_devices = bacon_newa (BaconDevice *,
+                                 (n + 1) * sizeof (BaconDevice *));
+  s_search_documents = bacon_newa (const char *,
+                                   ((2 * n) + 1) * sizeof (const char *));
   x = 0;
-  while (BACON_TRUE) {
-    c = fgetc (fp);
-    if (c == EOF)
+  for (p = list; p; p = p->next) {
+    s_search_devices[x] = p->device;
+    s_search_documents[2 * x] = p->device->fullname;
+    s_search_documents[(2 * x) + 1] = p->device->codename;
+    ++x;
+    if (!p->next)
       break;
-    data[x++] = ((char) c);
   }
 
-  data[x] = '\0';
-  bacon_env_fclose (fp);
-  return data;
+  s_search_index = bacon_devdb_search_index (list, s_search_documents, 2 * n);
+  if (!s_search_index)
+    s_search_index = bacon_search_index_new (s_search_documents, 2 * n);
+  s_search_list = list;
 }
 
 BaconDeviceList *
@@ -111,13 +250,24 @@ bacon_device_list_new (BaconBoolean force_new)
       if (data) {
         list = bacon_parse_for_device_list (data, BACON_FALSE);
         bacon_write_local_device_list (list);
+        bacon_device_search_prepare (list);
+        bacon_devdb_write (s_local_device_db_path, list, s_search_index);
       }
       bacon_net_deinit ();
     }
   } else {
-    data = bacon_device_local_data ();
-    if (data)
+    /* The text list stays the source of truth; the database is rebuilt
+       from it whenever it is missing, older or unreadable. */
+    if (!bacon_devdb_is_stale (s_local_device_db_path,
+                               s_local_device_list_path))
+      list = bacon_devdb_open (s_local_device_db_path);
+    if (!list) {
+      data = bacon_device_local_data ();
       list = bacon_parse_for_device_list (data, BACON_TRUE);
+      bacon_device_search_prepare (list);
+      bacon_devdb_write (s_local_device_db_path, list, s_search_index);
+      bacon_free (data);
+    }
   }
   return list;
 }
@@ -127,7 +277,15 @@ bacon_device_list_destroy (BaconDeviceList *list)
 {
   BaconDeviceList *p;
 
+  if (list && (list == s_index_list))
+    bacon_device_index_clear ();
+  if (list && (list == s_search_list))
+    bacon_device_search_clear ();
+  if (bacon_devdb_close (list))
+    return;
   for (p = list; p; p = p->next) {
+    bacon_free (p->device->codename);
+    bacon_free (p->device->fullname);
     bacon_free (p->device);
     if (!p->next)
       break;
@@ -153,32 +311,175 @@ bacon_device_list_total (BaconDeviceList *list)
 BaconBoolean
 bacon_device_is_valid_id (BaconDeviceList *list, const char *id)
 {
-  BaconDeviceList *p;
-
-  for (p = list; p; p = p->next) {
-    if (bacon_streqci (id, p->device->codename))
-      return BACON_TRUE;
-    if (!p->next)
-      break;
-  }
-  return BACON_FALSE;
+  return bacon_device_get_device_from_id (list, id) ? BACON_TRUE
+                                                     : BACON_FALSE;
 }
 
+/* A mapped list is looked up through the index stored in the database.
+   Any other list has its index built on the first lookup and reused until
+   the list is destroyed. */
 BaconDevice *
 bacon_device_get_device_from_id (BaconDeviceList *list, const char *id)
 {
   BaconDevice *device;
+
+  if (!list || !id)
+    return NULL;
+  if (bacon_devdb_find (list, id, &device))
+    return device;
+  if (list != s_index_list)
+    bacon_device_index_build (list);
+  return bacon_device_index_find (id, bacon_strhashci (id))->device;
+}
+
+/* Returns the devices whose fullname or codename contains every token,
+   in list order, using the trigram index instead of scanning. */
+BaconDeviceMatch *
+bacon_device_find (BaconDeviceList *list,
+                   BaconSearchTokenList *tokens,
+                   size_t *n_matches)
+{
+  size_t n;
+  size_t x;
+  size_t n_docs;
+  unsigned int *docs;
+  BaconDevice *device;
+  BaconDeviceMatch *matches;
+
+  *n_matches = 0;
+  if (!list)
+    return NULL;
+
+  bacon_device_search_prepare (list);
+  docs = bacon_search_index_query (s_search_index, tokens, &n_docs);
+  matches = bacon_newa (BaconDeviceMatch,
+                        (n_docs + 1) * sizeof (BaconDeviceMatch));
+
+  n = 0;
+  for (x = 0; x < n_docs; ++x) {
+    device = s_search_devices[docs[x] / 2];
+    if (!n || (matches[n - 1].device != device)) {
+      matches[n].device = device;
+      matches[n].fullname_match = BACON_FALSE;
+      matches[n].codename_match = BACON_FALSE;
+      matches[n++].distance = 0;
+    }
+    if (docs[x] % 2)
+      matches[n - 1].codename_match = BACON_TRUE;
+    else
+      matches[n - 1].fullname_match = BACON_TRUE;
+  }
+  bacon_free (docs);
+  *n_matches = n;
+  return matches;
+}
+
+/* Scores `device' against every pattern; the distance of a token is the
+   better of its fullname and codename distances, and the field that gave
+   it is flagged in `match'. Returns -1 as soon as a token is too far from
+   both. */
+static int
+bacon_device_fuzzy_score (const BaconDevice *device,
+                          const BaconSearchPattern *patterns,
+                          size_t n_patterns,
+                          BaconDeviceMatch *match)
+{
+  int d;
+  int dc;
+  int total;
+  size_t x;
+
+  total = 0;
+  match->fullname_match = BACON_FALSE;
+  match->codename_match = BACON_FALSE;
+  for (x = 0; x < n_patterns; ++x) {
+    d = bacon_search_distance (&patterns[x], device->fullname);
+    dc = d;
+    if (d)
+      dc = bacon_search_distance (&patterns[x], device->codename);
+    if (dc < d) {
+      d = dc;
+      match->codename_match = BACON_TRUE;
+    } else
+      match->fullname_match = BACON_TRUE;
+    if (d > patterns[x].max_distance)
+      return -1;
+    total += d;
+  }
+  return total;
+}
+
+/* Longest first: long tokens are the likeliest to rule a device out. */
+static int
+bacon_device_fuzzy_pattern_cmp (const void *a, const void *b)
+{
+  size_t la;
+  size_t lb;
+
+  la = ((const BaconSearchPattern *) a)->length;
+  lb = ((const BaconSearchPattern *) b)->length;
+  return (la < lb) ? 1 : ((la > lb) ? -1 : 0);
+}
+
+/* Returns at most `max' devices whose fullname or codename contains each
+   token with at most a few typos, fewest edits first and in list order
+   among equals. */
+BaconDeviceMatch *
+bacon_device_fuzzy_find (BaconDeviceList *list,
+                         BaconSearchTokenList *tokens,
+                         size_t max,
+                         size_t *n_matches)
+{
+  int score;
+  size_t n;
+  size_t x;
+  size_t pos;
+  size_t total;
+  size_t n_patterns;
+  BaconDeviceMatch match;
+  BaconDeviceMatch *matches;
   BaconDeviceList *p;
+  BaconSearchTokenList *t;
+  BaconSearchPattern *patterns;
 
-  device = NULL;
-  for (p = list; p; p = p->next) {
-    if (bacon_streqci (id, p->device->codename)) {
-      device = p->device;
+  *n_matches = 0;
+  if (!list || !tokens || !max)
+    return NULL;
+
+  /* --max=N comes straight from the user, there's never more to keep
+     than there are devices */
+  total = (size_t) bacon_device_list_total (list);
+  if (max > total)
+    max = total;
+
+  n_patterns = bacon_search_token_list_total (tokens);
+  patterns = bacon_newa (BaconSearchPattern,
+                         n_patterns * sizeof (BaconSearchPattern));
+  x = 0;
+  for (t = tokens; t; t = t->next) {
+    bacon_search_pattern_init (&patterns[x++], t->token);
+    if (!t->next)
       break;
+  }
+  qsort (patterns, n_patterns, sizeof (BaconSearchPattern),
+         bacon_device_fuzzy_pattern_cmp);
+
+  n = 0;
+  matches = bacon_newa (BaconDeviceMatch, max * sizeof (BaconDeviceMatch));
+  for (p = list; p; p = p->next) {
+    score = bacon_device_fuzzy_score (p->device, patterns, n_patterns, &match);
+    if ((score >= 0) && ((n < max) || (score < matches[n - 1].distance))) {
+      match.device = p->device;
+      match.distance = score;
+      pos = (n < max) ? n++ : (n - 1);
+      for (; (pos > 0) && (matches[pos - 1].distance > score); --pos)
+        matches[pos] = matches[pos - 1];
+      matches[pos] = match;
     }
     if (!p->next)
       break;
   }
-  return device;
+  bacon_free (patterns);
+  *n_matches = n;
+  return matches;
 }
-
@@ -23,6 +23,7 @@
 
 #include "bacon.h"
 #include "bacon-env.h"
+#include "bacon-search.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,20 +36,22 @@ extern "C" {
 
 typedef struct BaconDevice                 BaconDevice;
 typedef struct BaconDeviceList             BaconDeviceList;
+typedef struct BaconDeviceMatch            BaconDeviceMatch;
 #ifdef BACON_GTK
 typedef struct BaconDeviceThumbRequestList BaconDeviceThumbRequestList;
 
 struct BaconDeviceThumbRequestList {
   char request[BACON_DEVICE_THUMB_REQUEST_MAX];
   char filename[BACON_PATH_MAX];
+  const char *codename;
   BaconDeviceThumbRequestList *next;
   BaconDeviceThumbRequestList *prev;
 };
 #endif
 
 struct BaconDevice {
-  char codename[BACON_DEVICE_NAME_MAX];
-  char fullname[BACON_DEVICE_NAME_MAX];
+  char *codename;
+  char *fullname;
 };
 
 struct BaconDeviceList {
@@ -57,12 +60,26 @@ struct BaconDeviceList {
   BaconDeviceList *prev;
 };
 
+struct BaconDeviceMatch {
+  BaconDevice *device;
+  BaconBoolean fullname_match;
+  BaconBoolean codename_match;
+  int distance;
+};
+
 BaconDeviceList *bacon_device_list_new (BaconBoolean local);
 void bacon_device_list_destroy (BaconDeviceList *list);
 int bacon_device_list_total (BaconDeviceList *list);
 BaconBoolean bacon_device_is_valid_id (BaconDeviceList *list, const char *id);
 BaconDevice *bacon_device_get_device_from_id (BaconDeviceList *list,
                                               const char *id);
+BaconDeviceMatch *bacon_device_find (BaconDeviceList *list,
+                                     BaconSearchTokenList *tokens,
+                                     size_t *n_matches);
+BaconDeviceMatch *bacon_device_fuzzy_find (BaconDeviceList *list,
+                                           BaconSearchTokenList *tokens,
+                                           size_t max,
+                                           size_t *n_matches);
 
 #ifdef __cplusplus
 }
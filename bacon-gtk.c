@@ -26,6 +26,7 @@
 #include <curl/curl.h>
 #include <gtk/gtk.h>
 
+#include "bacon-atlas.h"
 #include "bacon-device.h"
 #include "bacon-env.h"
 #include "bacon-gtk.h"
@@ -47,6 +48,10 @@
 #define BACON_PREFERENCES_WINDOW_WIDTH  450
 #define BACON_PREFERENCES_WINDOW_HEIGHT 300
 #define BACON_ICON_VIEW_ITEM_WIDTH      200
+#define BACON_ICON_CACHE_JOBS           8
+#define BACON_ICON_CACHE_POLL_MILLIS    50
+#define BACON_ICON_LOAD_BATCH           8
+#define BACON_FILTER_DETACH_ROWS        32
 
 #define BACON_FILE_MENU_ITEM_LABEL         "File"
 #define BACON_QUIT_MENU_ITEM_LABEL         "Quit"
@@ -92,19 +97,32 @@
   BACON_DEVICE_COUNT_COLOR "\">%03i</span></b>"
 
 typedef struct BaconData           BaconData;
-typedef struct BaconThumbList      BaconThumbList;
+typedef struct BaconTask           BaconTask;
 
+/* `pixbuf' stays NULL until the device's cell is first on screen,
+   `thumb' is the file it gets decoded from (owned by s_thumbs). `iter'
+   is the device's row in s_store and `visible' whether it passes the
+   search, which is matched against the lowercased `*_key' names. */
 struct BaconData {
   BaconDevice *device;
   BaconRomList *rom_list;
+  const gchar *thumb;
   GdkPixbuf *pixbuf;
+  gchar *fullname_key;
+  gchar *codename_key;
+  GtkTreeIter iter;
+  gboolean visible;
   BaconData *next;
   BaconData *prev;
 };
 
-struct BaconThumbList {
-  const char *name;
-  BaconThumbList *next;
+/* Network work for the worker thread: `work' runs there with `data',
+   `done' gets what it returns back in the main loop */
+struct BaconTask {
+  gpointer (*work) (gpointer data);
+  void (*done) (gpointer result);
+  gpointer data;
+  gpointer result;
 };
 
 typedef enum {
@@ -120,6 +138,8 @@ enum {
   DEVICE_FULLNAME_COLUMN,
   DEVICE_CODENAME_COLUMN,
   DEVICE_PIXBUF_COLUMN,
+  DEVICE_DATA_COLUMN,
+  DEVICE_VISIBLE_COLUMN,
   N_COLUMNS
 };
 
@@ -127,7 +147,9 @@ extern BaconDeviceList * g_device_list;
 extern char *            g_program_data_path;
 static BaconProgressType s_progress_type      = BACON_PROGRESS_TYPE_NONE;
 static BaconDevice *     s_device             = NULL;
-static BaconThumbList *  s_thumbs             = NULL;
+static GHashTable *      s_thumbs             = NULL;
+static GdkPixbuf *       s_fallback_pixbuf    = NULL;
+static guint             s_icon_load_source   = 0;
 static BaconData *       s_data               = NULL;
 static GtkWindow *       s_progress_window    = NULL;
 static GtkProgressBar *  s_progress_bar       = NULL;
@@ -135,21 +157,34 @@ static GtkEntryBuffer *  s_entry_buffer       = NULL;
 static GtkIconView *     s_icon_view          = NULL;
 static GtkLabel *        s_device_count_label = NULL;
 static GtkTreeModel *    s_model              = NULL;
+static GtkListStore *    s_store              = NULL;
+static BaconData **      s_matches            = NULL;
+static gint              s_n_matches          = 0;
+static gint              s_n_data             = 0;
+static gchar *           s_filter_text        = NULL;
 static GtkWindow *       s_window             = NULL;
 static gint              s_window_cur_width   = -1;
 static gint              s_window_cur_height  = -1;
 static gchar *           s_thumbs_path        = NULL;
 static gint              s_device_count       = 0;
+static BaconNetBatch *   s_icon_batch         = NULL;
+static BaconNetFile *    s_icon_files         = NULL;
+static gint              s_n_icon_files       = 0;
+static gboolean          s_icons_ready        = FALSE;
+static gint              s_saved_jobs         = 0;
+static gint              s_saved_host_jobs    = 0;
+static GThread *         s_task_thread        = NULL;
+
+static void bacon_set_model (void);
 
+/* Thumbnails are looked up by codename */
 static void
-bacon_add_thumb (const char *name)
+bacon_add_thumb (const char *codename, const char *filename)
 {
-  BaconThumbList *n;
-
-  n = bacon_new (BaconThumbList);
-  n->name = name;
-  n->next = s_thumbs;
-  s_thumbs = n;
+  if (!s_thumbs)
+    s_thumbs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, g_free);
+  g_hash_table_replace (s_thumbs, g_strdup (codename), g_strdup (filename));
 }
 
 static char *
@@ -272,96 +307,246 @@ bacon_update_progress_bar (gdouble total, gdouble current)
   gtk_progress_bar_set_fraction (s_progress_bar, fraction);
 }
 
+static gboolean
+bacon_task_done (gpointer data)
+{
+  BaconTask *task;
+
+  task = (BaconTask *) data;
+  g_thread_join (s_task_thread);
+  s_task_thread = NULL;
+  task->done (task->result);
+  bacon_free (task);
+  return FALSE;
+}
+
+static gpointer
+bacon_task_run (gpointer data)
+{
+  BaconTask *task;
+
+  task = (BaconTask *) data;
+  task->result = task->work (task->data);
+  g_idle_add (bacon_task_done, task);
+  return NULL;
+}
+
+/* Runs `work' on a thread of its own so the window keeps drawing while
+   it waits on the network. There is only ever one task at a time, the
+   net layer is not shared between threads. Returns false if one is
+   still running. */
+static gboolean
+bacon_task_start (gpointer (*work) (gpointer),
+                  gpointer data,
+                  void (*done) (gpointer))
+{
+  BaconTask *task;
+
+  if (s_task_thread)
+    return FALSE;
+
+  task = bacon_new (BaconTask);
+  task->work = work;
+  task->done = done;
+  task->data = data;
+  task->result = NULL;
+#if GLIB_CHECK_VERSION (2, 32, 0)
+  s_task_thread = g_thread_new ("bacon-net", bacon_task_run, task);
+#else
+  s_task_thread = g_thread_create (bacon_task_run, task, TRUE, NULL);
+#endif
+  if (!s_task_thread) {
+    g_warning ("failed to start network thread");
+    bacon_free (task);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* A thumbnail that did not make it is not left behind half written,
+   or it would never be fetched again */
 static void
-bacon_init_icon_cache (void)
+bacon_free_icon_files (void)
+{
+  gint x;
+
+  for (x = 0; x < s_n_icon_files; ++x) {
+    if (!s_icon_files[x].ok)
+      bacon_env_delete (s_icon_files[x].filename);
+    g_free ((gchar *) s_icon_files[x].filename);
+  }
+  bacon_free (s_icon_files);
+  s_icon_files = NULL;
+  s_n_icon_files = 0;
+}
+
+/* Ends the thumbnail downloads and gives the net layer back the limits
+   it had before them */
+static gboolean
+bacon_icon_batch_finish (void)
+{
+  gboolean ok;
+
+  ok = bacon_net_batch_finish (s_icon_batch);
+  s_icon_batch = NULL;
+  bacon_net_set_limits (s_saved_jobs, s_saved_host_jobs);
+  bacon_free_icon_files ();
+  return ok;
+}
+
+static void
+bacon_icon_cache_ready (void)
+{
+  s_icons_ready = TRUE;
+  gtk_window_set_auto_startup_notification (TRUE);
+  bacon_set_model ();
+}
+
+/* Moves the thumbnail downloads along from the main loop, the device
+   view is filled in once they are all over */
+static gboolean
+bacon_icon_cache_poll (gpointer user_data)
+{
+  int done;
+
+  done = 0;
+  if (bacon_net_batch_step (s_icon_batch, &done)) {
+    bacon_update_progress_bar ((gdouble) s_n_icon_files, (gdouble) done);
+    return TRUE;
+  }
+
+  if (!bacon_icon_batch_finish ())
+    g_warning ("failed to download some icons from %s",
+               BACON_DEVICE_ICON_THUMB_URL);
+  bacon_finish_progress_window ();
+  bacon_icon_cache_ready ();
+  return FALSE;
+}
+
+/* Runs on the worker thread */
+static gpointer
+bacon_fetch_device_thumbs (gpointer device_list)
 {
-  guint x;
-  guint icons_needed;
-  guint icons_total;
   char *data;
-  char *iconpath;
-  BaconDeviceThumbRequestList *p;
   BaconDeviceThumbRequestList *thumbs;
 
-  data = NULL;
   thumbs = NULL;
-
   if (bacon_net_init_for_device_icons ()) {
     data = bacon_net_get_page_data ();
     if (data)
-      thumbs =
-        bacon_parse_for_device_thumb_request_list (data, g_device_list);
+      thumbs = bacon_parse_for_device_thumb_request_list (
+          data, (BaconDeviceList *) device_list);
     bacon_net_deinit ();
   }
+  return thumbs;
+}
+
+/* Missing thumbnails are downloads of their own, a few at a time, that
+   run from the main loop. s_icon_batch is set while they do. */
+static void
+bacon_device_thumbs_fetched (gpointer result)
+{
+  gint icons_total;
+  char *iconpath;
+  BaconDeviceThumbRequestList *p;
+  BaconDeviceThumbRequestList *thumbs;
 
+  thumbs = (BaconDeviceThumbRequestList *) result;
   bacon_set_thumbs_path ();
-  icons_needed = 0;
   icons_total = 0;
+  for (p = thumbs; p; p = p->next)
+    icons_total++;
 
+  s_n_icon_files = 0;
+  s_icon_files = bacon_newa (BaconNetFile,
+                             sizeof (BaconNetFile) * (icons_total + 1));
   for (p = thumbs; p; p = p->next) {
-    bacon_add_thumb (p->filename);
+    bacon_add_thumb (p->codename, p->filename);
     iconpath = bacon_full_icon_path (p->filename);
-    icons_total++;
-    if (!bacon_env_is_file (iconpath))
-      icons_needed++;
-    g_free (iconpath);
-    if (!p->next)
-      break;
-  }
-
-  g_message ("total icons: %i needed icons:%i", icons_total, icons_needed);
-
-  if (icons_needed) {
-    if (icons_needed >= (icons_total / 3))
-      bacon_init_progress_window (BACON_PROGRESS_TYPE_LONG_ICON_CACHE);
-    else
-      bacon_init_progress_window (BACON_PROGRESS_TYPE_ICON_CACHE);
-    x = 0;
-    for (p = thumbs; p; p = p->next) {
-      iconpath = bacon_full_icon_path (p->filename);
-      if (!bacon_env_is_file (iconpath)) {
-        g_message ("downloading icon `%s'\n", iconpath);
-        if (bacon_net_init_for_device_icon_thumb (p->request, iconpath)) {
-          if (!bacon_net_get_file ())
-            g_warning ("failed to download icon from %s/%s\n",
-                        BACON_DEVICE_ICON_THUMB_URL, p->request);
-          x++;
-          bacon_net_deinit ();
-        }
-        bacon_update_progress_bar ((gdouble) icons_needed, (gdouble) x);
-        while (gtk_events_pending ())
-          gtk_main_iteration ();
-      }
+    if (bacon_env_is_file (iconpath)) {
       g_free (iconpath);
-      if (!p->next)
-        break;
+      continue;
     }
-    bacon_finish_progress_window ();
+    memset (&s_icon_files[s_n_icon_files], 0, sizeof (BaconNetFile));
+    s_icon_files[s_n_icon_files].request = p->request;
+    s_icon_files[s_n_icon_files].filename = iconpath;
+    s_n_icon_files++;
+  }
+
+  g_message ("total icons: %i needed icons:%i", icons_total, s_n_icon_files);
+
+  if (s_n_icon_files) {
+    bacon_net_get_limits (&s_saved_jobs, &s_saved_host_jobs);
+    bacon_net_set_limits (BACON_ICON_CACHE_JOBS, BACON_ICON_CACHE_JOBS);
+    s_icon_batch = bacon_net_batch_new (BACON_DEVICE_ICON_THUMB_URL,
+                                        s_icon_files, s_n_icon_files);
+    if (!s_icon_batch)
+      bacon_net_set_limits (s_saved_jobs, s_saved_host_jobs);
   }
+  if (!s_icon_batch) {
+    bacon_free_icon_files ();
+    bacon_icon_cache_ready ();
+    return;
+  }
+
+  if (s_n_icon_files >= (icons_total / 3))
+    bacon_init_progress_window (BACON_PROGRESS_TYPE_LONG_ICON_CACHE);
+  else
+    bacon_init_progress_window (BACON_PROGRESS_TYPE_ICON_CACHE);
+  g_timeout_add (BACON_ICON_CACHE_POLL_MILLIS, bacon_icon_cache_poll, NULL);
 }
 
 static void
-bacon_init_data (void)
+bacon_init_icon_cache (void)
 {
-  gchar *iconpath;
-  GError *error;
-  BaconData *dp;
-  BaconDeviceList *p;
-  BaconThumbList *tp;
+  if (s_icon_batch || s_task_thread)
+    return;
+  /* without a thread to fetch them every device gets the fallback */
+  if (bacon_task_start (bacon_fetch_device_thumbs, g_device_list,
+                        bacon_device_thumbs_fetched))
+    gtk_window_set_auto_startup_notification (FALSE);
+  else
+    bacon_icon_cache_ready ();
+}
 
-  error = NULL;
+/* The inline fallback is decoded once and shared by every device that
+   has no thumbnail of its own */
+static GdkPixbuf *
+bacon_fallback_pixbuf (void)
+{
+  GError *error;
 
-  for (p = g_device_list; p; p = p->next) {
-    bacon_list_append (BaconData, s_data, dp);
-    dp->device = p->device;
-    tp = s_thumbs;
-    while (tp) {
-      if (strstr (tp->name, dp->device->codename))
-        break;
-      tp = tp->next;
+  if (!s_fallback_pixbuf) {
+    error = NULL;
+    s_fallback_pixbuf = gdk_pixbuf_new_from_inline (-1, s_fallback_device_icon,
+                                                    FALSE, &error);
+    if (error) {
+      g_warning ("failed to create pixbuf from inline: %s", error->message);
+      g_error_free (error);
+      s_fallback_pixbuf = NULL;
     }
-    if (tp && tp->name && *tp->name) {
-      iconpath = bacon_full_icon_path (tp->name);
+  }
+  return s_fallback_pixbuf;
+}
+
+/* The atlas has the icon already scaled as long as its thumbnail has
+   not changed since, otherwise it is scaled here and kept for the next
+   atlas */
+static void
+bacon_load_device_icon (BaconData *dp)
+{
+  gchar *iconpath;
+  GError *error;
+  struct stat s;
+
+  if (dp->thumb) {
+    iconpath = bacon_full_icon_path (dp->thumb);
+    memset (&s, 0, sizeof (struct stat));
+    if (stat (iconpath, &s) == 0)
+      dp->pixbuf = bacon_atlas_lookup (dp->device->codename,
+                                       (gint64) s.st_mtime);
+    if (!dp->pixbuf) {
+      error = NULL;
       dp->pixbuf =
         gdk_pixbuf_new_from_file_at_scale (iconpath,
                                            BACON_DEVICE_ICON_SCALE_WIDTH,
@@ -371,43 +556,149 @@ bacon_init_data (void)
         g_warning ("failed to create pixbuf from `%s': %s",
                    iconpath, error->message);
         g_error_free (error);
-      }
-      g_free (iconpath);
-    } else {
-      dp->pixbuf = gdk_pixbuf_new_from_inline (-1, s_fallback_device_icon,
-                                               FALSE, &error);
-      if (error) {
-        g_warning ("failed to create pixbuf from inline: %s", error->message);
-        g_error_free (error);
         dp->pixbuf = NULL;
-      }
+      } else
+        bacon_atlas_add (dp->device->codename, (gint64) s.st_mtime,
+                         dp->pixbuf);
     }
+    g_free (iconpath);
+  }
+  if (!dp->pixbuf && bacon_fallback_pixbuf ())
+    dp->pixbuf = g_object_ref (s_fallback_pixbuf);
+}
+
+/* Nothing is decoded here, only matched up with its thumbnail file */
+static void
+bacon_init_data (void)
+{
+  gchar *atlaspath;
+  BaconData *dp;
+  BaconDeviceList *p;
+
+  if (s_thumbs_path) {
+    atlaspath = bacon_full_icon_path (BACON_ATLAS_FILENAME);
+    bacon_atlas_open (atlaspath,
+                      BACON_DEVICE_ICON_SCALE_WIDTH,
+                      BACON_DEVICE_ICON_SCALE_HEIGHT);
+    g_free (atlaspath);
+  }
+
+  for (p = g_device_list; p; p = p->next) {
+    bacon_list_append (BaconData, s_data, dp);
+    dp->device = p->device;
+    dp->fullname_key = g_ascii_strdown (p->device->fullname, -1);
+    dp->codename_key = g_ascii_strdown (p->device->codename, -1);
+    dp->visible = TRUE;
+    dp->thumb = NULL;
+    if (s_thumbs)
+      dp->thumb = g_hash_table_lookup (s_thumbs, dp->device->codename);
+    dp->pixbuf = NULL;
+    if (!dp->thumb)
+      bacon_load_device_icon (dp);
     dp->rom_list = NULL;
     bacon_list_rewind (s_data, dp);
     if (!p->next)
       break;
   }
+}
+
+/* Decodes the icons of the cells that are on screen, a few at a time so
+   scrolling does not stall */
+static gboolean
+bacon_load_visible_icons (gpointer user_data)
+{
+  gint x;
+  gint first;
+  gint last;
+  gint loaded;
+  GtkTreeIter iter;
+  GtkTreePath *start;
+  GtkTreePath *end;
+  BaconData *dp;
+
+  if (!s_icon_view || !s_model ||
+      !gtk_icon_view_get_visible_range (s_icon_view, &start, &end))
+  {
+    s_icon_load_source = 0;
+    return FALSE;
+  }
 
-  if (error)
-    g_error_free (error);
+  first = gtk_tree_path_get_indices (start)[0];
+  last = gtk_tree_path_get_indices (end)[0];
+  gtk_tree_path_free (start);
+  gtk_tree_path_free (end);
+
+  loaded = 0;
+  if (gtk_tree_model_iter_nth_child (s_model, &iter, NULL, first)) {
+    for (x = first; x <= last; ++x) {
+      gtk_tree_model_get (s_model, &iter, DEVICE_DATA_COLUMN, &dp, -1);
+      if (dp && !dp->pixbuf) {
+        bacon_load_device_icon (dp);
+        gtk_list_store_set (s_store, &dp->iter,
+                            DEVICE_PIXBUF_COLUMN, dp->pixbuf, -1);
+        if (++loaded == BACON_ICON_LOAD_BATCH)
+          return TRUE;
+      }
+      if (!gtk_tree_model_iter_next (s_model, &iter))
+        break;
+    }
+  }
+  s_icon_load_source = 0;
+  return FALSE;
 }
 
 static void
-bacon_refresh_device_list (void)
+bacon_queue_icon_load (void)
+{
+  if (!s_icon_load_source)
+    s_icon_load_source = g_idle_add (bacon_load_visible_icons, NULL);
+}
+
+static void
+bacon_on_scrolled (GtkAdjustment *adjustment, gpointer user_data)
+{
+  bacon_queue_icon_load ();
+}
+
+/* Runs on the worker thread */
+static gpointer
+bacon_fetch_device_list (gpointer progress_bar)
 {
   char *data;
+  BaconDeviceList *list;
 
-  if (g_device_list)
-    bacon_device_list_destroy (g_device_list);
-  data = NULL;
-  bacon_init_progress_window (BACON_PROGRESS_TYPE_DEVICE_LIST);
-  if (bacon_net_gtk_init_for_device_list (s_progress_bar)) {
+  list = NULL;
+  if (bacon_net_gtk_init_for_device_list (GTK_PROGRESS_BAR (progress_bar))) {
     data = bacon_net_get_page_data ();
     if (data)
-      g_device_list = bacon_parse_for_device_list (data, BACON_FALSE);
+      list = bacon_parse_for_device_list (data, BACON_FALSE);
     bacon_net_deinit ();
   }
+  return list;
+}
+
+static void
+bacon_device_list_fetched (gpointer result)
+{
+  g_device_list = (BaconDeviceList *) result;
   bacon_finish_progress_window ();
+  if (g_device_list)
+    bacon_set_model ();
+}
+
+static void
+bacon_refresh_device_list (void)
+{
+  if (s_task_thread)
+    return;
+  if (g_device_list) {
+    bacon_device_list_destroy (g_device_list);
+    g_device_list = NULL;
+  }
+  bacon_init_progress_window (BACON_PROGRESS_TYPE_DEVICE_LIST);
+  if (!bacon_task_start (bacon_fetch_device_list, s_progress_bar,
+                         bacon_device_list_fetched))
+    bacon_finish_progress_window ();
 }
 
 static gint
@@ -482,66 +773,179 @@ bacon_set_icon_view_attributes (void)
                               BACON_ICON_VIEW_ITEM_WIDTH));
 }
 
+/* Every device gets a row once, the search only flips their visible
+   column underneath the filter that the icon view shows */
 static void
-bacon_set_model (void)
+bacon_init_store (void)
 {
   gchar *display_name;
-  gchar *label_markup;
-  GtkTreeIter iter;
-  GtkListStore *store;
   BaconData *p;
-  BaconSearchTokenList *search_list;
-
-  if (!g_device_list)
-    bacon_refresh_device_list ();
 
-  if (!s_data) {
-    if (!s_thumbs) {
-      gtk_window_set_auto_startup_notification (FALSE);
-      bacon_init_icon_cache ();
-      gtk_window_set_auto_startup_notification (TRUE);
-    }
-    bacon_init_data ();
+  s_store = gtk_list_store_new (N_COLUMNS,
+                                G_TYPE_STRING,
+                                G_TYPE_STRING,
+                                G_TYPE_STRING,
+                                GDK_TYPE_PIXBUF,
+                                G_TYPE_POINTER,
+                                G_TYPE_BOOLEAN);
+  s_n_data = 0;
+  for (p = s_data; p; p = p->next) {
+    s_n_data++;
+    if (!p->next)
+      break;
   }
+  s_matches = bacon_newa (BaconData *, sizeof (BaconData *) * (s_n_data + 1));
 
-  display_name = NULL;
-  store = gtk_list_store_new (N_COLUMNS,
-                              G_TYPE_STRING,
-                              G_TYPE_STRING,
-                              G_TYPE_STRING,
-                              GDK_TYPE_PIXBUF);
-  s_device_count = 0;
-  search_list =
-    bacon_search_token_list_new (gtk_entry_buffer_get_text (s_entry_buffer));
-
+  s_n_matches = 0;
   for (p = s_data; p; p = p->next) {
-    if (search_list &&
-        ((bacon_search (p->device->fullname, search_list) !=
-          BACON_SEARCH_RESULT_ALL_MATCHES) &&
-         (bacon_search (p->device->codename, search_list) !=
-          BACON_SEARCH_RESULT_ALL_MATCHES)))
-      continue;
-    s_device_count++;
     display_name = g_markup_printf_escaped (BACON_DISPLAY_NAME_MARKUP_FORMAT,
                                             p->device->fullname,
                                             p->device->codename);
-    gtk_list_store_append (store, &iter);
-    gtk_list_store_set (store, &iter,
+    gtk_list_store_append (s_store, &p->iter);
+    gtk_list_store_set (s_store, &p->iter,
                         DEVICE_DISPLAY_NAME_COLUMN, display_name,
                         DEVICE_FULLNAME_COLUMN, p->device->fullname,
                         DEVICE_CODENAME_COLUMN, p->device->codename,
-                        DEVICE_PIXBUF_COLUMN, p->pixbuf, -1);
+                        DEVICE_PIXBUF_COLUMN,
+                        p->pixbuf ? p->pixbuf : bacon_fallback_pixbuf (),
+                        DEVICE_DATA_COLUMN, p,
+                        DEVICE_VISIBLE_COLUMN, TRUE, -1);
     g_free (display_name);
+    p->visible = TRUE;
+    s_matches[s_n_matches++] = p;
     if (!p->next)
       break;
   }
 
-  bacon_search_token_list_free (search_list);
+  s_model = gtk_tree_model_filter_new (GTK_TREE_MODEL (s_store), NULL);
+  gtk_tree_model_filter_set_visible_column (GTK_TREE_MODEL_FILTER (s_model),
+                                            DEVICE_VISIBLE_COLUMN);
+}
+
+static gboolean
+bacon_key_has_tokens (const gchar *key, BaconSearchTokenList *tokens)
+{
+  BaconSearchTokenList *p;
 
-  s_model = GTK_TREE_MODEL (store);
-  if (s_icon_view) {
+  for (p = tokens; p; p = p->next) {
+    if (!strstr (key, p->token))
+      return FALSE;
+    if (!p->next)
+      break;
+  }
+  return TRUE;
+}
+
+/* A device stays if every token is in its full name, or every token is
+   in its codename */
+static gboolean
+bacon_data_matches (const BaconData *dp, BaconSearchTokenList *tokens)
+{
+  return (bacon_key_has_tokens (dp->fullname_key, tokens) ||
+          bacon_key_has_tokens (dp->codename_key, tokens));
+}
+
+/* Text typed onto the end of the last search can only narrow it, so only
+   the devices that matched then are looked at again. Anything else goes
+   over every device. */
+static void
+bacon_filter_devices (void)
+{
+  gint i;
+  gint x;
+  gint n_changed;
+  gboolean narrow;
+  gboolean detach;
+  const gchar *text;
+  BaconData *p;
+  BaconData **changed;
+  BaconSearchTokenList *tokens;
+
+  text = s_entry_buffer ? gtk_entry_buffer_get_text (s_entry_buffer) : "";
+  if (s_filter_text && g_str_equal (text, s_filter_text))
+    return;
+
+  narrow = (s_filter_text && g_str_has_prefix (text, s_filter_text));
+  g_free (s_filter_text);
+  s_filter_text = g_strdup (text);
+  tokens = bacon_search_token_list_new (text);
+
+  x = 0;
+  n_changed = 0;
+  changed = bacon_newa (BaconData *, sizeof (BaconData *) * (s_n_data + 1));
+  if (narrow) {
+    for (i = 0; i < s_n_matches; ++i) {
+      p = s_matches[i];
+      if (bacon_data_matches (p, tokens))
+        s_matches[x++] = p;
+      else {
+        p->visible = FALSE;
+        changed[n_changed++] = p;
+      }
+    }
+  } else {
+    for (p = s_data; p; p = p->next) {
+      if (bacon_data_matches (p, tokens)) {
+        s_matches[x++] = p;
+        if (!p->visible) {
+          p->visible = TRUE;
+          changed[n_changed++] = p;
+        }
+      } else if (p->visible) {
+        p->visible = FALSE;
+        changed[n_changed++] = p;
+      }
+      if (!p->next)
+        break;
+    }
+  }
+  s_n_matches = x;
+  bacon_search_token_list_free (tokens);
+
+  /* the icon view takes filter changes one row at a time, past a few
+     rows it is cheaper to lay the whole model out again */
+  detach = (s_icon_view && (n_changed > BACON_FILTER_DETACH_ROWS) &&
+            (gtk_icon_view_get_model (s_icon_view) == s_model));
+  if (detach)
+    gtk_icon_view_set_model (s_icon_view, NULL);
+  for (i = 0; i < n_changed; ++i)
+    gtk_list_store_set (s_store, &changed[i]->iter,
+                        DEVICE_VISIBLE_COLUMN, changed[i]->visible, -1);
+  if (detach)
     gtk_icon_view_set_model (s_icon_view, s_model);
+  bacon_free (changed);
+}
+
+static void
+bacon_set_model (void)
+{
+  gchar *label_markup;
+
+  /* the network work is done elsewhere, each step comes back here once
+     it is over */
+  if (!g_device_list) {
+    bacon_refresh_device_list ();
+    return;
+  }
+
+  if (!s_data) {
+    if (!s_icons_ready) {
+      bacon_init_icon_cache ();
+      return;
+    }
+    bacon_init_data ();
+  }
+
+  if (!s_store)
+    bacon_init_store ();
+  bacon_filter_devices ();
+  s_device_count = s_n_matches;
+
+  if (s_icon_view) {
+    if (gtk_icon_view_get_model (s_icon_view) != s_model)
+      gtk_icon_view_set_model (s_icon_view, s_model);
     bacon_set_icon_view_attributes ();
+    bacon_queue_icon_load ();
   }
 
   if (s_device_count_label) {
@@ -1036,8 +1440,15 @@ bacon_init_main_window (void)
   gtk_icon_view_set_selection_mode (s_icon_view, GTK_SELECTION_SINGLE);
   gtk_widget_set_has_tooltip (GTK_WIDGET (s_icon_view), TRUE);
   bacon_set_icon_view_attributes ();
-  gtk_scrolled_window_add_with_viewport
-    (GTK_SCROLLED_WINDOW (scrolled_window), GTK_WIDGET (s_icon_view));
+  /* the icon view scrolls itself, so it knows which items are visible */
+  gtk_container_add (GTK_CONTAINER (scrolled_window),
+                     GTK_WIDGET (s_icon_view));
+
+  g_signal_connect (G_OBJECT (gtk_scrolled_window_get_vadjustment (
+                                GTK_SCROLLED_WINDOW (scrolled_window))),
+                    "value-changed",
+                    G_CALLBACK (bacon_on_scrolled),
+                    NULL);
 
   g_signal_connect (G_OBJECT (s_icon_view),
                     "button-press-event",
@@ -1059,27 +1470,47 @@ bacon_init_main_window (void)
 void
 bacon_gtk_main (int *argc, char ***argv)
 {
-  BaconThumbList *p;
-
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+#endif
   gtk_init (argc, argv);
   bacon_init_main_window ();
   gtk_main ();
 
+  /* a task still on its way keeps the net layer until it is over, it is
+     told to stop first so the window doesn't wait out a slow server */
+  if (s_task_thread) {
+    bacon_net_gtk_cancel ();
+    g_thread_join (s_task_thread);
+  }
+  if (s_icon_batch)
+    bacon_icon_batch_finish ();
+  if (s_icon_load_source)
+    g_source_remove (s_icon_load_source);
+  bacon_atlas_close ();
   bacon_free (s_thumbs_path);
+  if (s_thumbs)
+    g_hash_table_destroy (s_thumbs);
 
-  while (s_thumbs) {
-    p = s_thumbs->next;
-    bacon_free (s_thumbs);
-    s_thumbs = p;
-  }
+  if (s_model)
+    g_object_unref (s_model);
+  if (s_store)
+    g_object_unref (s_store);
+  bacon_free (s_matches);
+  g_free (s_filter_text);
 
   for (; s_data; s_data = s_data->next) {
     if (s_data->pixbuf)
       g_object_unref (s_data->pixbuf);
+    g_free (s_data->fullname_key);
+    g_free (s_data->codename_key);
     bacon_rom_list_destroy (s_data->rom_list);
     if (!s_data->next)
       break;
   }
+  if (s_fallback_pixbuf)
+    g_object_unref (s_fallback_pixbuf);
 }
 #endif /* BACON_GTK */
 
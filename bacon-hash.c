@@ -18,7 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  * The methods of generating an MD5 message digest below were derived from
- * the RSA Data Security, Inc. MD5 Message-Digest Algorithm.
+ * the RSA Data Security, Inc. MD5 Message-Digest Algorithm. SHA-1 and
+ * SHA-256 live in bacon-sha.c and share the buffering done here.
  */
 
 #include "bacon.h"
@@ -26,13 +27,29 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#if defined (HAVE_MMAP) && defined (HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define BACON_HASH_USE_MMAP 1
+#endif
 
 #include "bacon-env.h"
 #include "bacon-hash.h"
 #include "bacon-out.h"
+#include "bacon-sha.h"
 #include "bacon-str.h"
 #include "bacon-util.h"
 
+#define BACON_HASH_STATE_SUFFIX  ".hashstate"
+#define BACON_HASH_STATE_VERSION 2
+#define BACON_HASH_CACHE_FILENAME "hashcache.txt"
+#define BACON_HASH_CACHE_VERSION  3
+#define BACON_HASH_CACHE_MAX      1024
+#define BACON_HASH_READ_SIZE      (256 * 1024)
+#define BACON_HASH_MAP_SIZE       (64UL * 1024UL * 1024UL)
+
 #define S11 7
 #define S12 12
 #define S13 17
@@ -84,11 +101,35 @@
     (a) += (b);                            \
   } while (BACON_FALSE)
 
+/* A file is identified by where it lives and when it last changed, so a
+   cached digest goes stale by itself as soon as the file is touched. The
+   nanoseconds and ctime catch rewrites within the same second, or ones
+   that put the old mtime back afterwards. */
 typedef struct {
-  unsigned int state[4];
-  unsigned int count[2];
-  unsigned char buffer[64];
-} BaconMd5Ctx;
+  unsigned long dev;
+  unsigned long ino;
+  unsigned long size;
+  long mtime;
+  long mtime_nsec;
+  long ctime;
+  BaconHash hash;
+} BaconHashCacheEntry;
+
+typedef struct {
+  const char *name;
+  size_t digest_size;
+  BaconBoolean big_endian;
+  unsigned int init[8];
+  void (*transform) (unsigned int *state,
+                     const unsigned char *blocks,
+                     size_t n_blocks);
+} BaconHashAlgorithm;
+
+extern char *g_program_data_path;
+
+static BaconHashCacheEntry *s_cache        = NULL;
+static int                  s_n_cache      = 0;
+static BaconBoolean         s_cache_loaded = BACON_FALSE;
 
 static unsigned char s_padding[64] = {
   0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -99,22 +140,34 @@ static unsigned char s_padding[64] = {
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/* MD5 stores its words little endian, the SHA family big endian */
 static void
-bacon_hash_encode (unsigned char *o, unsigned int *i, unsigned int n)
+bacon_hash_encode (unsigned char *o,
+                   const unsigned int *i,
+                   size_t n,
+                   BaconBoolean big_endian)
 {
-  unsigned int x;
-  unsigned int y;
+  size_t x;
+  size_t y;
 
   for (x = 0, y = 0; y < n; x++, y += 4) {
-    o[y] = (unsigned char) (i[x] & 0xff);
-    o[y + 1] = (unsigned char) ((i[x] >> 8) & 0xff);
-    o[y + 2] = (unsigned char) ((i[x] >> 16) & 0xff);
-    o[y + 3] = (unsigned char) ((i[x] >> 24) & 0xff);
+    if (big_endian) {
+      o[y] = (unsigned char) ((i[x] >> 24) & 0xff);
+      o[y + 1] = (unsigned char) ((i[x] >> 16) & 0xff);
+      o[y + 2] = (unsigned char) ((i[x] >> 8) & 0xff);
+      o[y + 3] = (unsigned char) (i[x] & 0xff);
+    } else {
+      o[y] = (unsigned char) (i[x] & 0xff);
+      o[y + 1] = (unsigned char) ((i[x] >> 8) & 0xff);
+      o[y + 2] = (unsigned char) ((i[x] >> 16) & 0xff);
+      o[y + 3] = (unsigned char) ((i[x] >> 24) & 0xff);
+    }
   }
 }
 
+#ifdef WORDS_BIGENDIAN
 static void
-bacon_hash_decode (unsigned int *o, unsigned char *i, unsigned int n)
+bacon_hash_decode (unsigned int *o, const unsigned char *i, unsigned int n)
 {
   unsigned int x;
   unsigned int y;
@@ -125,9 +178,10 @@ bacon_hash_decode (unsigned int *o, unsigned char *i, unsigned int n)
            (((unsigned int) i[y + 2]) << 16) |
            (((unsigned int) i[y + 3]) << 24);
 }
+#endif
 
 static void
-bacon_hash_transform (unsigned int state[4], unsigned char block[64])
+bacon_hash_md5_block (unsigned int *state, const unsigned char *block)
 {
   unsigned int a;
   unsigned int b;
@@ -140,7 +194,12 @@ bacon_hash_transform (unsigned int state[4], unsigned char block[64])
   c = state[2];
   d = state[3];
 
+#ifdef WORDS_BIGENDIAN
   bacon_hash_decode (x, block, 64);
+#else
+  /* the block already is in MD5's (little endian) word order */
+  memcpy (x, block, 64);
+#endif
 
   FF (a, b, c, d, x[0], S11, 0xd76aa478);
   FF (d, a, b, c, x[1], S12, 0xe8c7b756);
@@ -218,23 +277,84 @@ bacon_hash_transform (unsigned int state[4], unsigned char block[64])
 }
 
 static void
-bacon_hash_init (BaconMd5Ctx *ctx)
+bacon_hash_md5_transform (unsigned int *state,
+                          const unsigned char *blocks,
+                          size_t n_blocks)
+{
+  for (; n_blocks; n_blocks--, blocks += 64)
+    bacon_hash_md5_block (state, blocks);
+}
+
+static const BaconHashAlgorithm s_algorithms[] = {
+  { "none", 0, BACON_FALSE, { 0 }, NULL },
+  {
+    "md5", 16, BACON_FALSE,
+    { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 },
+    bacon_hash_md5_transform
+  },
+  {
+    "sha1", 20, BACON_TRUE,
+    { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 },
+    bacon_sha1_transform
+  },
+  {
+    "sha256", 32, BACON_TRUE,
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    },
+    bacon_sha256_transform
+  }
+};
+
+#define BACON_HASH_N_ALGORITHMS \
+  ((int) (sizeof (s_algorithms) / sizeof (s_algorithms[0])))
+
+BaconHashType
+bacon_hash_type_from_name (const char *name)
 {
-  ctx->count[0] = 0;
-  ctx->count[1] = 0;
+  int x;
 
-  ctx->state[0] = 0x67452301;
-  ctx->state[1] = 0xefcdab89;
-  ctx->state[2] = 0x98badcfe;
-  ctx->state[3] = 0x10325476;
+  for (x = 1; x < BACON_HASH_N_ALGORITHMS; ++x)
+    if (bacon_streq (name, s_algorithms[x].name))
+      return (BaconHashType) x;
+  return BACON_HASH_NONE;
 }
 
-static void
-bacon_hash_update (BaconMd5Ctx *ctx, unsigned char *input, unsigned int n)
+const char *
+bacon_hash_name (BaconHashType type)
+{
+  return s_algorithms[type].name;
+}
+
+size_t
+bacon_hash_digest_size (BaconHashType type)
+{
+  return s_algorithms[type].digest_size;
+}
+
+void
+bacon_hash_init (BaconHashCtx *ctx, BaconHashType type)
+{
+  memset (ctx, 0, sizeof (BaconHashCtx));
+  ctx->type = type;
+  memcpy (ctx->state, s_algorithms[type].init, sizeof (ctx->state));
+  ctx->transform = s_algorithms[type].transform;
+#ifdef HAVE_SHA_NI
+  if ((type == BACON_HASH_SHA256) && bacon_sha_ni_supported ())
+    ctx->transform = bacon_sha256_transform_ni;
+#endif
+}
+
+void
+bacon_hash_update (BaconHashCtx *ctx,
+                   const unsigned char *input,
+                   unsigned int n)
 {
   unsigned int i;
   unsigned int index;
   unsigned int n_part;
+  unsigned int n_blocks;
 
   index = ((ctx->count[0] >> 3) & 0x3F);
   if ((ctx->count[0] += (n << 3)) < (n << 3))
@@ -245,78 +365,528 @@ bacon_hash_update (BaconMd5Ctx *ctx, unsigned char *input, unsigned int n)
 
   if (n >= n_part) {
     memcpy (&ctx->buffer[index], input, n_part);
-    bacon_hash_transform (ctx->state, ctx->buffer);
-    for (i = n_part; i + 63 < n; i += 64)
-      bacon_hash_transform (ctx->state, &input[i]);
+    ctx->transform (ctx->state, ctx->buffer, 1);
+    /* whole blocks go straight from the input in one call */
+    n_blocks = (n - n_part) / 64;
+    ctx->transform (ctx->state, &input[n_part], n_blocks);
+    i = n_part + n_blocks * 64;
     index = 0;
   } else
     i = 0;
   memcpy (&ctx->buffer[index], &input[i], n - i);
 }
 
-static void
-bacon_hash_update_from_file (BaconMd5Ctx *ctx, FILE *fp)
+#ifdef BACON_HASH_USE_MMAP
+/* Hashes `fd' from `offset' through a sliding window of mappings and
+   returns how far it got, which is where reading has to take over if a
+   mapping fails. */
+static unsigned long
+bacon_hash_update_from_map (BaconHashCtx *ctx, int fd, unsigned long offset)
 {
-  unsigned char buffer[1024];
-  unsigned int n;
+  long page;
+  unsigned long size;
+  unsigned long start;
+  unsigned long n;
+  unsigned char *map;
+  struct stat s;
+
+  memset (&s, 0, sizeof (struct stat));
+  if (fstat (fd, &s) != 0)
+    return offset;
+
+  page = sysconf (_SC_PAGESIZE);
+  if (page <= 0)
+    return offset;
+
+  size = (unsigned long) s.st_size;
+  while (offset < size) {
+    start = offset - (offset % ((unsigned long) page));
+    n = size - start;
+    if (n > BACON_HASH_MAP_SIZE)
+      n = BACON_HASH_MAP_SIZE;
+    map = (unsigned char *) mmap (NULL, n, PROT_READ, MAP_PRIVATE,
+                                  fd, (off_t) start);
+    if (map == MAP_FAILED)
+      break;
+#ifdef HAVE_MADVISE
+    madvise (map, n, MADV_SEQUENTIAL);
+#endif
+    bacon_hash_update (ctx, map + (offset - start),
+                       (unsigned int) (n - (offset - start)));
+    munmap (map, n);
+    offset = start + n;
+  }
+  return offset;
+}
+#endif
 
+/* Feeds `fp' from `*offset' to its end into `ctx' and advances `*offset'.
+   It never prints anything, so worker threads can use it as well. */
+static BaconBoolean
+bacon_hash_update_from_fp (BaconHashCtx *ctx, FILE *fp, unsigned long *offset)
+{
+  size_t n;
+  unsigned char *buffer;
+
+#if defined (HAVE_POSIX_FADVISE) && defined (POSIX_FADV_SEQUENTIAL)
+  posix_fadvise (fileno (fp), (off_t) *offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef BACON_HASH_USE_MMAP
+  *offset = bacon_hash_update_from_map (ctx, fileno (fp), *offset);
+#endif
+  if (*offset && (fseek (fp, (long) *offset, SEEK_SET) == -1))
+    return BACON_FALSE;
+
+  buffer = bacon_newa (unsigned char, BACON_HASH_READ_SIZE);
   while (BACON_TRUE) {
-    n = fread (buffer, 1, 1024, fp);
+    n = fread (buffer, 1, BACON_HASH_READ_SIZE, fp);
     if (!n)
       break;
-    bacon_hash_update (ctx, buffer, n);
+    bacon_hash_update (ctx, buffer, (unsigned int) n);
+    *offset += n;
   }
+  bacon_free (buffer);
+  return ferror (fp) ? BACON_FALSE : BACON_TRUE;
 }
 
-static void
-bacon_hash_final (BaconMd5Ctx *ctx,
-                  unsigned char digest[BACON_HASH_DIGEST_SIZE])
+void
+bacon_hash_update_from_file (BaconHashCtx *ctx,
+                             const char *filename,
+                             unsigned long offset)
+{
+  FILE *fp;
+#ifdef BACON_DEBUG
+  unsigned long start;
+  long millis;
+  struct timeval s;
+  struct timeval e;
+
+  start = offset;
+  bacon_get_time_of_day (&s);
+#endif
+
+  fp = bacon_env_fopen (filename, "rb");
+  if (!bacon_hash_update_from_fp (ctx, fp, &offset)) {
+    bacon_error ("failed to read `%s' (%s)", filename, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+  bacon_env_fclose (fp);
+
+#ifdef BACON_DEBUG
+  bacon_get_time_of_day (&e);
+  millis = bacon_get_millis (&s, &e);
+  bacon_debug ("%s of %lu bytes of `%s' took %li ms (%.1f MB/s)",
+               bacon_hash_name (ctx->type), offset - start, filename, millis,
+               (millis > 0) ? (((double) (offset - start)) /
+                               (1000.0 * millis)) : 0.0);
+#endif
+}
+
+void
+bacon_hash_final (BaconHashCtx *ctx, BaconHash *hash)
 {
   unsigned char bits[8];
+  unsigned int count[2];
   unsigned int index;
   unsigned int n_pad;
-
-  bacon_hash_encode (bits, ctx->count, 8);
+  const BaconHashAlgorithm *a;
+
+  a = &s_algorithms[ctx->type];
+  if (a->big_endian) {
+    count[0] = ctx->count[1];
+    count[1] = ctx->count[0];
+  } else {
+    count[0] = ctx->count[0];
+    count[1] = ctx->count[1];
+  }
+  bacon_hash_encode (bits, count, 8, a->big_endian);
   index = ((ctx->count[0] >> 3) & 0x3f);
   n_pad = (index < 56) ? (56 - index) : (120 - index);
 
   bacon_hash_update (ctx, s_padding, n_pad);
   bacon_hash_update (ctx, bits, 8);
 
-  bacon_hash_encode (digest, ctx->state, BACON_HASH_DIGEST_SIZE);
+  memset (hash, 0, sizeof (BaconHash));
+  hash->type = ctx->type;
+  bacon_hash_encode (hash->digest, ctx->state, a->digest_size, a->big_endian);
   memset ((unsigned char *) ctx, 0, sizeof (*ctx));
 }
 
-static void
-bacon_hash_from_digest (char hash[BACON_HASH_SIZE],
-                        unsigned char digest[BACON_HASH_DIGEST_SIZE])
+/* Number of bytes fed to `ctx' so far */
+unsigned long
+bacon_hash_length (const BaconHashCtx *ctx)
 {
-  unsigned int i;
+  return (((unsigned long) ctx->count[1]) << 29) | (ctx->count[0] >> 3);
+}
 
-  for (i = 0; i < BACON_HASH_DIGEST_SIZE; i++)
-    sprintf (hash + i * 2, "%02x", digest[i]);
-  hash[BACON_HASH_SIZE - 1] = '\0';
+static int
+bacon_hash_hex_value (char c)
+{
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Reads a `type' digest from its hex form. Anything that is not exactly
+   that long leaves `hash' as BACON_HASH_NONE, which never matches. */
+BaconBoolean
+bacon_hash_from_hex (BaconHash *hash, BaconHashType type, const char *hex)
+{
+  size_t x;
+  size_t n;
+  int hi;
+  int lo;
+
+  memset (hash, 0, sizeof (BaconHash));
+  n = bacon_hash_digest_size (type);
+  if (!n || (strlen (hex) != n * 2))
+    return BACON_FALSE;
+
+  for (x = 0; x < n; ++x) {
+    hi = bacon_hash_hex_value (hex[x * 2]);
+    lo = bacon_hash_hex_value (hex[x * 2 + 1]);
+    if ((hi < 0) || (lo < 0)) {
+      memset (hash, 0, sizeof (BaconHash));
+      return BACON_FALSE;
+    }
+    hash->digest[x] = (unsigned char) ((hi << 4) | lo);
+  }
+  hash->type = type;
+  return BACON_TRUE;
 }
 
+/* Writes the hex form of `hash' to `hex', which must have room for
+   BACON_HASH_HEX_SIZE characters */
 void
-bacon_hash_from_file (BaconHash *hash, const char *path)
+bacon_hash_to_hex (const BaconHash *hash, char *hex)
 {
-  unsigned char digest[BACON_HASH_DIGEST_SIZE];
+  static const char digits[] = "0123456789abcdef";
+  size_t x;
+  size_t n;
+
+  n = bacon_hash_digest_size (hash->type);
+  for (x = 0; x < n; ++x) {
+    hex[x * 2] = digits[hash->digest[x] >> 4];
+    hex[x * 2 + 1] = digits[hash->digest[x] & 0x0f];
+  }
+  hex[n * 2] = '\0';
+}
+
+static char *
+bacon_hash_state_path (const char *filename)
+{
+  return bacon_strf ("%s%s", filename, BACON_HASH_STATE_SUFFIX);
+}
+
+/* The intermediate state of a download's hash is kept next to it so that
+   a resumed download only has to hash the bytes it has not seen yet. It is
+   only picked up if it was made by the same kind of hash as `ctx'. */
+BaconBoolean
+bacon_hash_load_state (BaconHashCtx *ctx, const char *filename)
+{
+  int x;
+  int version;
+  unsigned int byte;
+  char name[16];
+  char *path;
   FILE *fp;
-  BaconMd5Ctx ctx;
-
-  fp = bacon_env_fopen (path, "rb");
-  memset (&ctx, 0, sizeof (BaconMd5Ctx));
-  bacon_hash_init (&ctx);
-  bacon_hash_update_from_file (&ctx, fp);
-  bacon_hash_final (&ctx, digest);
-  bacon_hash_from_digest (hash->hash, digest);
+  BaconHashCtx loaded;
+
+  path = bacon_hash_state_path (filename);
+  fp = fopen (path, "r");
+  bacon_free (path);
+  if (!fp)
+    return BACON_FALSE;
+
+  loaded = *ctx;
+  if ((fscanf (fp, "%i %15s", &version, name) != 2) ||
+      (version != BACON_HASH_STATE_VERSION) ||
+      (bacon_hash_type_from_name (name) != ctx->type))
+  {
+    bacon_env_fclose (fp);
+    return BACON_FALSE;
+  }
+
+  for (x = 0; x < 8; ++x) {
+    if (fscanf (fp, "%x", &loaded.state[x]) != 1) {
+      bacon_env_fclose (fp);
+      return BACON_FALSE;
+    }
+  }
+
+  if (fscanf (fp, "%x %x", &loaded.count[0], &loaded.count[1]) != 2) {
+    bacon_env_fclose (fp);
+    return BACON_FALSE;
+  }
+
+  for (x = 0; x < 64; ++x) {
+    if (fscanf (fp, "%2x", &byte) != 1) {
+      bacon_env_fclose (fp);
+      return BACON_FALSE;
+    }
+    loaded.buffer[x] = (unsigned char) byte;
+  }
   bacon_env_fclose (fp);
+  *ctx = loaded;
+  return BACON_TRUE;
 }
 
+void
+bacon_hash_save_state (const BaconHashCtx *ctx, const char *filename)
+{
+  int x;
+  char *path;
+  FILE *fp;
+
+  path = bacon_hash_state_path (filename);
+  fp = fopen (path, "w");
+  if (!fp) {
+    bacon_debug ("failed to save `%s' (%s)", path, strerror (errno));
+    bacon_free (path);
+    return;
+  }
+  bacon_free (path);
+
+  fprintf (fp, "%i %s", BACON_HASH_STATE_VERSION, bacon_hash_name (ctx->type));
+  for (x = 0; x < 8; ++x)
+    fprintf (fp, " %08x", ctx->state[x]);
+  bacon_foutln (fp, " %08x %08x", ctx->count[0], ctx->count[1]);
+  for (x = 0; x < 64; ++x)
+    fprintf (fp, "%02x", ctx->buffer[x]);
+  fputc ('\n', fp);
+  bacon_env_fclose (fp);
+}
+
+void
+bacon_hash_delete_state (const char *filename)
+{
+  char *path;
+
+  path = bacon_hash_state_path (filename);
+  bacon_env_delete (path);
+  bacon_free (path);
+}
+
+static char *
+bacon_hash_cache_path (void)
+{
+  return bacon_strf ("%s%c%s", g_program_data_path,
+                     BACON_PATH_SEP, BACON_HASH_CACHE_FILENAME);
+}
+
+static void
+bacon_hash_cache_load (void)
+{
+  int version;
+  char name[16];
+  char hex[BACON_HASH_HEX_SIZE];
+  char *path;
+  FILE *fp;
+  BaconHashCacheEntry e;
+
+  if (s_cache_loaded)
+    return;
+  s_cache_loaded = BACON_TRUE;
+  s_cache = bacon_newa (BaconHashCacheEntry,
+                        sizeof (BaconHashCacheEntry) * BACON_HASH_CACHE_MAX);
+
+  path = bacon_hash_cache_path ();
+  fp = fopen (path, "r");
+  bacon_free (path);
+  if (!fp)
+    return;
+
+  if ((fscanf (fp, "%i", &version) == 1) &&
+      (version == BACON_HASH_CACHE_VERSION))
+  {
+    while ((s_n_cache < BACON_HASH_CACHE_MAX) &&
+           (fscanf (fp, "%lu %lu %lu %ld %ld %ld %15s %64s", &e.dev, &e.ino,
+                    &e.size, &e.mtime, &e.mtime_nsec, &e.ctime,
+                    name, hex) == 8))
+    {
+      if (bacon_hash_from_hex (&e.hash, bacon_hash_type_from_name (name), hex))
+        s_cache[s_n_cache++] = e;
+    }
+  }
+  bacon_env_fclose (fp);
+}
+
+static void
+bacon_hash_cache_save (void)
+{
+  int x;
+  char hex[BACON_HASH_HEX_SIZE];
+  char *path;
+  char *tmp;
+  FILE *fp;
+
+  path = bacon_hash_cache_path ();
+  tmp = bacon_strf ("%s.tmp", path);
+  fp = fopen (tmp, "w");
+  if (!fp) {
+    bacon_debug ("failed to save `%s' (%s)", tmp, strerror (errno));
+    bacon_free (tmp);
+    bacon_free (path);
+    return;
+  }
+
+  bacon_foutln (fp, "%i", BACON_HASH_CACHE_VERSION);
+  for (x = 0; x < s_n_cache; ++x) {
+    bacon_hash_to_hex (&s_cache[x].hash, hex);
+    bacon_foutln (fp, "%lu %lu %lu %ld %ld %ld %s %s",
+                  s_cache[x].dev, s_cache[x].ino, s_cache[x].size,
+                  s_cache[x].mtime, s_cache[x].mtime_nsec, s_cache[x].ctime,
+                  bacon_hash_name (s_cache[x].hash.type), hex);
+  }
+  bacon_env_fclose (fp);
+
+  /* replace the old cache in one step so a crash can't leave half of it */
+  if (rename (tmp, path) == -1)
+    bacon_debug ("failed to rename `%s' (%s)", tmp, strerror (errno));
+  bacon_free (tmp);
+  bacon_free (path);
+}
+
+static BaconBoolean
+bacon_hash_cache_key (BaconHashCacheEntry *e, const char *filename)
+{
+  struct stat s;
+
+  memset (&s, 0, sizeof (struct stat));
+  if (stat (filename, &s) != 0)
+    return BACON_FALSE;
+
+  /* without inode numbers (e.g. on Windows) files can't be told apart */
+  if (!s.st_ino)
+    return BACON_FALSE;
+
+  e->dev = (unsigned long) s.st_dev;
+  e->ino = (unsigned long) s.st_ino;
+  e->size = (unsigned long) s.st_size;
+  e->mtime = (long) s.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  e->mtime_nsec = (long) s.st_mtim.tv_nsec;
+#else
+  e->mtime_nsec = 0;
+#endif
+  e->ctime = (long) s.st_ctime;
+  return BACON_TRUE;
+}
+
+/* Looks up the `type' digest of `filename' without reading it. Returns
+   false if the file is not cached, has changed since it was, or was cached
+   with another kind of hash. */
 BaconBoolean
-bacon_hash_match (const BaconHash *hash1, const BaconHash *hash2)
+bacon_hash_cache_lookup (BaconHash *hash,
+                         BaconHashType type,
+                         const char *filename)
+{
+  int x;
+  BaconHashCacheEntry key;
+
+  if (!g_program_data_path || !bacon_hash_cache_key (&key, filename))
+    return BACON_FALSE;
+
+  bacon_hash_cache_load ();
+  for (x = 0; x < s_n_cache; ++x) {
+    if ((s_cache[x].dev == key.dev) && (s_cache[x].ino == key.ino) &&
+        (s_cache[x].size == key.size) && (s_cache[x].mtime == key.mtime) &&
+        (s_cache[x].mtime_nsec == key.mtime_nsec) &&
+        (s_cache[x].ctime == key.ctime) && (s_cache[x].hash.type == type))
+    {
+      *hash = s_cache[x].hash;
+      return BACON_TRUE;
+    }
+  }
+  return BACON_FALSE;
+}
+
+void
+bacon_hash_cache_store (const BaconHash *hash, const char *filename)
+{
+  int x;
+  BaconHashCacheEntry key;
+
+  if (!g_program_data_path || !bacon_hash_cache_key (&key, filename))
+    return;
+
+  bacon_hash_cache_load ();
+  key.hash = *hash;
+
+  /* a file only ever has one entry - whatever it had before is stale */
+  for (x = 0; x < s_n_cache; ++x)
+    if ((s_cache[x].dev == key.dev) && (s_cache[x].ino == key.ino))
+      break;
+
+  if (x == s_n_cache) {
+    if (s_n_cache == BACON_HASH_CACHE_MAX) {
+      memmove (s_cache, s_cache + 1,
+               sizeof (BaconHashCacheEntry) * (BACON_HASH_CACHE_MAX - 1));
+      x = s_n_cache - 1;
+    } else
+      s_n_cache++;
+  }
+  s_cache[x] = key;
+  bacon_hash_cache_save ();
+}
+
+void
+bacon_hash_cache_cleanup (void)
 {
-  return bacon_streq (hash1->hash, hash2->hash);
+  bacon_free (s_cache);
+  s_cache = NULL;
+  s_n_cache = 0;
+  s_cache_loaded = BACON_FALSE;
 }
 
+void
+bacon_hash_from_file (BaconHash *hash,
+                      BaconHashType type,
+                      const char *path)
+{
+  BaconHashCtx ctx;
+
+  bacon_hash_init (&ctx, type);
+  bacon_hash_update_from_file (&ctx, path, 0);
+  bacon_hash_final (&ctx, hash);
+}
+
+/* Like bacon_hash_from_file () but without any output, which makes it
+   safe for worker threads. Returns false if `filename' can't be read. */
+BaconBoolean
+bacon_hash_from_file_quiet (BaconHash *hash,
+                            BaconHashType type,
+                            const char *filename)
+{
+  unsigned long offset;
+  BaconBoolean ret;
+  BaconHashCtx ctx;
+  FILE *fp;
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    return BACON_FALSE;
+
+  offset = 0;
+  bacon_hash_init (&ctx, type);
+  ret = bacon_hash_update_from_fp (&ctx, fp, &offset);
+  fclose (fp);
+  if (ret)
+    bacon_hash_final (&ctx, hash);
+  return ret;
+}
+
+/* Digests of different kinds never match, and neither does a missing one */
+BaconBoolean
+bacon_hash_match (const BaconHash *hash1, const BaconHash *hash2)
+{
+  if ((hash1->type != hash2->type) || (hash1->type == BACON_HASH_NONE))
+    return BACON_FALSE;
+  return (memcmp (hash1->digest, hash2->digest,
+                  bacon_hash_digest_size (hash1->type)) == 0)
+         ? BACON_TRUE : BACON_FALSE;
+}
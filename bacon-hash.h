@@ -27,14 +27,64 @@
 extern "C" {
 #endif
 
-#define BACON_HASH_DIGEST_SIZE 16
-#define BACON_HASH_SIZE        BACON_HASH_DIGEST_SIZE * 2 + 1
+/* large enough for the longest digest (SHA-256) and its hex form */
+#define BACON_HASH_DIGEST_MAX 32
+#define BACON_HASH_HEX_SIZE   (BACON_HASH_DIGEST_MAX * 2 + 1)
+
+typedef enum {
+  BACON_HASH_NONE,
+  BACON_HASH_MD5,
+  BACON_HASH_SHA1,
+  BACON_HASH_SHA256
+} BaconHashType;
 
 typedef struct {
-  char hash[BACON_HASH_SIZE];
+  BaconHashType type;
+  unsigned char digest[BACON_HASH_DIGEST_MAX];
 } BaconHash;
 
-void bacon_hash_from_file (BaconHash *hash, const char *filename);
+/* All supported digests work on 64 byte blocks, so they share one context.
+   `transform' is picked by bacon_hash_init () for the running CPU. */
+typedef struct {
+  BaconHashType type;
+  unsigned int state[8];
+  unsigned int count[2];
+  unsigned char buffer[64];
+  void (*transform) (unsigned int *state,
+                     const unsigned char *blocks,
+                     size_t n_blocks);
+} BaconHashCtx;
+
+void bacon_hash_init (BaconHashCtx *ctx, BaconHashType type);
+void bacon_hash_update (BaconHashCtx *ctx,
+                        const unsigned char *input,
+                        unsigned int n);
+void bacon_hash_update_from_file (BaconHashCtx *ctx,
+                                  const char *filename,
+                                  unsigned long offset);
+void bacon_hash_final (BaconHashCtx *ctx, BaconHash *hash);
+unsigned long bacon_hash_length (const BaconHashCtx *ctx);
+const char *bacon_hash_name (BaconHashType type);
+BaconHashType bacon_hash_type_from_name (const char *name);
+size_t bacon_hash_digest_size (BaconHashType type);
+BaconBoolean bacon_hash_from_hex (BaconHash *hash,
+                                  BaconHashType type,
+                                  const char *hex);
+void bacon_hash_to_hex (const BaconHash *hash, char *hex);
+BaconBoolean bacon_hash_load_state (BaconHashCtx *ctx, const char *filename);
+void bacon_hash_save_state (const BaconHashCtx *ctx, const char *filename);
+void bacon_hash_delete_state (const char *filename);
+BaconBoolean bacon_hash_cache_lookup (BaconHash *hash,
+                                      BaconHashType type,
+                                      const char *filename);
+void bacon_hash_cache_store (const BaconHash *hash, const char *filename);
+void bacon_hash_cache_cleanup (void);
+void bacon_hash_from_file (BaconHash *hash,
+                           BaconHashType type,
+                           const char *filename);
+BaconBoolean bacon_hash_from_file_quiet (BaconHash *hash,
+                                         BaconHashType type,
+                                         const char *filename);
 BaconBoolean bacon_hash_match (const BaconHash *hash1,
                                const BaconHash *hash2);
 
@@ -175,6 +175,7 @@ static void
 bacon_display_rom_choices (const BaconRomList *list, int *total_choices)
 {
   int n;
+  char hex[BACON_HASH_HEX_SIZE];
   BaconRom *rom;
 
   /* add some extra spaces here to cover up the "Loading..." progress */
@@ -188,21 +189,25 @@ bacon_display_rom_choices (const BaconRomList *list, int *total_choices)
     for (; rom; rom = rom->next) {
       bacon_outlni (1, "%s) %s",
                     BACON_COLOR_I (BACON_NUMBER_LIST_COLOR, n),
-                    BACON_COLOR_S (BACON_ROM_NAME_COLOR, rom->name));
+                    BACON_COLOR_S (BACON_ROM_NAME_COLOR,
+                                   bacon_rom_name (rom)));
       bacon_outlni (2, "%s: %s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "released"),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->date));
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR,
+                                   bacon_rom_date (rom)));
       bacon_outlni (2, "%s:     %s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "size"),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->size));
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR,
+                                   bacon_rom_size (rom)));
+      bacon_hash_to_hex (&rom->hash, hex);
       bacon_outlni (2, "%s:     %s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "hash"),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->hash.hash));
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, hex));
       bacon_outlni (2, "%s:      %s%s%s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "url"),
                     BACON_COLOR_S (BACON_ROM_INFO_COLOR, BACON_GET_CM_URL),
                     BACON_COLOR_C (BACON_ROM_INFO_COLOR, '/'),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->get));
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, bacon_rom_get (rom)));
       if (!rom->next)
         break;
       ++n;
@@ -292,7 +297,8 @@ bacon_currents (void)
 
   bacon_out ("Current ROM:      ");
   if (s_rom)
-    bacon_outln ("%s", BACON_COLOR_S (BACON_ROM_NAME_COLOR, s_rom->name));
+    bacon_outln ("%s", BACON_COLOR_S (BACON_ROM_NAME_COLOR,
+                                      bacon_rom_name (s_rom)));
   else
     bacon_outln ("");
 
@@ -419,6 +425,7 @@ bacon_specify_download_path (void)
 static void
 bacon_download (void)
 {
+  char hex[BACON_HASH_HEX_SIZE];
   BaconBoolean ret;
 
   bacon_outln ("\n%s",
@@ -434,27 +441,28 @@ bacon_download (void)
                               bacon_rom_type_str (s_rom_type_i)));
   bacon_outln ("%s:    %s",
                BACON_COLOR_S (BACON_BOLD, "filename"),
-               BACON_COLOR_S (BACON_ROM_NAME_COLOR, s_rom->name));
+               BACON_COLOR_S (BACON_ROM_NAME_COLOR, bacon_rom_name (s_rom)));
   bacon_outln ("%s: %s",
                BACON_COLOR_S (BACON_BOLD, "released on"),
-               BACON_COLOR_S (BACON_ROM_INFO_COLOR, s_rom->date));
+               BACON_COLOR_S (BACON_ROM_INFO_COLOR, bacon_rom_date (s_rom)));
   bacon_outln ("%s:        %s",
                BACON_COLOR_S (BACON_BOLD, "size"),
-               BACON_COLOR_S (BACON_ROM_INFO_COLOR, s_rom->size));
+               BACON_COLOR_S (BACON_ROM_INFO_COLOR, bacon_rom_size (s_rom)));
   bacon_outln ("%s:         %s%s%s",
                BACON_COLOR_S (BACON_BOLD, "url"),
                BACON_COLOR_S (BACON_ROM_INFO_COLOR, BACON_GET_CM_URL),
                BACON_COLOR_C (BACON_ROM_INFO_COLOR, '/'),
-               BACON_COLOR_S (BACON_ROM_INFO_COLOR, s_rom->get));
+               BACON_COLOR_S (BACON_ROM_INFO_COLOR, bacon_rom_get (s_rom)));
+  bacon_hash_to_hex (&s_rom->hash, hex);
   bacon_outln ("%s:         %s",
-               BACON_COLOR_S (BACON_BOLD, "md5"),
-               BACON_COLOR_S (BACON_ROM_INFO_COLOR, s_rom->hash.hash));
+               BACON_COLOR_S (BACON_BOLD, "hash"),
+               BACON_COLOR_S (BACON_ROM_INFO_COLOR, hex));
   bacon_out ("%s:   ", BACON_COLOR_S (BACON_BOLD, "saving to"));
   if (s_dirpath)
     bacon_outln ("%s%s%s",
                  BACON_COLOR_S (BACON_YELLOW, s_dirpath),
                  BACON_COLOR_C (BACON_YELLOW, BACON_PATH_SEP),
-                 BACON_COLOR_S (BACON_YELLOW, s_rom->name));
+                 BACON_COLOR_S (BACON_YELLOW, bacon_rom_name (s_rom)));
   else
     bacon_outln ("%s",
                  (!g_out_path) ?
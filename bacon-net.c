@@ -21,10 +21,15 @@
 #include "bacon.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
 
 #include <curl/curl.h>
 
+#include "bacon-ctype.h"
 #include "bacon-env.h"
 #include "bacon-net.h"
 #include "bacon-out.h"
@@ -32,61 +37,158 @@
 #include "bacon-str.h"
 #include "bacon-util.h"
 
-#define BACON_URL_MAX 1024
+#define BACON_URL_MAX          1024
+#define BACON_HANDLES_MAX      16
+#define BACON_RANGE_MAX        64
+#define BACON_SEGMENTS_SUFFIX  ".segments"
+#define BACON_SEGMENTS_VERSION 1
+#define BACON_SEGMENTS_TMP     ".tmp"
+/* How much of a streamed download may go unrecorded in its hash state */
+#define BACON_HASH_CHECKPOINT  (8UL * 1024UL * 1024UL)
+#define BACON_PAGE_BUFFER_MIN  4096
+#define BACON_PAGE_PRESIZE_MAX (16UL * 1024UL * 1024UL)
+#ifdef BACON_GTK
+/* Resolution of the progress handed from the worker thread to the bar */
+# define BACON_GTK_PROGRESS_STEPS 1000
+#endif
 
 #define BACON_USERAGENT \
   BACON_PROGRAM_NAME " " BACON_VERSION "/CM ROM downloader"
 
-#define BACON_FILE_RESULT ((BaconFileResult *) (s_net->res))
-#define BACON_PAGE_RESULT ((BaconPageResult *) (s_net->res))
+#define BACON_FILE_RESULT(n) ((BaconFileResult *) ((n)->res))
+#define BACON_PAGE_RESULT(n) ((BaconPageResult *) ((n)->res))
+#define BACON_RANGE_RESULT(n) ((BaconRangeResult *) ((n)->res))
+
+#define bacon_net_setopt(n, o, p) \
+  (n)->status = curl_easy_setopt ((n)->cp, o, p)
 
-#define bacon_net_setopt(o, p) \
-  s_net->status = curl_easy_setopt (s_net->cp, o, p)
+typedef struct BaconNetInstance BaconNetInstance;
 
 typedef struct {
   FILE *fp;
   char *path;
   unsigned long offset;
-  BaconBoolean (*setup) (void);
-  size_t (*write) (void *, size_t, size_t, FILE *);
+  BaconHashCtx *hash;
+  unsigned long unsaved;
+  unsigned long done;
+  unsigned long length;
+  BaconBoolean (*setup) (BaconNetInstance *);
+  size_t (*write) (void *, size_t, size_t, void *);
   int (*progress) (void *, double, double, double, double);
 } BaconFileResult;
 
 typedef struct {
   char *buffer;
   size_t n;
+  size_t size;
+  BaconBoolean (*sink) (const char *, size_t, void *);
+  void *user;
+  BaconBoolean stopped;
 } BaconDataChunk;
 
 typedef struct {
   BaconDataChunk chunk;
-  BaconBoolean (*setup) (void);
+  long code;
+  char etag[BACON_NET_VALIDATOR_MAX];
+  char modified[BACON_NET_VALIDATOR_MAX];
+  char if_etag[BACON_NET_VALIDATOR_MAX];
+  char if_modified[BACON_NET_VALIDATOR_MAX];
+  struct curl_slist *headers;
+  BaconBoolean (*setup) (BaconNetInstance *);
   size_t (*write) (void *, size_t, size_t, void *);
   int (*progress) (void *, double, double, double, double);
 } BaconPageResult;
 
+/* `code' is the last status line seen and `accepted' whether its
+   Content-Range starts where the segment left off */
+typedef struct {
+  int fd;
+  unsigned long start;
+  unsigned long end;
+  unsigned long done;
+  long code;
+  BaconBoolean accepted;
+  BaconBoolean (*setup) (BaconNetInstance *);
+  size_t (*write) (void *, size_t, size_t, void *);
+} BaconRangeResult;
+
 typedef enum {
   BACON_NET_ACTION_GET_FILE,
-  BACON_NET_ACTION_GET_PAGE
+  BACON_NET_ACTION_GET_PAGE,
+  BACON_NET_ACTION_GET_RANGE
 } BaconNetAction;
 
-typedef struct {
+struct BaconNetInstance {
   CURL *cp;
   CURLcode status;
   BaconNetAction action;
+  char url[BACON_URL_MAX];
   void *res;
-} BaconNetInstance;
+};
 
 extern BaconBoolean      g_show_progress;
-static BaconNetInstance *s_net       = NULL;
+static BaconNetInstance *s_net                 = NULL;
 #ifdef BACON_GTK
-static BaconBoolean      s_for_icons = BACON_FALSE;
+static BaconBoolean      s_for_icons           = BACON_FALSE;
+static volatile gint     s_gtk_progress        = 0;
+static volatile gint     s_gtk_progress_queued = 0;
+static volatile gint     s_gtk_cancel          = 0;
 #endif
-static char              s_url       [BACON_URL_MAX];
+static CURLSH *          s_share               = NULL;
+static CURLM *           s_multi               = NULL;
+static int               s_max_total           = 0;
+static int               s_max_host            = 0;
+static int               s_n_handles           = 0;
+static unsigned long     s_transfers           = 0;
+static unsigned long     s_reused              = 0;
+static unsigned long     s_page_allocs         = 0;
+static unsigned long     s_page_writes         = 0;
+static unsigned long     s_page_bytes          = 0;
+static CURL *            s_handles             [BACON_HANDLES_MAX];
 
 static size_t
-bacon_file_write (void *p, size_t size, size_t nmemb, FILE *fp)
+bacon_file_write (void *buf, size_t size, size_t nmemb, void *o)
+{
+  size_t n;
+  BaconFileResult *p;
+
+  p = (BaconFileResult *) o;
+  n = fwrite (buf, size, nmemb, p->fp);
+  p->done += n * size;
+  if (!p->hash || !n)
+    return n;
+
+  /* hash while the bytes are still hot instead of rereading the file */
+  bacon_hash_update (p->hash, (const unsigned char *) buf,
+                     (unsigned int) (n * size));
+  p->unsaved += n * size;
+  if ((p->unsaved >= BACON_HASH_CHECKPOINT) && (fflush (p->fp) == 0)) {
+    bacon_hash_save_state (p->hash, p->path);
+    p->unsaved = 0;
+  }
+  return n;
+}
+
+/* Makes room for `n' bytes in `p'. Unless `exact' is true the buffer
+   at least doubles, so a page costs O(log n) reallocations. */
+static void
+bacon_page_reserve (BaconDataChunk *p, size_t n, BaconBoolean exact)
 {
-  return fwrite (p, size, nmemb, fp);
+  size_t size;
+
+  if (n <= p->size)
+    return;
+  if (exact)
+    size = n;
+  else {
+    size = (p->size < BACON_PAGE_BUFFER_MIN) ? BACON_PAGE_BUFFER_MIN
+                                             : p->size;
+    while (size < n)
+      size *= 2;
+  }
+  p->buffer = (char *) bacon_realloc (p->buffer, size);
+  p->size = size;
+  s_page_allocs++;
 }
 
 static size_t
@@ -98,17 +200,176 @@ bacon_page_write (void *buf, size_t size, size_t nmemb, void *o)
   p = (BaconDataChunk *) o;
   n = size * nmemb;
 
-  p->buffer = (char *) bacon_realloc (p->buffer, p->n + n + 1);
-  if (!p->buffer)
-    return 0;
+  if (p->sink) {
+    p->n += n;
+    /* anything short of `n' makes libcurl abort the transfer */
+    if (!p->sink ((const char *) buf, n, p->user)) {
+      p->stopped = BACON_TRUE;
+      return 0;
+    }
+    return n;
+  }
 
+  bacon_page_reserve (p, p->n + n + 1, BACON_FALSE);
+  s_page_writes++;
+  s_page_bytes += n;
   memcpy (&(p->buffer[p->n]), buf, n);
   p->n += n;
   p->buffer[p->n] = 0;
   return n;
 }
 
+/* Picks the validators out of the response headers, a new status line
+   (after a redirect) starts over */
+static size_t
+bacon_page_header (char *buf, size_t size, size_t nmemb, void *o)
+{
+  size_t n;
+  size_t len;
+  unsigned long length;
+  char *dest;
+  char name[16];
+  BaconPageResult *p;
+
+  p = (BaconPageResult *) o;
+  n = size * nmemb;
+
+  if ((n > 5) && !strncmp (buf, "HTTP/", 5)) {
+    *p->etag = '\0';
+    *p->modified = '\0';
+    return n;
+  }
+
+  len = 0;
+  while ((len < n) && (len < (sizeof (name) - 1)) && (buf[len] != ':'))
+    ++len;
+  if ((len == n) || (buf[len] != ':'))
+    return n;
+  bacon_strtolower (name, len, buf);
+
+  if (bacon_streq (name, "content-length")) {
+    /* only a hint, a compressed page decodes to more than this */
+    length = strtoul (buf + len + 1, NULL, 10);
+    if (!p->chunk.sink && (length > 0) && (length < BACON_PAGE_PRESIZE_MAX))
+      bacon_page_reserve (&p->chunk, p->chunk.n + length + 1, BACON_TRUE);
+    return n;
+  }
+
+  if (bacon_streq (name, "etag"))
+    dest = p->etag;
+  else if (bacon_streq (name, "last-modified"))
+    dest = p->modified;
+  else
+    return n;
+
+  /* skip the colon and blanks, and drop the line ending */
+  for (++len; (len < n) && ((buf[len] == ' ') || (buf[len] == '\t')); ++len)
+    ;
+  buf += len;
+  n -= len;
+  while (n && ((buf[n - 1] == '\r') || (buf[n - 1] == '\n')))
+    --n;
+  if (n < BACON_NET_VALIDATOR_MAX) {
+    memcpy (dest, buf, n);
+    dest[n] = '\0';
+  }
+  return size * nmemb;
+}
+
+#ifdef HAVE_PWRITE
+/* Reads the status code and where the Content-Range starts; only a 206
+   for the byte the segment left off at is written anywhere */
+static size_t
+bacon_range_header (char *buf, size_t size, size_t nmemb, void *o)
+{
+  size_t n;
+  size_t x;
+  size_t len;
+  unsigned long start;
+  char name[16];
+  char unit[7];
+  BaconRangeResult *p;
+
+  p = (BaconRangeResult *) o;
+  n = size * nmemb;
+
+  if ((n > 5) && !strncmp (buf, "HTTP/", 5)) {
+    p->code = 0;
+    p->accepted = BACON_FALSE;
+    for (x = 5; (x < n) && (buf[x] != ' '); ++x)
+      ;
+    for (++x; (x < n) && bacon_isdigit (buf[x]); ++x)
+      p->code = (p->code * 10) + (buf[x] - '0');
+    return n;
+  }
+
+  len = 0;
+  while ((len < n) && (len < (sizeof (name) - 1)) && (buf[len] != ':'))
+    ++len;
+  if ((len == n) || (buf[len] != ':'))
+    return n;
+  bacon_strtolower (name, len, buf);
+  if (!bacon_streq (name, "content-range"))
+    return n;
+
+  for (x = len + 1; (x < n) && ((buf[x] == ' ') || (buf[x] == '\t')); ++x)
+    ;
+  if ((n - x) <= 6)
+    return n;
+  bacon_strtolower (unit, 6, buf + x);
+  if (!bacon_streq (unit, "bytes "))
+    return n;
+
+  start = 0;
+  for (x += 6; (x < n) && bacon_isdigit (buf[x]); ++x)
+    start = (start * 10) + (unsigned long) (buf[x] - '0');
+  if ((x < n) && (buf[x] == '-') && (start == (p->start + p->done)))
+    p->accepted = BACON_TRUE;
+  return n;
+}
+
+static size_t
+bacon_range_write (void *buf, size_t size, size_t nmemb, void *o)
+{
+  size_t n;
+  ssize_t written;
+  BaconRangeResult *p;
+
+  p = (BaconRangeResult *) o;
+  n = size * nmemb;
+
+  /* a server that ignores the range sends the file from its first byte,
+     none of that may land in the segment or count as done */
+  if ((p->code != 206) || !p->accepted)
+    return 0;
+  if ((p->start + p->done + n) > (p->end + 1))
+    return 0;
+
+  written = pwrite (p->fd, buf, n, (off_t) (p->start + p->done));
+  if ((written < 0) || (((size_t) written) != n))
+    return 0;
+  p->done += n;
+  return n;
+}
+#endif
+
 #ifdef BACON_GTK
+static gboolean
+bacon_gtk_progress_update (gpointer progress_bar)
+{
+  gdouble fraction;
+
+  g_atomic_int_set (&s_gtk_progress_queued, 0);
+  fraction = ((gdouble) g_atomic_int_get (&s_gtk_progress) /
+              BACON_GTK_PROGRESS_STEPS);
+  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (progress_bar), fraction);
+  g_object_unref (progress_bar);
+  return FALSE;
+}
+
+/* The transfer runs on the GUI's worker thread, the bar is only ever
+   touched from the main loop. At most one update is queued at a time
+   and it shows whatever is the latest. */
 static int
 bacon_gtk_progress (void *progress_bar,
                     double td,
@@ -118,14 +379,33 @@ bacon_gtk_progress (void *progress_bar,
 {
   gdouble fraction;
 
+  if (g_atomic_int_get (&s_gtk_cancel))
+    return 1;
   fraction = (cd / td);
   if (!bacon_nan_value (fraction)) {
-    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (progress_bar), fraction);
-    while (gtk_events_pending ())
-      gtk_main_iteration ();
+    g_atomic_int_set (&s_gtk_progress,
+                      (gint) (fraction * BACON_GTK_PROGRESS_STEPS));
+    if (g_atomic_int_compare_and_exchange (&s_gtk_progress_queued, 0, 1))
+      g_idle_add (bacon_gtk_progress_update, g_object_ref (progress_bar));
   }
   return 0;
 }
+
+/* The icon page has no bar of its own, this is only here so that
+   bacon_net_gtk_cancel () can stop it */
+static int
+bacon_gtk_page_progress (void *net,
+                         double td,
+                         double cd,
+                         double tu,
+                         double cu)
+{
+  if (g_atomic_int_get (&s_gtk_cancel))
+    return 1;
+  if (BACON_PAGE_RESULT ((BaconNetInstance *) net)->progress)
+    bacon_progress_page (td, cd);
+  return 0;
+}
 #endif
 
 static int
@@ -143,205 +423,476 @@ bacon_page_progress (void *data, double td, double cd, double tu, double cu)
 }
 
 static void
-bacon_set_url (const char *root, const char *req)
+bacon_set_url (BaconNetInstance *net, const char *root, const char *req)
 {
   if (root && *root) {
     if (req && *req)
-      snprintf (s_url, BACON_URL_MAX, "%s/%s", root, req);
+      snprintf (net->url, BACON_URL_MAX, "%s/%s", root, req);
     else
-      snprintf (s_url, BACON_URL_MAX, "%s", root);
+      snprintf (net->url, BACON_URL_MAX, "%s", root);
   } else
-    *s_url = '\0';
+    *net->url = '\0';
+}
+
+static BaconBoolean
+bacon_net_check (BaconNetInstance *net)
+{
+  if (net->status == CURLE_OK)
+    return BACON_TRUE;
+  /* only a cancelled GUI transfer is aborted, that is not an error */
+  if (net->status != CURLE_ABORTED_BY_CALLBACK)
+    bacon_error (curl_easy_strerror (net->status));
+  return BACON_FALSE;
 }
 
 static BaconBoolean
-bacon_net_check (void)
+bacon_show_progress (void)
 {
-  if (s_net->status == CURLE_OK)
+#ifdef BACON_GTK
+  if (!s_for_icons && g_show_progress)
+#else
+  if (g_show_progress)
+#endif
     return BACON_TRUE;
-  bacon_error (curl_easy_strerror (s_net->status));
   return BACON_FALSE;
 }
 
+static void
+bacon_net_share_init (void)
+{
+  if (s_share)
+    return;
+
+  s_share = curl_share_init ();
+  if (!s_share) {
+    bacon_debug ("%s", "failed to create share handle");
+    return;
+  }
+
+  /* DNS answers and TLS sessions (and, where libcurl supports it, the
+     connections themselves) outlive the handles that created them */
+  curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+static CURL *
+bacon_net_handle_get (void)
+{
+  CURL *cp;
+
+  if (s_n_handles > 0) {
+    cp = s_handles[--s_n_handles];
+    curl_easy_reset (cp);
+  } else
+    cp = curl_easy_init ();
+
+  bacon_net_share_init ();
+  if (cp && s_share)
+    curl_easy_setopt (cp, CURLOPT_SHARE, s_share);
+  return cp;
+}
+
+static void
+bacon_net_handle_put (CURL *cp)
+{
+  if (s_n_handles < BACON_HANDLES_MAX)
+    s_handles[s_n_handles++] = cp;
+  else
+    curl_easy_cleanup (cp);
+}
+
+static void
+bacon_net_count_connection (BaconNetInstance *net)
+{
+  long n_connects;
+
+  n_connects = -1;
+  if (curl_easy_getinfo (net->cp, CURLINFO_NUM_CONNECTS,
+                         &n_connects) != CURLE_OK)
+    return;
+
+  s_transfers++;
+  if (n_connects == 0)
+    s_reused++;
+  bacon_debug ("%s: %s connection", net->url,
+               (n_connects == 0) ? "reused" : "new");
+}
+
+/* Pages may arrive compressed, compare what came over the wire with
+   what was handed to the page */
+static void
+bacon_page_report_size (BaconNetInstance *net)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t wire;
+
+  if ((curl_easy_getinfo (net->cp, CURLINFO_SIZE_DOWNLOAD_T,
+                          &wire) != CURLE_OK) || (wire <= 0))
+    return;
+#else
+  double wire;
+
+  if ((curl_easy_getinfo (net->cp, CURLINFO_SIZE_DOWNLOAD,
+                          &wire) != CURLE_OK) || (wire <= 0))
+    return;
+#endif
+  bacon_debug ("%s: %lu bytes received, %lu bytes of page", net->url,
+               (unsigned long) wire,
+               (unsigned long) BACON_PAGE_RESULT (net)->chunk.n);
+}
+
 static BaconBoolean
-bacon_file_setup (void)
+bacon_file_setup (BaconNetInstance *net)
 {
   BaconBoolean check;
 
-  if (BACON_FILE_RESULT->offset == 0)
-    BACON_FILE_RESULT->fp = bacon_env_fopen (BACON_FILE_RESULT->path, "wb");
-  else if (BACON_FILE_RESULT->offset > 0)
-    BACON_FILE_RESULT->fp = bacon_env_fopen (BACON_FILE_RESULT->path, "ab");
+  if (BACON_FILE_RESULT (net)->offset == 0)
+    BACON_FILE_RESULT (net)->fp =
+      bacon_env_fopen (BACON_FILE_RESULT (net)->path, "wb");
+  else if (BACON_FILE_RESULT (net)->offset > 0)
+    BACON_FILE_RESULT (net)->fp =
+      bacon_env_fopen (BACON_FILE_RESULT (net)->path, "ab");
 
-  bacon_net_setopt (CURLOPT_WRITEDATA, (void *) BACON_FILE_RESULT->fp);
-  if (!bacon_net_check ())
+  bacon_net_setopt (net, CURLOPT_WRITEDATA, (void *) BACON_FILE_RESULT (net));
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_RESUME_FROM, BACON_FILE_RESULT->offset);
-  if (!bacon_net_check ())
+  bacon_net_setopt (net, CURLOPT_RESUME_FROM, BACON_FILE_RESULT (net)->offset);
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_WRITEFUNCTION, (void *) BACON_FILE_RESULT->write);
-  check = bacon_net_check ();
+  bacon_net_setopt (net, CURLOPT_WRITEFUNCTION,
+                    (void *) BACON_FILE_RESULT (net)->write);
+  check = bacon_net_check (net);
 
-  if (check && BACON_FILE_RESULT->progress) {
-    bacon_net_setopt (CURLOPT_PROGRESSFUNCTION,
-                      (void *) BACON_FILE_RESULT->progress);
-    check = bacon_net_check ();
+  if (check && BACON_FILE_RESULT (net)->progress) {
+    bacon_net_setopt (net, CURLOPT_PROGRESSFUNCTION,
+                      (void *) BACON_FILE_RESULT (net)->progress);
+    check = bacon_net_check (net);
   }
   return check;
 }
 
 static BaconBoolean
-bacon_page_setup (void)
+bacon_page_setup (BaconNetInstance *net)
 {
+  char *header;
   BaconBoolean check;
+  BaconPageResult *r;
 
-  bacon_net_setopt (CURLOPT_WRITEDATA, (void *) &BACON_PAGE_RESULT->chunk);
-  if (!bacon_net_check ())
+  r = BACON_PAGE_RESULT (net);
+  bacon_net_setopt (net, CURLOPT_WRITEDATA, (void *) &r->chunk);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (net, CURLOPT_HEADERFUNCTION, bacon_page_header);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (net, CURLOPT_HEADERDATA, (void *) r);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  /* pages are markup and shrink a lot, "" asks for every encoding
+     this libcurl can decode (gzip, deflate and br where built in) */
+#if LIBCURL_VERSION_NUM >= 0x071506
+  bacon_net_setopt (net, CURLOPT_ACCEPT_ENCODING, "");
+#else
+  bacon_net_setopt (net, CURLOPT_ENCODING, "");
+#endif
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_WRITEFUNCTION, (void *) BACON_PAGE_RESULT->write);
-  check = bacon_net_check ();
+  /* a page that was seen before is only sent again if it changed */
+  if (!r->headers && (*r->if_etag || *r->if_modified)) {
+    if (*r->if_etag) {
+      header = bacon_strf ("If-None-Match: %s", r->if_etag);
+      r->headers = curl_slist_append (r->headers, header);
+      bacon_free (header);
+    }
+    if (*r->if_modified) {
+      header = bacon_strf ("If-Modified-Since: %s", r->if_modified);
+      r->headers = curl_slist_append (r->headers, header);
+      bacon_free (header);
+    }
+  }
+  if (r->headers) {
+    bacon_net_setopt (net, CURLOPT_HTTPHEADER, r->headers);
+    if (!bacon_net_check (net))
+      return BACON_FALSE;
+  }
+
+  bacon_net_setopt (net, CURLOPT_WRITEFUNCTION,
+                    (void *) BACON_PAGE_RESULT (net)->write);
+  check = bacon_net_check (net);
 
-  if (check && BACON_PAGE_RESULT->progress) {
-    bacon_net_setopt (CURLOPT_PROGRESSFUNCTION,
-                      (void *) BACON_PAGE_RESULT->progress);
-    check = bacon_net_check ();
+  if (check && BACON_PAGE_RESULT (net)->progress) {
+    bacon_net_setopt (net, CURLOPT_PROGRESSFUNCTION,
+                      (void *) BACON_PAGE_RESULT (net)->progress);
+    check = bacon_net_check (net);
   }
   return check;
 }
 
-static void
-bacon_net_init (BaconNetAction action, unsigned long offset, const char *loc)
+#ifdef HAVE_PWRITE
+static BaconBoolean
+bacon_range_setup (BaconNetInstance *net)
 {
-  s_net = bacon_new (BaconNetInstance);
-  s_net->action = action;
+  char range[BACON_RANGE_MAX];
 
-  s_net->cp = curl_easy_init ();
-  if (!s_net->cp) {
-    s_net->status = CURLE_FAILED_INIT;
-    return;
-  }
-  s_net->status = CURLE_OK;
+  snprintf (range, BACON_RANGE_MAX, "%lu-%lu",
+            BACON_RANGE_RESULT (net)->start + BACON_RANGE_RESULT (net)->done,
+            BACON_RANGE_RESULT (net)->end);
+  bacon_net_setopt (net, CURLOPT_RANGE, range);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  BACON_RANGE_RESULT (net)->code = 0;
+  BACON_RANGE_RESULT (net)->accepted = BACON_FALSE;
+  bacon_net_setopt (net, CURLOPT_HEADERDATA,
+                    (void *) BACON_RANGE_RESULT (net));
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (net, CURLOPT_HEADERFUNCTION, bacon_range_header);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (net, CURLOPT_WRITEDATA, (void *) BACON_RANGE_RESULT (net));
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (net, CURLOPT_WRITEFUNCTION,
+                    (void *) BACON_RANGE_RESULT (net)->write);
+  return bacon_net_check (net);
+}
+#endif
 
-  if (s_net->action == BACON_NET_ACTION_GET_FILE) {
-    s_net->res = bacon_new (BaconFileResult);
-    BACON_FILE_RESULT->offset = offset;
-    BACON_FILE_RESULT->fp = NULL;
+/* Creates an instance without a curl handle, see
+   bacon_net_instance_attach () */
+static BaconNetInstance *
+bacon_net_instance_alloc (BaconNetAction action,
+                          const char *root,
+                          const char *req,
+                          unsigned long offset,
+                          const char *loc)
+{
+  BaconNetInstance *net;
+
+  net = bacon_new (BaconNetInstance);
+  net->action = action;
+  net->cp = NULL;
+  net->status = CURLE_OK;
+  net->res = NULL;
+  bacon_set_url (net, root, req);
+
+  if (net->action == BACON_NET_ACTION_GET_FILE) {
+    net->res = bacon_new (BaconFileResult);
+    BACON_FILE_RESULT (net)->offset = offset;
+    BACON_FILE_RESULT (net)->fp = NULL;
+    BACON_FILE_RESULT (net)->hash = NULL;
+    BACON_FILE_RESULT (net)->unsaved = 0;
+    BACON_FILE_RESULT (net)->done = 0;
+    BACON_FILE_RESULT (net)->length = 0;
     if (loc)
-      BACON_FILE_RESULT->path = bacon_strdup (loc);
+      BACON_FILE_RESULT (net)->path = bacon_strdup (loc);
     else
-      BACON_FILE_RESULT->path = NULL;
-    BACON_FILE_RESULT->setup = &bacon_file_setup;
-    BACON_FILE_RESULT->write = &bacon_file_write;
-#ifdef BACON_GTK
-    if (!s_for_icons && g_show_progress)
-#else
-    if (g_show_progress)
-#endif
-      BACON_FILE_RESULT->progress = &bacon_file_progress;
+      BACON_FILE_RESULT (net)->path = NULL;
+    BACON_FILE_RESULT (net)->setup = &bacon_file_setup;
+    BACON_FILE_RESULT (net)->write = &bacon_file_write;
+    if (bacon_show_progress ())
+      BACON_FILE_RESULT (net)->progress = &bacon_file_progress;
     else
-      BACON_FILE_RESULT->progress = NULL;
-  } else {
-    s_net->res = bacon_new (BaconPageResult);
-    memset (&BACON_PAGE_RESULT->chunk, 0, sizeof (BaconDataChunk));
-    BACON_PAGE_RESULT->chunk.buffer = bacon_newa (char, 1);
-    BACON_PAGE_RESULT->chunk.n = 0;
-    BACON_PAGE_RESULT->setup = &bacon_page_setup;
-    BACON_PAGE_RESULT->write = &bacon_page_write;
-#ifdef BACON_GTK
-    if (!s_for_icons && g_show_progress)
-#else
-    if (g_show_progress)
+      BACON_FILE_RESULT (net)->progress = NULL;
+#ifdef HAVE_PWRITE
+  } else if (net->action == BACON_NET_ACTION_GET_RANGE) {
+    net->res = bacon_new (BaconRangeResult);
+    memset (net->res, 0, sizeof (BaconRangeResult));
+    BACON_RANGE_RESULT (net)->fd = -1;
+    BACON_RANGE_RESULT (net)->setup = &bacon_range_setup;
+    BACON_RANGE_RESULT (net)->write = &bacon_range_write;
 #endif
-      BACON_PAGE_RESULT->progress = &bacon_page_progress;
+  } else {
+    net->res = bacon_new (BaconPageResult);
+    memset (&BACON_PAGE_RESULT (net)->chunk, 0, sizeof (BaconDataChunk));
+    BACON_PAGE_RESULT (net)->chunk.buffer = bacon_newa (char, 1);
+    *BACON_PAGE_RESULT (net)->chunk.buffer = '\0';
+    BACON_PAGE_RESULT (net)->chunk.n = 0;
+    BACON_PAGE_RESULT (net)->chunk.size = 1;
+    BACON_PAGE_RESULT (net)->code = 0;
+    *BACON_PAGE_RESULT (net)->etag = '\0';
+    *BACON_PAGE_RESULT (net)->modified = '\0';
+    *BACON_PAGE_RESULT (net)->if_etag = '\0';
+    *BACON_PAGE_RESULT (net)->if_modified = '\0';
+    BACON_PAGE_RESULT (net)->headers = NULL;
+    BACON_PAGE_RESULT (net)->setup = &bacon_page_setup;
+    BACON_PAGE_RESULT (net)->write = &bacon_page_write;
+    if (bacon_show_progress ())
+      BACON_PAGE_RESULT (net)->progress = &bacon_page_progress;
     else
-      BACON_PAGE_RESULT->progress = NULL;
+      BACON_PAGE_RESULT (net)->progress = NULL;
+  }
+  return net;
+}
+
+static BaconBoolean
+bacon_net_instance_attach (BaconNetInstance *net)
+{
+  net->cp = bacon_net_handle_get ();
+  net->status = (net->cp) ? CURLE_OK : CURLE_FAILED_INIT;
+  return (net->cp) ? BACON_TRUE : BACON_FALSE;
+}
+
+/* Hands the curl handle back to the pool once a transfer is over */
+static void
+bacon_net_instance_detach (BaconNetInstance *net)
+{
+  if (!net->cp)
+    return;
+  bacon_net_handle_put (net->cp);
+  net->cp = NULL;
+}
+
+static BaconNetInstance *
+bacon_net_instance_new (BaconNetAction action,
+                        const char *root,
+                        const char *req,
+                        unsigned long offset,
+                        const char *loc)
+{
+  BaconNetInstance *net;
+
+  net = bacon_net_instance_alloc (action, root, req, offset, loc);
+  bacon_net_instance_attach (net);
+  return net;
+}
+
+static void
+bacon_net_instance_free (BaconNetInstance *net)
+{
+  if (!net)
+    return;
+
+  bacon_net_instance_detach (net);
+
+  if (net->res) {
+    if (net->action == BACON_NET_ACTION_GET_FILE) {
+      bacon_env_fclose (BACON_FILE_RESULT (net)->fp);
+      bacon_free (BACON_FILE_RESULT (net)->path);
+    } else if (net->action == BACON_NET_ACTION_GET_PAGE) {
+      bacon_free (BACON_PAGE_RESULT (net)->chunk.buffer);
+      if (BACON_PAGE_RESULT (net)->headers)
+        curl_slist_free_all (BACON_PAGE_RESULT (net)->headers);
+    }
+    bacon_free (net->res);
   }
+  bacon_free (net);
 }
 
 static BaconBoolean
-bacon_net_setup (void)
+bacon_net_setup (BaconNetInstance *net)
 {
   BaconBoolean null_progress_cb;
 
-  bacon_net_setopt (CURLOPT_URL, s_url);
-  if (!bacon_net_check ())
+  bacon_net_setopt (net, CURLOPT_URL, net->url);
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_USERAGENT, BACON_USERAGENT);
-  if (!bacon_net_check ())
+  bacon_net_setopt (net, CURLOPT_USERAGENT, BACON_USERAGENT);
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_FOLLOWLOCATION, 1L);
-  if (!bacon_net_check ())
+  bacon_net_setopt (net, CURLOPT_FOLLOWLOCATION, 1L);
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  if ((s_net->action == BACON_NET_ACTION_GET_FILE) &&
-      !BACON_FILE_RESULT->progress)
+#ifdef BACON_GTK
+  /* the GUI fetches from a worker thread, where the resolver may not
+     time out with signals */
+  bacon_net_setopt (net, CURLOPT_NOSIGNAL, 1L);
+  if (!bacon_net_check (net))
+    return BACON_FALSE;
+#endif
+
+  if (net->action == BACON_NET_ACTION_GET_RANGE)
     null_progress_cb = BACON_TRUE;
-  else if ((s_net->action == BACON_NET_ACTION_GET_PAGE) &&
-           !BACON_PAGE_RESULT->progress)
+  else if ((net->action == BACON_NET_ACTION_GET_FILE) &&
+           !BACON_FILE_RESULT (net)->progress)
+    null_progress_cb = BACON_TRUE;
+  else if ((net->action == BACON_NET_ACTION_GET_PAGE) &&
+           !BACON_PAGE_RESULT (net)->progress)
     null_progress_cb = BACON_TRUE;
   else
     null_progress_cb = BACON_FALSE;
 
   if (!null_progress_cb)
-    bacon_net_setopt (CURLOPT_NOPROGRESS, 0L);
+    bacon_net_setopt (net, CURLOPT_NOPROGRESS, 0L);
   else
-    bacon_net_setopt (CURLOPT_NOPROGRESS, 1L);
-  if (!bacon_net_check ())
+    bacon_net_setopt (net, CURLOPT_NOPROGRESS, 1L);
+  if (!bacon_net_check (net))
     return BACON_FALSE;
 
-  if (s_net->action == BACON_NET_ACTION_GET_FILE)
-    return BACON_FILE_RESULT->setup ();
-  return BACON_PAGE_RESULT->setup ();
+  if (net->action == BACON_NET_ACTION_GET_FILE)
+    return BACON_FILE_RESULT (net)->setup (net);
+#ifdef HAVE_PWRITE
+  if (net->action == BACON_NET_ACTION_GET_RANGE)
+    return BACON_RANGE_RESULT (net)->setup (net);
+#endif
+  return BACON_PAGE_RESULT (net)->setup (net);
 }
 
 static BaconBoolean
-bacon_net_fetch (void)
+bacon_net_fetch (BaconNetInstance *net)
 {
-#ifdef BACON_GTK
-  if (!s_for_icons && g_show_progress)
-#else
-  if (g_show_progress)
-#endif
+  if (bacon_show_progress ())
     bacon_progress_init ();
-  s_net->status = curl_easy_perform (s_net->cp);
-#ifdef BACON_GTK
-  if (!s_for_icons && g_show_progress)
-#else
-  if (g_show_progress)
-#endif
-    bacon_progress_deinit (s_net->action == BACON_NET_ACTION_GET_FILE);
-  return bacon_net_check ();
+  net->status = curl_easy_perform (net->cp);
+  if (bacon_show_progress ())
+    bacon_progress_deinit (net->action == BACON_NET_ACTION_GET_FILE);
+  bacon_net_count_connection (net);
+  if (net->action == BACON_NET_ACTION_GET_PAGE)
+    bacon_page_report_size (net);
+  return bacon_net_check (net);
 }
 
-BaconBoolean
-bacon_net_init_for_page_data (const char *request)
+static BaconBoolean
+bacon_net_init (BaconNetAction action,
+                const char *root,
+                const char *req,
+                unsigned long offset,
+                const char *loc)
 {
   if (s_net)
     bacon_net_deinit ();
-  bacon_set_url (BACON_GET_CM_URL, request);
-  bacon_net_init (BACON_NET_ACTION_GET_PAGE, -1, NULL);
-  if (bacon_net_check () && bacon_net_setup ())
+  s_net = bacon_net_instance_new (action, root, req, offset, loc);
+  if (bacon_net_check (s_net) && bacon_net_setup (s_net))
     return BACON_TRUE;
   return BACON_FALSE;
 }
 
+BaconBoolean
+bacon_net_init_for_page_data (const char *request)
+{
+  return bacon_net_init (BACON_NET_ACTION_GET_PAGE,
+                         BACON_GET_CM_URL, request, -1, NULL);
+}
+
+/* If `hash' is given it must already cover the first `offset' bytes of
+   `filename', and it is fed everything downloaded after them. */
 BaconBoolean
 bacon_net_init_for_rom (const char *request,
                         unsigned long offset,
-                        const char *filename)
+                        const char *filename,
+                        BaconHashCtx *hash)
 {
-  if (s_net)
-    bacon_net_deinit ();
-  bacon_set_url (BACON_GET_CM_URL, request);
-  bacon_net_init (BACON_NET_ACTION_GET_FILE, offset, filename);
-  if (bacon_net_check () && bacon_net_setup ())
-    return BACON_TRUE;
-  return BACON_FALSE;
+  if (!bacon_net_init (BACON_NET_ACTION_GET_FILE,
+                       BACON_GET_CM_URL, request, offset, filename))
+    return BACON_FALSE;
+  BACON_FILE_RESULT (s_net)->hash = hash;
+  return BACON_TRUE;
 }
 
 #ifdef BACON_GTK
@@ -349,13 +900,20 @@ BaconBoolean
 bacon_net_init_for_device_icons (void)
 {
   s_for_icons = BACON_TRUE;
-  if (s_net)
-    bacon_net_deinit ();
-  bacon_set_url (BACON_DEVICE_ICONS_URL, NULL);
-  bacon_net_init (BACON_NET_ACTION_GET_PAGE, -1, NULL);
-  if (bacon_net_check () && bacon_net_setup ())
-    return BACON_TRUE;
-  return BACON_FALSE;
+  if (!bacon_net_init (BACON_NET_ACTION_GET_PAGE,
+                       BACON_DEVICE_ICONS_URL, NULL, -1, NULL))
+    return BACON_FALSE;
+
+  bacon_net_setopt (s_net, CURLOPT_NOPROGRESS, 0L);
+  if (!bacon_net_check (s_net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (s_net, CURLOPT_PROGRESSFUNCTION, bacon_gtk_page_progress);
+  if (!bacon_net_check (s_net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (s_net, CURLOPT_PROGRESSDATA, s_net);
+  return bacon_net_check (s_net);
 }
 
 BaconBoolean
@@ -363,13 +921,8 @@ bacon_net_init_for_device_icon_thumb (const char *request,
                                       const char *filename)
 {
   s_for_icons = BACON_TRUE;
-  if (s_net)
-    bacon_net_deinit ();
-  bacon_set_url (BACON_DEVICE_ICON_THUMB_URL, request);
-  bacon_net_init (BACON_NET_ACTION_GET_FILE, 0, filename);
-  if (bacon_net_check () && bacon_net_setup ())
-    return BACON_TRUE;
-  return BACON_FALSE;
+  return bacon_net_init (BACON_NET_ACTION_GET_FILE,
+                         BACON_DEVICE_ICON_THUMB_URL, request, 0, filename);
 }
 
 BaconBoolean
@@ -377,68 +930,71 @@ bacon_net_gtk_init_for_device_list (GtkProgressBar *progress_bar)
 {
   if (s_net)
     bacon_net_deinit ();
-  bacon_set_url (BACON_GET_CM_URL, "");
 
-  bacon_net_init (BACON_NET_ACTION_GET_PAGE, -1, NULL);
-  if (!bacon_net_check ())
+  s_net = bacon_net_instance_new (BACON_NET_ACTION_GET_PAGE,
+                                  BACON_GET_CM_URL, "", -1, NULL);
+  if (!bacon_net_check (s_net))
+    return BACON_FALSE;
+
+  bacon_net_setopt (s_net, CURLOPT_URL, s_net->url);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_URL, s_url);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_USERAGENT, BACON_USERAGENT);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_USERAGENT, BACON_USERAGENT);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_FOLLOWLOCATION, 1L);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_FOLLOWLOCATION, 1L);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_NOSIGNAL, 1L);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_NOPROGRESS, 0L);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_NOPROGRESS, 0L);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_PROGRESSFUNCTION, bacon_gtk_progress);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_PROGRESSFUNCTION, bacon_gtk_progress);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  bacon_net_setopt (CURLOPT_PROGRESSDATA, progress_bar);
-  if (!bacon_net_check ())
+  bacon_net_setopt (s_net, CURLOPT_PROGRESSDATA, progress_bar);
+  if (!bacon_net_check (s_net))
     return BACON_FALSE;
 
-  BACON_PAGE_RESULT->progress = NULL;
-  return BACON_PAGE_RESULT->setup ();
+  BACON_PAGE_RESULT (s_net)->progress = NULL;
+  return BACON_PAGE_RESULT (s_net)->setup (s_net);
+}
+
+/* Makes the transfer on the GUI's worker thread give up at its next
+   progress report, libcurl makes one at least once a second */
+void
+bacon_net_gtk_cancel (void)
+{
+  g_atomic_int_set (&s_gtk_cancel, 1);
 }
 #endif
 
 void
 bacon_net_deinit (void)
 {
-  *s_url = '\0';
-  curl_easy_cleanup (s_net->cp);
 #ifdef BACON_GTK
   s_for_icons = BACON_FALSE;
 #endif
-
-  if (s_net->res) {
-    if (s_net->action == BACON_NET_ACTION_GET_FILE) {
-      bacon_env_fclose (BACON_FILE_RESULT->fp);
-      bacon_free (BACON_FILE_RESULT->path);
-    } else if (s_net->action == BACON_NET_ACTION_GET_PAGE)
-      bacon_free (BACON_PAGE_RESULT->chunk.buffer);
-    bacon_free (s_net->res);
-  }
-  bacon_free (s_net);
+  bacon_net_instance_free (s_net);
+  s_net = NULL;
 }
 
 char *
 bacon_net_get_page_data (void)
 {
   if (s_net && (s_net->action == BACON_NET_ACTION_GET_PAGE)) {
-    if (bacon_net_fetch ())
-      return BACON_PAGE_RESULT->chunk.buffer;
-    bacon_error (curl_easy_strerror (s_net->status));
+    if (bacon_net_fetch (s_net))
+      return BACON_PAGE_RESULT (s_net)->chunk.buffer;
+    if (s_net->status != CURLE_ABORTED_BY_CALLBACK)
+      bacon_error (curl_easy_strerror (s_net->status));
   }
   return NULL;
 }
@@ -447,10 +1003,843 @@ BaconBoolean
 bacon_net_get_file (void)
 {
   if (s_net && (s_net->action == BACON_NET_ACTION_GET_FILE)) {
-    if (bacon_net_fetch ())
+    if (bacon_net_fetch (s_net))
       return BACON_TRUE;
     bacon_error (curl_easy_strerror (s_net->status));
   }
   return BACON_FALSE;
 }
 
+static BaconBoolean
+bacon_net_multi_init (void)
+{
+  if (s_multi)
+    return BACON_TRUE;
+
+  s_multi = curl_multi_init ();
+  if (!s_multi) {
+    bacon_error ("failed to initialize parallel transfers");
+    return BACON_FALSE;
+  }
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt (s_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                     (long) s_max_total);
+  curl_multi_setopt (s_multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                     (long) s_max_host);
+#endif
+  return BACON_TRUE;
+}
+
+/* Limits how many transfers are in flight at once (`total') and how
+   many connections any one host gets (`per_host'), 0 means no limit. */
+void
+bacon_net_set_limits (int total, int per_host)
+{
+  s_max_total = (total > 0) ? total : 0;
+  s_max_host = (per_host > 0) ? per_host : 0;
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  if (s_multi) {
+    curl_multi_setopt (s_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                       (long) s_max_total);
+    curl_multi_setopt (s_multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                       (long) s_max_host);
+  }
+#endif
+}
+
+/* The limits as last set by bacon_net_set_limits () */
+void
+bacon_net_get_limits (int *total, int *per_host)
+{
+  *total = s_max_total;
+  *per_host = s_max_host;
+}
+
+/* Wraps up a transfer as soon as it is over, its handle goes back to
+   the pool right after this */
+static void
+bacon_net_finish (BaconNetInstance *net)
+{
+  if (net->action == BACON_NET_ACTION_GET_PAGE) {
+    curl_easy_getinfo (net->cp, CURLINFO_RESPONSE_CODE,
+                       &BACON_PAGE_RESULT (net)->code);
+    bacon_page_report_size (net);
+    /* a sink that has all it wants is not an error */
+    if ((net->status == CURLE_WRITE_ERROR) &&
+        BACON_PAGE_RESULT (net)->chunk.stopped)
+    {
+      bacon_debug ("%s: stopped after %lu bytes", net->url,
+                   (unsigned long) BACON_PAGE_RESULT (net)->chunk.n);
+      net->status = CURLE_OK;
+    }
+  } else if (net->action == BACON_NET_ACTION_GET_FILE) {
+    /* a long queue of downloads should not keep every file open */
+    bacon_env_fclose (BACON_FILE_RESULT (net)->fp);
+    BACON_FILE_RESULT (net)->fp = NULL;
+  }
+}
+
+/* Transfers waiting for, or holding, a slot on the multi handle */
+typedef struct {
+  BaconNetInstance **nets;
+  int n;
+  int next;
+  int active;
+  int done;
+  CURLMcode mstatus;
+} BaconNetQueue;
+
+/* A set of file downloads that is moved along by the caller's own main
+   loop through bacon_net_batch_step () */
+struct BaconNetBatch {
+  BaconNetFile *files;
+  BaconNetQueue queue;
+};
+
+static void
+bacon_net_queue_init (BaconNetQueue *queue, BaconNetInstance **nets, int n)
+{
+  queue->nets = nets;
+  queue->n = n;
+  queue->next = 0;
+  queue->active = 0;
+  queue->done = 0;
+  queue->mstatus = CURLM_OK;
+}
+
+/* Drops whatever is still queued or in flight */
+static void
+bacon_net_queue_abort (BaconNetQueue *queue)
+{
+  int x;
+
+  for (x = 0; x < queue->n; ++x) {
+    if (x >= queue->next)
+      queue->nets[x]->status = CURLE_ABORTED_BY_CALLBACK;
+    else if (queue->nets[x]->cp) {
+      curl_multi_remove_handle (s_multi, queue->nets[x]->cp);
+      bacon_net_instance_detach (queue->nets[x]);
+      queue->nets[x]->status = CURLE_ABORTED_BY_CALLBACK;
+    }
+  }
+  queue->next = queue->n;
+  queue->active = 0;
+}
+
+/* Runs one round of `queue' on the multi handle with at most
+   `s_max_total' transfers in flight. An instance only gets a curl
+   handle (and opens its file) once it has a slot, and gives it back
+   when it is done, so the queue can be as long as it likes. Anything
+   over the per-host limit is held back by libcurl itself. The round
+   waits up to `wait' milliseconds for something to happen, 0 does not
+   wait at all. Returns false once there is nothing left to run. */
+static BaconBoolean
+bacon_net_queue_step (BaconNetQueue *queue, int wait)
+{
+  int left;
+  int running;
+  char *priv;
+  CURLMsg *msg;
+  BaconNetInstance *net;
+
+  while ((queue->next < queue->n) &&
+         (!s_max_total || (queue->active < s_max_total)))
+  {
+    net = queue->nets[queue->next++];
+    if (bacon_net_instance_attach (net) && bacon_net_setup (net)) {
+      curl_easy_setopt (net->cp, CURLOPT_PRIVATE, (void *) net);
+      curl_multi_add_handle (s_multi, net->cp);
+      queue->active++;
+    } else {
+      if (!net->cp)
+        bacon_net_check (net);
+      bacon_net_instance_detach (net);
+      net->status = CURLE_FAILED_INIT; /* already reported */
+      queue->done++;
+    }
+  }
+  if (!queue->active)
+    return BACON_FALSE;
+
+  queue->mstatus = curl_multi_perform (s_multi, &running);
+  if ((queue->mstatus == CURLM_OK) && running && (wait > 0))
+    queue->mstatus = curl_multi_wait (s_multi, NULL, 0, wait, NULL);
+  if (queue->mstatus != CURLM_OK) {
+    bacon_error (curl_multi_strerror (queue->mstatus));
+    bacon_net_queue_abort (queue);
+    return BACON_FALSE;
+  }
+
+  while ((msg = curl_multi_info_read (s_multi, &left))) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+    priv = NULL;
+    curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, &priv);
+    net = (BaconNetInstance *) priv;
+    net->status = msg->data.result;
+    bacon_net_count_connection (net);
+    bacon_net_finish (net);
+    curl_multi_remove_handle (s_multi, net->cp);
+    bacon_net_instance_detach (net);
+    queue->active--;
+    queue->done++;
+  }
+  return BACON_TRUE;
+}
+
+/* Runs `nets' to the end, see bacon_net_queue_step (). `tick' is called
+   after every round with the instances started so far. */
+static CURLMcode
+bacon_net_run (BaconNetInstance **nets,
+               int n,
+               void (*tick) (BaconNetInstance **, int))
+{
+  BaconNetQueue queue;
+
+  bacon_net_queue_init (&queue, nets, n);
+  while (bacon_net_queue_step (&queue, BACON_SEC_MILLIS))
+    if (tick)
+      tick (nets, queue.next);
+  return queue.mstatus;
+}
+
+static void
+bacon_net_take_validators (BaconNetPage *page, const BaconPageResult *r)
+{
+  page->code = r->code;
+  if (r->code == 304) {
+    /* the old validators stand unless the server sent new ones */
+    if (*r->etag)
+      strcpy (page->etag, r->etag);
+    if (*r->modified)
+      strcpy (page->modified, r->modified);
+    return;
+  }
+  strcpy (page->etag, r->etag);
+  strcpy (page->modified, r->modified);
+}
+
+BaconBoolean
+bacon_net_get_pages (BaconNetPage *pages, int n)
+{
+  int x;
+  BaconBoolean ret;
+  CURLMcode mstatus;
+  BaconNetInstance **nets;
+
+  for (x = 0; x < n; ++x) {
+    pages[x].data = NULL;
+    pages[x].code = 0;
+  }
+
+  if (!bacon_net_multi_init ())
+    return BACON_FALSE;
+
+  /* every page gets its own instance so all of them
+     can be in flight at the same time */
+  nets = bacon_newa (BaconNetInstance *, sizeof (BaconNetInstance *) * n);
+  for (x = 0; x < n; ++x) {
+    nets[x] = bacon_net_instance_alloc (BACON_NET_ACTION_GET_PAGE,
+                                        BACON_GET_CM_URL, pages[x].request,
+                                        -1, NULL);
+    BACON_PAGE_RESULT (nets[x])->chunk.sink = pages[x].sink;
+    BACON_PAGE_RESULT (nets[x])->chunk.user = pages[x].user;
+    strcpy (BACON_PAGE_RESULT (nets[x])->if_etag, pages[x].etag);
+    strcpy (BACON_PAGE_RESULT (nets[x])->if_modified, pages[x].modified);
+  }
+
+  if (bacon_show_progress ())
+    bacon_progress_init ();
+
+  mstatus = bacon_net_run (nets, n, NULL);
+
+  if (bacon_show_progress ())
+    bacon_progress_deinit (BACON_FALSE);
+
+  ret = BACON_TRUE;
+  for (x = 0; x < n; ++x) {
+    if ((mstatus == CURLM_OK) && (nets[x]->status == CURLE_OK)) {
+      /* hand the buffer over to the caller */
+      pages[x].data = BACON_PAGE_RESULT (nets[x])->chunk.buffer;
+      BACON_PAGE_RESULT (nets[x])->chunk.buffer = NULL;
+      bacon_net_take_validators (&pages[x], BACON_PAGE_RESULT (nets[x]));
+    } else {
+      if ((mstatus == CURLM_OK) && (nets[x]->status != CURLE_FAILED_INIT))
+        bacon_error ("%s (%s)",
+                     curl_easy_strerror (nets[x]->status), nets[x]->url);
+      ret = BACON_FALSE;
+    }
+    bacon_net_instance_free (nets[x]);
+  }
+
+  bacon_free (nets);
+  return ret;
+}
+
+/* One progress bar for every file of bacon_net_get_files (); the
+   total grows as the servers report how large each file is */
+static void
+bacon_files_progress (BaconNetInstance **nets, int n)
+{
+  int x;
+  double total;
+  double current;
+  BaconFileResult *r;
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t length;
+#else
+  double length;
+#endif
+
+  total = 0.0;
+  current = 0.0;
+  for (x = 0; x < n; ++x) {
+    r = BACON_FILE_RESULT (nets[x]);
+    if (nets[x]->cp) {
+      length = -1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+      curl_easy_getinfo (nets[x]->cp, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                         &length);
+#else
+      curl_easy_getinfo (nets[x]->cp, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                         &length);
+#endif
+      if (length > 0)
+        r->length = (unsigned long) length;
+    }
+    total += (double) (r->offset + ((r->length > r->done) ? r->length
+                                                          : r->done));
+    current += (double) (r->offset + r->done);
+  }
+  bacon_progress_file (total, current);
+}
+
+BaconBoolean
+bacon_net_get_files (BaconNetFile *files, int n)
+{
+  int x;
+  BaconBoolean ret;
+  CURLMcode mstatus;
+  BaconNetInstance **nets;
+
+  for (x = 0; x < n; ++x)
+    files[x].ok = BACON_FALSE;
+
+  if (!bacon_net_multi_init ())
+    return BACON_FALSE;
+
+  nets = bacon_newa (BaconNetInstance *, sizeof (BaconNetInstance *) * n);
+  for (x = 0; x < n; ++x) {
+    nets[x] = bacon_net_instance_alloc (BACON_NET_ACTION_GET_FILE,
+                                        BACON_GET_CM_URL, files[x].request,
+                                        files[x].offset, files[x].filename);
+    BACON_FILE_RESULT (nets[x])->hash = files[x].hash;
+    /* the files share a single progress bar */
+    BACON_FILE_RESULT (nets[x])->progress = NULL;
+  }
+
+  if (bacon_show_progress ())
+    bacon_progress_init ();
+
+  mstatus = bacon_net_run (nets, n,
+                           bacon_show_progress () ? &bacon_files_progress
+                                                  : NULL);
+
+  if (bacon_show_progress ())
+    bacon_progress_deinit (BACON_TRUE);
+
+  ret = BACON_TRUE;
+  for (x = 0; x < n; ++x) {
+    if ((mstatus == CURLM_OK) && (nets[x]->status == CURLE_OK))
+      files[x].ok = BACON_TRUE;
+    else {
+      if ((mstatus == CURLM_OK) && (nets[x]->status != CURLE_FAILED_INIT))
+        bacon_error ("%s (%s)",
+                     curl_easy_strerror (nets[x]->status), nets[x]->url);
+      ret = BACON_FALSE;
+    }
+    bacon_net_instance_free (nets[x]);
+  }
+
+  bacon_free (nets);
+  return ret;
+}
+
+/* Starts fetching `files' (their requests are relative to `root')
+   without waiting for any of them. Nothing happens until the caller
+   moves the batch along with bacon_net_batch_step (). */
+BaconNetBatch *
+bacon_net_batch_new (const char *root, BaconNetFile *files, int n)
+{
+  int x;
+  BaconNetBatch *batch;
+  BaconNetInstance **nets;
+
+  for (x = 0; x < n; ++x)
+    files[x].ok = BACON_FALSE;
+
+  if (!bacon_net_multi_init ())
+    return NULL;
+
+  nets = bacon_newa (BaconNetInstance *, sizeof (BaconNetInstance *) * n);
+  for (x = 0; x < n; ++x) {
+    nets[x] = bacon_net_instance_alloc (BACON_NET_ACTION_GET_FILE, root,
+                                        files[x].request, files[x].offset,
+                                        files[x].filename);
+    BACON_FILE_RESULT (nets[x])->hash = files[x].hash;
+    BACON_FILE_RESULT (nets[x])->progress = NULL;
+  }
+
+  batch = bacon_new (BaconNetBatch);
+  batch->files = files;
+  bacon_net_queue_init (&batch->queue, nets, n);
+  return batch;
+}
+
+/* Does whatever `batch' can do right now and returns at once, `done'
+   is set to the number of files that are over (for better or worse).
+   Returns false once they all are. */
+BaconBoolean
+bacon_net_batch_step (BaconNetBatch *batch, int *done)
+{
+  BaconBoolean ret;
+
+  ret = bacon_net_queue_step (&batch->queue, 0);
+  if (done)
+    *done = batch->queue.done;
+  return ret;
+}
+
+/* Ends `batch', dropping anything that is not over yet, and tells in
+   the `ok' of every file whether it arrived. Returns false if any of
+   them did not. */
+BaconBoolean
+bacon_net_batch_finish (BaconNetBatch *batch)
+{
+  int x;
+  BaconBoolean ret;
+  BaconNetInstance *net;
+
+  if (!batch)
+    return BACON_FALSE;
+
+  bacon_net_queue_abort (&batch->queue);
+  ret = BACON_TRUE;
+  for (x = 0; x < batch->queue.n; ++x) {
+    net = batch->queue.nets[x];
+    if (net->status == CURLE_OK)
+      batch->files[x].ok = BACON_TRUE;
+    else {
+      if ((batch->queue.mstatus == CURLM_OK) &&
+          (net->status != CURLE_FAILED_INIT) &&
+          (net->status != CURLE_ABORTED_BY_CALLBACK))
+        bacon_error ("%s (%s)", curl_easy_strerror (net->status), net->url);
+      ret = BACON_FALSE;
+    }
+    bacon_net_instance_free (net);
+  }
+  bacon_free (batch->queue.nets);
+  bacon_free (batch);
+  return ret;
+}
+
+#ifdef HAVE_PWRITE
+static char *
+bacon_segments_path (const char *filename)
+{
+  return bacon_strf ("%s%s", filename, BACON_SEGMENTS_SUFFIX);
+}
+
+/* Written to a temporary file and renamed over the old one, so a crash
+   halfway through never leaves a cut off sidecar behind */
+static void
+bacon_segments_save (const char *path,
+                     unsigned long size,
+                     BaconNetInstance **nets,
+                     int n)
+{
+  int x;
+  char *tmp;
+  FILE *fp;
+  BaconBoolean ok;
+
+  tmp = bacon_strf ("%s%s", path, BACON_SEGMENTS_TMP);
+  fp = fopen (tmp, "w");
+  if (!fp) {
+    bacon_debug ("failed to save `%s' (%s)", path, strerror (errno));
+    bacon_free (tmp);
+    return;
+  }
+
+  ok = (fprintf (fp, "%i %lu %i\n", BACON_SEGMENTS_VERSION, size, n) > 0);
+  for (x = 0; ok && (x < n); ++x)
+    ok = (fprintf (fp, "%lu %lu %lu\n",
+                   BACON_RANGE_RESULT (nets[x])->start,
+                   BACON_RANGE_RESULT (nets[x])->end,
+                   BACON_RANGE_RESULT (nets[x])->done) > 0);
+  if (fclose (fp) != 0)
+    ok = BACON_FALSE;
+#ifndef BACON_OS_UNIX
+  if (ok)
+    remove (path);
+#endif
+  if (ok && (rename (tmp, path) != 0))
+    ok = BACON_FALSE;
+
+  if (!ok) {
+    bacon_debug ("failed to save `%s' (%s)", path, strerror (errno));
+    remove (tmp);
+  }
+  bacon_free (tmp);
+}
+
+/* Creates the first `n' range instances, without curl handles */
+static void
+bacon_segments_new (const char *request,
+                    int fd,
+                    BaconNetInstance **nets,
+                    int n)
+{
+  int x;
+
+  for (x = 0; x < n; ++x) {
+    nets[x] = bacon_net_instance_alloc (BACON_NET_ACTION_GET_RANGE,
+                                        BACON_GET_CM_URL, request, -1, NULL);
+    if (nets[x]->res)
+      BACON_RANGE_RESULT (nets[x])->fd = fd;
+  }
+}
+
+static void
+bacon_segments_free (BaconNetInstance **nets, int n)
+{
+  int x;
+
+  for (x = 0; x < n; ++x) {
+    bacon_net_instance_free (nets[x]);
+    nets[x] = NULL;
+  }
+}
+
+/* Fills `nets' from a previous run, returns the number of segments
+   or 0 if there is nothing usable to resume from. */
+static int
+bacon_segments_load (const char *path,
+                     unsigned long size,
+                     const char *request,
+                     int fd,
+                     BaconNetInstance **nets,
+                     int max)
+{
+  int x;
+  int n;
+  int version;
+  unsigned long old_size;
+  FILE *fp;
+  BaconRangeResult *r;
+
+  fp = fopen (path, "r");
+  if (!fp)
+    return 0;
+
+  n = 0;
+  if ((fscanf (fp, "%i %lu %i", &version, &old_size, &n) != 3) ||
+      (version != BACON_SEGMENTS_VERSION) || (old_size != size) ||
+      (n <= 0) || (n > max))
+  {
+    bacon_env_fclose (fp);
+    return 0;
+  }
+
+  bacon_segments_new (request, fd, nets, n);
+  for (x = 0; x < n; ++x) {
+    r = BACON_RANGE_RESULT (nets[x]);
+    if ((fscanf (fp, "%lu %lu %lu", &r->start, &r->end, &r->done) != 3) ||
+        (r->end >= size) || (r->start > r->end) ||
+        (r->done > (r->end - r->start + 1)))
+    {
+      bacon_env_fclose (fp);
+      bacon_segments_free (nets, n);
+      return 0;
+    }
+  }
+  bacon_env_fclose (fp);
+  return n;
+}
+
+static void
+bacon_segments_plan (unsigned long size,
+                     unsigned long offset,
+                     BaconNetInstance **nets,
+                     int n)
+{
+  int x;
+  unsigned long each;
+  unsigned long start;
+  BaconRangeResult *r;
+
+  each = (size - offset) / n;
+  start = offset;
+  for (x = 0; x < n; ++x) {
+    r = BACON_RANGE_RESULT (nets[x]);
+    r->start = start;
+    r->end = (x == (n - 1)) ? (size - 1) : (start + each - 1);
+    r->done = 0;
+    start = r->end + 1;
+  }
+}
+
+BaconBoolean
+bacon_net_has_segments (const char *filename)
+{
+  char *path;
+  BaconBoolean ret;
+
+  path = bacon_segments_path (filename);
+  ret = bacon_env_is_file (path);
+  bacon_free (path);
+  return ret;
+}
+
+void
+bacon_net_forget_segments (const char *filename)
+{
+  char *path;
+
+  path = bacon_segments_path (filename);
+  bacon_env_delete (path);
+  bacon_free (path);
+}
+
+unsigned long
+bacon_net_range_size (const char *request)
+{
+  long code;
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t length;
+#else
+  double length;
+#endif
+  BaconNetInstance *net;
+
+  code = 0;
+  length = -1;
+
+  /* ask for everything from the first byte; only a server that knows
+     about ranges answers this with 206 Partial Content */
+  net = bacon_net_instance_new (BACON_NET_ACTION_GET_PAGE,
+                                BACON_GET_CM_URL, request, -1, NULL);
+  if (bacon_net_check (net)) {
+    curl_easy_setopt (net->cp, CURLOPT_URL, net->url);
+    curl_easy_setopt (net->cp, CURLOPT_USERAGENT, BACON_USERAGENT);
+    curl_easy_setopt (net->cp, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (net->cp, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt (net->cp, CURLOPT_RANGE, "0-");
+    net->status = curl_easy_perform (net->cp);
+    if (net->status == CURLE_OK) {
+      bacon_net_count_connection (net);
+      curl_easy_getinfo (net->cp, CURLINFO_RESPONSE_CODE, &code);
+#if LIBCURL_VERSION_NUM >= 0x073700
+      curl_easy_getinfo (net->cp, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                         &length);
+#else
+      curl_easy_getinfo (net->cp, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+#endif
+    } else
+      bacon_debug ("%s: %s", net->url, curl_easy_strerror (net->status));
+  }
+  bacon_net_instance_free (net);
+
+  if ((code != 206) || (length <= 0))
+    return 0;
+  return (unsigned long) length;
+}
+
+BaconBoolean
+bacon_net_get_file_segmented (const char *request,
+                              const char *filename,
+                              unsigned long size,
+                              unsigned long offset,
+                              int segments)
+{
+  int x;
+  int n;
+  int fd;
+  int left;
+  int running;
+  char *path;
+  unsigned long done;
+  unsigned long resumed;
+  BaconBoolean ret;
+  CURLMcode mstatus;
+  CURLMsg *msg;
+  BaconNetInstance *nets[BACON_NET_SEGMENTS_MAX];
+  struct timeval last;
+  struct timeval now;
+
+  if (!bacon_net_multi_init ())
+    return BACON_FALSE;
+
+  fd = open (filename, O_WRONLY | O_CREAT, 0644);
+  if (fd == -1) {
+    bacon_error ("failed to open file `%s' (%s)", filename, strerror (errno));
+    return BACON_FALSE;
+  }
+
+  /* a partial file at least as big as the remote one is not a prefix
+     of it, it is fetched again from the start */
+  if (offset >= size) {
+    bacon_debug ("`%s' is larger than the remote file - starting over",
+                 filename);
+    offset = 0;
+    if (ftruncate (fd, 0) == -1)
+      bacon_debug ("failed to truncate `%s' (%s)", filename, strerror (errno));
+  }
+
+  if (segments > BACON_NET_SEGMENTS_MAX)
+    segments = BACON_NET_SEGMENTS_MAX;
+  if (((unsigned long) segments) > (size - offset))
+    segments = 1;
+
+  /* a sidecar may hold more ranges than asked for this time, only as
+     many instances as it (or a fresh plan) uses are created and only
+     those take a handle from the pool */
+  path = bacon_segments_path (filename);
+  n = bacon_segments_load (path, size, request, fd,
+                           nets, BACON_NET_SEGMENTS_MAX);
+  if (!n) {
+    n = segments;
+    bacon_segments_new (request, fd, nets, n);
+    bacon_segments_plan (size, offset, nets, n);
+#ifdef HAVE_POSIX_FALLOCATE
+    if (posix_fallocate (fd, 0, (off_t) size) != 0)
+#endif
+      if (ftruncate (fd, (off_t) size) == -1)
+        bacon_debug ("failed to preallocate `%s' (%s)",
+                     filename, strerror (errno));
+    bacon_segments_save (path, size, nets, n);
+  } else
+    offset = 0;
+
+  resumed = offset;
+  for (x = 0; x < n; ++x)
+    resumed += BACON_RANGE_RESULT (nets[x])->done;
+  bacon_debug ("fetching `%s' in %i segments (%lu of %lu bytes done)",
+               filename, n, resumed, size);
+
+  for (x = 0; x < n; ++x) {
+    if (BACON_RANGE_RESULT (nets[x])->done ==
+        (BACON_RANGE_RESULT (nets[x])->end -
+         BACON_RANGE_RESULT (nets[x])->start + 1))
+      nets[x]->status = CURLE_FAILED_INIT; /* nothing left to do */
+    else {
+      bacon_net_instance_attach (nets[x]);
+      if (bacon_net_check (nets[x]) && bacon_net_setup (nets[x]))
+        curl_multi_add_handle (s_multi, nets[x]->cp);
+      else
+        nets[x]->status = CURLE_FAILED_INIT; /* already reported */
+    }
+  }
+
+  if (g_show_progress)
+    bacon_progress_init ();
+
+  running = 0;
+  bacon_get_time_of_day (&last);
+  do {
+    mstatus = curl_multi_perform (s_multi, &running);
+    if ((mstatus == CURLM_OK) && running)
+      mstatus = curl_multi_wait (s_multi, NULL, 0, BACON_SEC_MILLIS, NULL);
+    if (mstatus != CURLM_OK) {
+      bacon_error (curl_multi_strerror (mstatus));
+      break;
+    }
+    done = 0;
+    for (x = 0; x < n; ++x)
+      done += BACON_RANGE_RESULT (nets[x])->done;
+    if (g_show_progress)
+      bacon_progress_file ((double) (size - resumed),
+                           (double) (offset + done - resumed));
+    bacon_get_time_of_day (&now);
+    if (bacon_get_millis (&last, &now) >= BACON_SEC_MILLIS) {
+      bacon_segments_save (path, size, nets, n);
+      last = now;
+    }
+  } while (running);
+
+  if (g_show_progress)
+    bacon_progress_deinit (BACON_TRUE);
+
+  while ((msg = curl_multi_info_read (s_multi, &left))) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+    for (x = 0; x < n; ++x) {
+      if (nets[x]->cp == msg->easy_handle) {
+        nets[x]->status = msg->data.result;
+        bacon_net_count_connection (nets[x]);
+        break;
+      }
+    }
+  }
+
+  ret = BACON_TRUE;
+  for (x = 0; x < n; ++x) {
+    if (nets[x]->cp)
+      curl_multi_remove_handle (s_multi, nets[x]->cp);
+    if (BACON_RANGE_RESULT (nets[x])->done !=
+        (BACON_RANGE_RESULT (nets[x])->end -
+         BACON_RANGE_RESULT (nets[x])->start + 1))
+    {
+      if (BACON_RANGE_RESULT (nets[x])->code &&
+          ((BACON_RANGE_RESULT (nets[x])->code != 206) ||
+           !BACON_RANGE_RESULT (nets[x])->accepted))
+        bacon_error ("segment %i of `%s' was not sent as the range it "
+                     "asked for (HTTP %li)", x + 1, filename,
+                     BACON_RANGE_RESULT (nets[x])->code);
+      else if (nets[x]->status != CURLE_FAILED_INIT)
+        bacon_error ("segment %i of `%s' failed (%s)", x + 1, filename,
+                     curl_easy_strerror (nets[x]->status));
+      ret = BACON_FALSE;
+    }
+  }
+
+  if (close (fd) == -1) {
+    bacon_warn ("failed to close file (%s)", strerror (errno));
+    ret = BACON_FALSE;
+  }
+
+  if (ret)
+    bacon_env_delete (path);
+  else
+    bacon_segments_save (path, size, nets, n);
+
+  bacon_segments_free (nets, n);
+  bacon_free (path);
+  return ret;
+}
+#endif
+
+void
+bacon_net_cleanup (void)
+{
+  if (s_net)
+    bacon_net_deinit ();
+
+  bacon_debug ("%lu of %lu transfers reused an existing connection",
+               s_reused, s_transfers);
+  bacon_debug ("%lu page buffer allocations for %lu writes (%lu bytes)",
+               s_page_allocs, s_page_writes, s_page_bytes);
+
+  if (s_multi) {
+    curl_multi_cleanup (s_multi);
+    s_multi = NULL;
+  }
+
+  while (s_n_handles > 0)
+    curl_easy_cleanup (s_handles[--s_n_handles]);
+
+  if (s_share) {
+    curl_share_cleanup (s_share);
+    s_share = NULL;
+  }
+}
@@ -22,6 +22,7 @@
 #define BACON_NET_H
 
 #include "bacon.h"
+#include "bacon-hash.h"
 
 #ifdef BACON_GTK
 # include <gtk/gtk.h>
@@ -33,25 +34,86 @@ extern "C" {
 
 /* The main URL where all the device/rom info comes from */
 #define BACON_GET_CM_URL             "http://get.cm"
+/* Upper limit for the number of parallel ranges in a segmented download */
+#define BACON_NET_SEGMENTS_MAX       16
+/* Upper limit for the number of transfers in flight at once */
+#define BACON_NET_JOBS_MAX           64
+/* Room for an ETag or Last-Modified value */
+#define BACON_NET_VALIDATOR_MAX      128
 /* Use these URLs from the CM wiki page for device icons in the GUI */
 #ifdef BACON_GTK
 # define BACON_DEVICE_ICONS_URL      "http://wiki.cyanogenmod.org/w/Devices#"
 # define BACON_DEVICE_ICON_THUMB_URL "http://wiki.cyanogenmod.org/images"
 #endif
 
+/* A page request for bacon_net_get_pages (). On success `data' holds
+   the page contents and must be freed by the caller. If `sink' is set the
+   page is handed to it chunk by chunk instead (and `data' stays empty);
+   once it returns false the rest of the page is not downloaded.
+   A non-empty `etag' or `modified' makes the request conditional; if
+   nothing changed `code' is 304 and nothing reaches the sink. On
+   success `code' is the HTTP status and `etag' and `modified' hold
+   whatever the server sent for the page. */
+typedef struct {
+  const char *request;
+  char *data;
+  BaconBoolean (*sink) (const char *data, size_t n, void *user);
+  void *user;
+  char etag[BACON_NET_VALIDATOR_MAX];
+  char modified[BACON_NET_VALIDATOR_MAX];
+  long code;
+} BaconNetPage;
+
+/* A file request for bacon_net_get_files (). The download starts at
+   `offset' and `hash' (if set) is treated as with
+   bacon_net_init_for_rom (). `ok' tells whether the file arrived. */
+typedef struct {
+  const char *request;
+  const char *filename;
+  unsigned long offset;
+  BaconHashCtx *hash;
+  BaconBoolean ok;
+} BaconNetFile;
+
+/* File downloads that are moved along without blocking, see
+   bacon_net_batch_new () */
+typedef struct BaconNetBatch BaconNetBatch;
+
 BaconBoolean bacon_net_init_for_page_data (const char *request);
 BaconBoolean bacon_net_init_for_rom (const char *request,
                                      unsigned long offset,
-                                     const char *filename);
+                                     const char *filename,
+                                     BaconHashCtx *hash);
 void bacon_net_deinit (void);
 char *bacon_net_get_page_data (void);
 BaconBoolean bacon_net_get_file (void);
+BaconBoolean bacon_net_get_pages (BaconNetPage *pages, int n);
+BaconBoolean bacon_net_get_files (BaconNetFile *files, int n);
+BaconNetBatch *bacon_net_batch_new (const char *root,
+                                    BaconNetFile *files,
+                                    int n);
+BaconBoolean bacon_net_batch_step (BaconNetBatch *batch, int *done);
+BaconBoolean bacon_net_batch_finish (BaconNetBatch *batch);
+void bacon_net_set_limits (int total, int per_host);
+void bacon_net_get_limits (int *total, int *per_host);
+#ifdef HAVE_PWRITE
+BaconBoolean bacon_net_has_segments (const char *filename);
+void bacon_net_forget_segments (const char *filename);
+unsigned long bacon_net_range_size (const char *request);
+BaconBoolean bacon_net_get_file_segmented (const char *request,
+                                           const char *filename,
+                                           unsigned long size,
+                                           unsigned long offset,
+                                           int segments);
+#endif
+void bacon_net_cleanup (void);
 #ifdef BACON_GTK
 BaconBoolean bacon_net_init_for_device_icons (void);
 BaconBoolean bacon_net_init_for_device_icon_thumb (const char *request,
                                                    const char *filename);
 BaconBoolean
 bacon_net_gtk_init_for_device_list (GtkProgressBar *progress_bar);
+void bacon_net_gtk_cancel (void);
 #endif
 
 #ifdef __cplusplus
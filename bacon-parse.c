@@ -25,6 +25,7 @@
 #include "bacon-net.h"
 #include "bacon-out.h"
 #include "bacon-parse.h"
+#include "bacon-str.h"
 #include "bacon-util.h"
 
 #define BACON_CODENAME_TAG       "<span class=\"codename\">"
@@ -38,7 +39,8 @@
 # define BACON_THUMB_URL_PATTERN "wiki.cyanogenmod.org/images/"
 #endif
 
-#define BACON_LINE_MAX 1024
+#define BACON_LINE_MAX        1024
+#define BACON_ROM_PATTERN_MAX 32
 
 #define bacon_find_and_fill(__dst, __src, __p, __np, __x, __c) \
   do {                                                         \
@@ -52,15 +54,56 @@
 
 static size_t s_n_codename_tag      = 0;
 static size_t s_n_fullname_tag      = 0;
-static size_t s_n_rom_name_pattern  = 0;
-static size_t s_n_hash_pattern      = 0;
-static size_t s_n_get_pattern       = 0;
-static size_t s_n_size_tag          = 0;
-static size_t s_n_date_tag          = 0;
 #ifdef BACON_GTK
 static size_t s_n_thumb_url_pattern = 0;
 #endif
 
+/* The fields of a ROM in the order they appear on a get.cm page. Each
+   one is found by its pattern and runs up to its stop character. */
+enum {
+  BACON_ROM_FIELD_NAME,
+  BACON_ROM_FIELD_HASH,
+  BACON_ROM_FIELD_GET,
+  BACON_ROM_FIELD_SIZE,
+  BACON_ROM_FIELD_DATE,
+  BACON_ROM_FIELD_TOTAL
+};
+
+typedef struct {
+  const char *pattern;
+  char stop;
+} BaconRomField;
+
+static const BaconRomField s_rom_fields[BACON_ROM_FIELD_TOTAL] = {
+  { BACON_ROM_NAME_PATTERN, '<' },
+  { BACON_HASH_PATTERN, ' ' },
+  { BACON_GET_PATTERN, '"' },
+  { BACON_SIZE_TAG, '<' },
+  { BACON_DATE_TAG, '<' }
+};
+
+/* KMP failure tables, so a pattern split across two chunks is still
+   found without looking back at data that is gone */
+static size_t       s_rom_field_len  [BACON_ROM_FIELD_TOTAL];
+static size_t       s_rom_field_fail [BACON_ROM_FIELD_TOTAL]
+                                     [BACON_ROM_PATTERN_MAX];
+static BaconBoolean s_rom_fields_ready = BACON_FALSE;
+
+struct BaconRomParser {
+  int max;
+  int n_roms;
+  int field;
+  BaconBoolean reading;
+  BaconBoolean done;
+  size_t matched;
+  size_t len;
+  char hex[BACON_HASH_HEX_SIZE];
+  BaconRomPool *pool;
+  BaconRom *rom;
+  BaconRom *p;
+  BaconRom *tail;
+};
+
 static void
 bacon_set_size_values (void)
 {
@@ -70,21 +113,6 @@ bacon_set_size_values (void)
   if (!s_n_fullname_tag)
     s_n_fullname_tag = strlen (BACON_FULLNAME_TAG);
 
-  if (!s_n_rom_name_pattern)
-    s_n_rom_name_pattern = strlen (BACON_ROM_NAME_PATTERN);
-
-  if (!s_n_hash_pattern)
-    s_n_hash_pattern = strlen (BACON_HASH_PATTERN);
-
-  if (!s_n_get_pattern)
-    s_n_get_pattern = strlen (BACON_GET_PATTERN);
-
-  if (!s_n_size_tag)
-    s_n_size_tag = strlen (BACON_SIZE_TAG);
-
-  if (!s_n_date_tag)
-    s_n_date_tag = strlen (BACON_DATE_TAG);
-
 #ifdef BACON_GTK
   if (!s_n_thumb_url_pattern)
     s_n_thumb_url_pattern = strlen (BACON_THUMB_URL_PATTERN);
@@ -147,11 +175,15 @@ bacon_parse_local_for_device_list (const char *data)
   size_t l;
   size_t pos;
   char line[BACON_LINE_MAX];
+  char codename[BACON_DEVICE_NAME_MAX];
+  char fullname[BACON_DEVICE_NAME_MAX];
   BaconDeviceList *p;
   BaconDeviceList *list;
+  BaconDeviceList *tail;
 
   pos = 0;
   list = NULL;
+  tail = NULL;
   bacon_set_size_values ();
 
   while (BACON_TRUE) {
@@ -159,11 +191,12 @@ bacon_parse_local_for_device_list (const char *data)
     l = 0;
     if (!*line)
       break;
-    bacon_list_append (BaconDeviceList, list, p);
+    bacon_list_append_tail (BaconDeviceList, list, tail, p);
+    bacon_fill_buffer_pos (codename, line, &l, '@');
+    bacon_fill_buffer_pos (fullname, line, &l, '\0');
     p->device = bacon_new (BaconDevice);
-    bacon_fill_buffer_pos (p->device->codename, line, &l, '@');
-    bacon_fill_buffer_pos (p->device->fullname, line, &l, '\0');
-    bacon_list_rewind (list, p);
+    p->device->codename = bacon_strdup (codename);
+    p->device->fullname = bacon_strdup (fullname);
   }
   return list;
 }
@@ -173,24 +206,30 @@ bacon_parse_remote_for_device_list (const char *data)
 {
   char *d;
   char *x;
+  char codename[BACON_DEVICE_NAME_MAX];
+  char fullname[BACON_DEVICE_NAME_MAX];
   BaconDeviceList *p;
   BaconDeviceList *list;
+  BaconDeviceList *tail;
 
   d = NULL;
   list = NULL;
+  tail = NULL;
   bacon_set_size_values ();
 
   while (BACON_TRUE) {
     x = strstr ((!d) ? data : d, BACON_CODENAME_TAG);
     if (x && *x) {
       x = x + s_n_codename_tag;
-      bacon_list_append (BaconDeviceList, list, p);
-      p->device = bacon_new (BaconDevice);
-      bacon_fill_buffer (p->device->codename, x, '<');
+      bacon_list_append_tail (BaconDeviceList, list, tail, p);
+      bacon_fill_buffer (codename, x, '<');
       d = x;
-      bacon_find_and_fill (p->device->fullname, d, BACON_FULLNAME_TAG,
+      *fullname = '\0';
+      bacon_find_and_fill (fullname, d, BACON_FULLNAME_TAG,
                            s_n_fullname_tag, x, '<');
-      bacon_list_rewind (list, p);
+      p->device = bacon_new (BaconDevice);
+      p->device->codename = bacon_strdup (codename);
+      p->device->fullname = bacon_strdup (fullname);
     } else
       break;
   }
@@ -209,41 +248,191 @@ bacon_parse_for_device_list (const char *data, BaconBoolean local)
   return list;
 }
 
+static void
+bacon_rom_fields_prepare (void)
+{
+  int f;
+  size_t x;
+  size_t k;
+  const char *pattern;
+
+  if (s_rom_fields_ready)
+    return;
+
+  for (f = 0; f < BACON_ROM_FIELD_TOTAL; ++f) {
+    pattern = s_rom_fields[f].pattern;
+    s_rom_field_len[f] = strlen (pattern);
+    s_rom_field_fail[f][0] = 0;
+    for (x = 1, k = 0; x < s_rom_field_len[f]; ++x) {
+      while (k && (pattern[x] != pattern[k]))
+        k = s_rom_field_fail[f][k - 1];
+      if (pattern[x] == pattern[k])
+        ++k;
+      s_rom_field_fail[f][x] = k;
+    }
+  }
+  s_rom_fields_ready = BACON_TRUE;
+}
+
+BaconRomParser *
+bacon_rom_parser_new (int max)
+{
+  BaconRomParser *parser;
+
+  bacon_rom_fields_prepare ();
+  parser = bacon_new (BaconRomParser);
+  memset (parser, 0, sizeof (BaconRomParser));
+  parser->max = max;
+  parser->field = BACON_ROM_FIELD_NAME;
+  parser->pool = bacon_rom_pool_new ();
+  parser->rom = NULL;
+  parser->p = NULL;
+  parser->tail = NULL;
+  if (max <= 0)
+    parser->done = BACON_TRUE;
+  return parser;
+}
+
+/* The view of the field being read, NULL for the hash which is
+   decoded from `hex' instead */
+static BaconRomView *
+bacon_rom_parser_view (BaconRomParser *parser)
+{
+  switch (parser->field) {
+  case BACON_ROM_FIELD_NAME:
+    return &parser->p->name;
+  case BACON_ROM_FIELD_HASH:
+    return NULL;
+  case BACON_ROM_FIELD_GET:
+    return &parser->p->get;
+  case BACON_ROM_FIELD_SIZE:
+    return &parser->p->size;
+  default:
+    ;
+  }
+  return &parser->p->date;
+}
+
+static void
+bacon_rom_parser_start_rom (BaconRomParser *parser)
+{
+  parser->p = bacon_rom_new (&parser->rom, &parser->tail, parser->pool);
+  parser->n_roms++;
+}
+
+static void
+bacon_rom_parser_end_field (BaconRomParser *parser)
+{
+  if (parser->field == BACON_ROM_FIELD_HASH)
+    bacon_hash_from_hex (&parser->p->hash, BACON_HASH_MD5, parser->hex);
+
+  parser->reading = BACON_FALSE;
+  if (++parser->field < BACON_ROM_FIELD_TOTAL)
+    return;
+
+  parser->field = BACON_ROM_FIELD_NAME;
+  if (parser->n_roms >= parser->max)
+    parser->done = BACON_TRUE;
+}
+
+/* Feeds the next `n' bytes of a ROM page to `parser'. Returns false once
+   `max' complete ROMs have been read and the rest of the page is of no
+   more use. */
+BaconBoolean
+bacon_rom_parser_feed (BaconRomParser *parser, const char *data, size_t n)
+{
+  int f;
+  size_t x;
+  size_t size;
+  size_t len;
+  BaconRomView *view;
+  const char *c;
+  const char *pattern;
+
+  x = 0;
+  while ((x < n) && !parser->done) {
+    f = parser->field;
+    if (parser->reading) {
+      /* take the value up to its stop character, a broken page can not
+         make one run on for ever */
+      view = bacon_rom_parser_view (parser);
+      size = (view) ? BACON_ROM_FIELD_MAX : BACON_HASH_HEX_SIZE - 1;
+      c = (const char *) memchr (data + x, s_rom_fields[f].stop, n - x);
+      len = (size_t) ((c ? c : (data + n)) - (data + x));
+      if (parser->len + len > size)
+        len = (parser->len < size) ? (size - parser->len) : 0;
+      if (view)
+        bacon_rom_pool_append (parser->pool, view, data + x, len);
+      else {
+        memcpy (parser->hex + parser->len, data + x, len);
+        parser->hex[parser->len + len] = '\0';
+      }
+      parser->len += len;
+      if (!c)
+        break;
+      x = (size_t) (c - data);
+      bacon_rom_parser_end_field (parser);
+      continue;
+    }
+
+    pattern = s_rom_fields[f].pattern;
+    if (!parser->matched) {
+      c = (const char *) memchr (data + x, *pattern, n - x);
+      if (!c)
+        break;
+      x = (size_t) (c - data);
+    }
+    while (parser->matched && (data[x] != pattern[parser->matched]))
+      parser->matched = s_rom_field_fail[f][parser->matched - 1];
+    if (data[x] == pattern[parser->matched])
+      parser->matched++;
+    ++x;
+
+    if (parser->matched == s_rom_field_len[f]) {
+      parser->matched = 0;
+      parser->reading = BACON_TRUE;
+      parser->len = 0;
+      if (f == BACON_ROM_FIELD_NAME)
+        bacon_rom_parser_start_rom (parser);
+      if (f == BACON_ROM_FIELD_HASH)
+        *parser->hex = '\0';
+      else
+        bacon_rom_pool_start (parser->pool, bacon_rom_parser_view (parser));
+    }
+  }
+  return !parser->done;
+}
+
+/* Ends parsing and hands over the ROMs found so far, a ROM cut off by the
+   end of the page keeps the fields it got. */
 BaconRom *
-bacon_parse_for_rom (const char *data, int max)
+bacon_rom_parser_finish (BaconRomParser *parser)
 {
-  int m;
-  char *x;
-  char *d;
-  BaconRom *p;
   BaconRom *rom;
 
-  m = 0;
-  d = NULL;
-  rom = NULL;
-  bacon_set_size_values ();
-  
-  while (m < max) {
-    x = strstr ((!d) ? data : d, BACON_ROM_NAME_PATTERN);
-    if (x && *x) {
-      m++;
-      x = x + s_n_rom_name_pattern;
-      bacon_list_append (BaconRom, rom, p);
-      bacon_fill_buffer (p->name, x, '<');
-      d = x;
-      bacon_find_and_fill (p->hash.hash, d, BACON_HASH_PATTERN,
-                           s_n_hash_pattern, x, ' ');
-      bacon_find_and_fill (p->get, d, BACON_GET_PATTERN,
-                           s_n_get_pattern, x, '"');
-      bacon_find_and_fill (p->size, d, BACON_SIZE_TAG, s_n_size_tag, x, '<');
-      bacon_find_and_fill (p->date, d, BACON_DATE_TAG, s_n_date_tag, x, '<');
-      bacon_list_rewind (rom, p);
-    } else
-      break;
+  if (parser->reading && (parser->field == BACON_ROM_FIELD_HASH))
+    bacon_rom_parser_end_field (parser);
+  rom = parser->rom;
+  if (rom)
+    bacon_rom_pool_trim (parser->pool);
+  else {
+    bacon_free (parser->pool->data);
+    bacon_free (parser->pool);
   }
+  bacon_free (parser);
   return rom;
 }
 
+BaconRom *
+bacon_parse_for_rom (const char *data, int max)
+{
+  BaconRomParser *parser;
+
+  parser = bacon_rom_parser_new (max);
+  bacon_rom_parser_feed (parser, data, strlen (data));
+  return bacon_rom_parser_finish (parser);
+}
+
 #ifdef BACON_GTK
 BaconDeviceThumbRequestList *
 bacon_parse_for_device_thumb_request_list (const char *data,
@@ -255,10 +444,12 @@ bacon_parse_for_device_thumb_request_list (const char *data,
   BaconDeviceList *dp;
   BaconDeviceThumbRequestList *p;
   BaconDeviceThumbRequestList *list;
+  BaconDeviceThumbRequestList *tail;
 
   e = NULL;
   x = NULL;
   list = NULL;
+  tail = NULL;
   bacon_set_size_values ();
 
   for (dp = devicelist; dp; dp = dp->next) {
@@ -268,7 +459,8 @@ bacon_parse_for_device_thumb_request_list (const char *data,
       d = x;
       x = strstr (d, BACON_THUMB_URL_PATTERN);
       if (x && *x) {
-        bacon_list_append (BaconDeviceThumbRequestList, list, p);
+        bacon_list_append_tail (BaconDeviceThumbRequestList, list, tail, p);
+        p->codename = dp->device->codename;
         x = x + s_n_thumb_url_pattern;
         bacon_fill_buffer (p->request, x, '"');
         if (p->request && *p->request) {
@@ -282,7 +474,6 @@ bacon_parse_for_device_thumb_request_list (const char *data,
                        dp->device->codename);
         snprintf (p->filename, BACON_PATH_MAX, "device-%s%s",
                   dp->device->codename, (e && *e) ? e : ".png");
-        bacon_list_rewind (list, p);
       }
     }
   }
@@ -32,6 +32,15 @@ extern "C" {
 BaconDeviceList *bacon_parse_for_device_list (const char *data,
                                               BaconBoolean local);
 BaconRom *bacon_parse_for_rom (const char *data, int max);
+
+/* Incremental ROM page parsing, for feeding a page as it downloads */
+typedef struct BaconRomParser BaconRomParser;
+
+BaconRomParser *bacon_rom_parser_new (int max);
+BaconBoolean bacon_rom_parser_feed (BaconRomParser *parser,
+                                    const char *data,
+                                    size_t n);
+BaconRom *bacon_rom_parser_finish (BaconRomParser *parser);
 #ifdef BACON_GTK
 BaconDeviceThumbRequestList *
 bacon_parse_for_device_thumb_request_list (const char *data,
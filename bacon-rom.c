@@ -19,11 +19,19 @@
  */
 
 #include "bacon.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "bacon-env.h"
 #include "bacon-net.h"
 #include "bacon-out.h"
 #include "bacon-parse.h"
 #include "bacon-rom.h"
+#include "bacon-romcache.h"
+#include "bacon-str.h"
 #include "bacon-util.h"
 
 #define BACON_ROM_TYPE_TEST_STRING     "Experimental"
@@ -40,100 +48,368 @@
 #define BACON_ALL_FORMAT               ""
 #define BACON_REQUEST_FORMAT           "?device=%s&type=%s"
 
-#define BACON_REQUEST_MAX 256
+#define BACON_REQUEST_MAX  256
+#define BACON_ROM_POOL_MIN 256
+
+extern int g_segments;
+extern int g_cache_ttl;
 
-static char s_request[BACON_REQUEST_MAX];
+static const char *
+bacon_rom_type_format (int id)
+{
+  switch (id) {
+  case BACON_ROM_NIGHTLY:
+    return BACON_NIGHTLY_FORMAT;
+  case BACON_ROM_RC:
+    return BACON_RC_FORMAT;
+  case BACON_ROM_SNAPSHOT:
+    return BACON_SNAPSHOT_FORMAT;
+  case BACON_ROM_STABLE:
+    return BACON_STABLE_FORMAT;
+  case BACON_ROM_TEST:
+    return BACON_TEST_FORMAT;
+  default:
+    ;
+  }
+  return BACON_ALL_FORMAT;
+}
+
+static void
+bacon_form_request (char *request, const char *codename, int id)
+{
+  snprintf (request, BACON_REQUEST_MAX, BACON_REQUEST_FORMAT,
+            codename, bacon_rom_type_format (id));
+}
 
 static void
-bacon_form_request (const char *codename, int id)
+bacon_rom_pool_reserve (BaconRomPool *pool, size_t n)
 {
-  const char *type_str;
+  size_t size;
+
+  if ((pool->n + n) <= pool->size)
+    return;
+  /* views only have room for 32 bit offsets */
+  if ((pool->n + n) > UINT_MAX) {
+    bacon_error ("ROM list too large");
+    exit (EXIT_FAILURE);
+  }
+  size = (pool->size) ? pool->size : BACON_ROM_POOL_MIN;
+  while (size < (pool->n + n))
+    size *= 2;
+  pool->data = (char *) bacon_realloc (pool->data, size);
+  pool->size = size;
+}
+
+BaconRomPool *
+bacon_rom_pool_new (void)
+{
+  BaconRomPool *pool;
+
+  pool = bacon_new (BaconRomPool);
+  pool->data = NULL;
+  pool->n = 0;
+  pool->size = 0;
+  bacon_rom_pool_reserve (pool, 1);
+  pool->data[pool->n++] = '\0';
+  return pool;
+}
+
+/* Starts `view' as an empty field at the end of `pool' */
+void
+bacon_rom_pool_start (BaconRomPool *pool, BaconRomView *view)
+{
+  bacon_rom_pool_reserve (pool, 1);
+  view->offset = (unsigned int) pool->n;
+  view->length = 0;
+  pool->data[pool->n++] = '\0';
+}
+
+/* Adds `n' bytes of `s' to `view', which must be the last field
+   started in `pool' */
+void
+bacon_rom_pool_append (BaconRomPool *pool,
+                       BaconRomView *view,
+                       const char *s,
+                       size_t n)
+{
+  bacon_rom_pool_reserve (pool, n);
+  memcpy (pool->data + pool->n - 1, s, n);
+  pool->n += n;
+  pool->data[pool->n - 1] = '\0';
+  view->length += (unsigned int) n;
+}
+
+void
+bacon_rom_pool_add (BaconRomPool *pool,
+                    BaconRomView *view,
+                    const char *s,
+                    size_t n)
+{
+  bacon_rom_pool_start (pool, view);
+  bacon_rom_pool_append (pool, view, s, n);
+}
+
+/* Gives back the room a finished pool did not use */
+void
+bacon_rom_pool_trim (BaconRomPool *pool)
+{
+  if (pool->n == pool->size)
+    return;
+  pool->data = (char *) bacon_realloc (pool->data, pool->n);
+  pool->size = pool->n;
+}
+
+/* Appends a ROM with empty fields to the list at `root', its text will
+   go to `pool' */
+BaconRom *
+bacon_rom_new (BaconRom **root, BaconRom **tail, BaconRomPool *pool)
+{
+  BaconRom *p;
+  BaconRom *r;
+  BaconRom *t;
+
+  r = *root;
+  t = *tail;
+  bacon_list_append_tail (BaconRom, r, t, p);
+  *root = r;
+  *tail = t;
+  memset (&p->name, 0, sizeof (BaconRomView));
+  memset (&p->get, 0, sizeof (BaconRomView));
+  memset (&p->size, 0, sizeof (BaconRomView));
+  memset (&p->date, 0, sizeof (BaconRomView));
+  memset (&p->hash, 0, sizeof (BaconHash));
+  p->pool = pool;
+  return p;
+}
+
+/* Frees the list at `rom' along with the pool its ROMs share */
+void
+bacon_rom_free (BaconRom *rom)
+{
+  BaconRomPool *pool;
+
+  if (!rom)
+    return;
+  pool = rom->pool;
+  bacon_list_free (rom);
+  bacon_free (pool->data);
+  bacon_free (pool);
+}
+
+/* Copies the first `max' ROMs of `rom' */
+static BaconRom *
+bacon_rom_list_copy (const BaconRom *rom, int max)
+{
+  int n;
+  BaconRom *p;
+  BaconRom *root;
+  BaconRom *tail;
+  BaconRomPool *pool;
+
+  if (!rom || (max <= 0))
+    return NULL;
+
+  root = NULL;
+  tail = NULL;
+  pool = bacon_rom_pool_new ();
+  for (n = 0; rom && (n < max); rom = rom->next, ++n) {
+    p = bacon_rom_new (&root, &tail, pool);
+    bacon_rom_pool_add (pool, &p->name, bacon_rom_name (rom),
+                        rom->name.length);
+    bacon_rom_pool_add (pool, &p->get, bacon_rom_get (rom), rom->get.length);
+    bacon_rom_pool_add (pool, &p->size, bacon_rom_size (rom),
+                        rom->size.length);
+    bacon_rom_pool_add (pool, &p->date, bacon_rom_date (rom),
+                        rom->date.length);
+    p->hash = rom->hash;
+  }
+  bacon_rom_pool_trim (pool);
+  return root;
+}
+
+/* Loads the cached list of a page if it can answer for `max' ROMs */
+static BaconBoolean
+bacon_rom_cache_lookup (BaconRomCache *cache,
+                        const char *codename,
+                        int id,
+                        int max)
+{
+  if (!bacon_romcache_load (cache, codename, bacon_rom_type_format (id)))
+    return BACON_FALSE;
+  if (cache->complete || (bacon_rom_total (cache->roms) >= max))
+    return BACON_TRUE;
+  bacon_romcache_clear (cache);
+  return BACON_FALSE;
+}
+
+static BaconBoolean
+bacon_rom_type_wanted (int type, int id)
+{
+  if (type & BACON_ROM_TYPE_ALL)
+    return BACON_TRUE;
 
-  *s_request = '\0';
   switch (id) {
   case BACON_ROM_NIGHTLY:
-    type_str = BACON_NIGHTLY_FORMAT;
-    break;
+    return (type & BACON_ROM_TYPE_NIGHTLY) ? BACON_TRUE : BACON_FALSE;
   case BACON_ROM_RC:
-    type_str = BACON_RC_FORMAT;
-    break;
+    return (type & BACON_ROM_TYPE_RC) ? BACON_TRUE : BACON_FALSE;
   case BACON_ROM_SNAPSHOT:
-    type_str = BACON_SNAPSHOT_FORMAT;
-    break;
+    return (type & BACON_ROM_TYPE_SNAPSHOT) ? BACON_TRUE : BACON_FALSE;
   case BACON_ROM_STABLE:
-    type_str = BACON_STABLE_FORMAT;
-    break;
+    return (type & BACON_ROM_TYPE_STABLE) ? BACON_TRUE : BACON_FALSE;
   case BACON_ROM_TEST:
-    type_str = BACON_TEST_FORMAT;
-    break;
+    return (type & BACON_ROM_TYPE_TEST) ? BACON_TRUE : BACON_FALSE;
   default:
-    type_str = BACON_ALL_FORMAT;
-    break;
+    ;
   }
+  return BACON_FALSE;
+}
 
-  snprintf (s_request, BACON_REQUEST_MAX,
-            BACON_REQUEST_FORMAT, codename, type_str);
+static BaconBoolean
+bacon_rom_page_sink (const char *data, size_t n, void *parser)
+{
+  return bacon_rom_parser_feed ((BaconRomParser *) parser, data, n);
 }
 
-static BaconRom *
-bacon_setup_rom (const char *codename, int id, int *max)
+/* Fetches the ROM lists of `n' devices in one go, every type page of
+   every device shares the same pool of transfers. A page that was
+   cached less than `g_cache_ttl' seconds ago is not fetched at all, an
+   older one is only sent again by the server if it has changed. */
+BaconRomList **
+bacon_rom_lists_new (const char *const *codenames,
+                     const int *types,
+                     const int *maxes,
+                     int n)
 {
-  char *data;
+  int x;
+  int y;
+  int n_pages;
+  int *ids;
+  int *owners;
+  long now;
+  char (*requests)[BACON_REQUEST_MAX];
+  BaconBoolean *cached;
+  BaconNetPage *pages;
+  BaconRomCache *caches;
+  BaconRomParser **parsers;
   BaconRom *rom;
+  BaconRomList **lists;
 
-  rom = NULL;
-  bacon_form_request (codename, id);
-  if (bacon_net_init_for_page_data (s_request)) {
-    data = bacon_net_get_page_data ();
-    if (data)
-      rom = bacon_parse_for_rom (data, *max);
-    bacon_net_deinit ();
+  lists = bacon_newa (BaconRomList *, sizeof (BaconRomList *) * n);
+  ids = bacon_newa (int, sizeof (int) * n * BACON_ROM_TOTAL);
+  owners = bacon_newa (int, sizeof (int) * n * BACON_ROM_TOTAL);
+  requests = bacon_malloc (BACON_REQUEST_MAX * n * BACON_ROM_TOTAL);
+  cached = bacon_newa (BaconBoolean,
+                       sizeof (BaconBoolean) * n * BACON_ROM_TOTAL);
+  pages = bacon_newa (BaconNetPage,
+                      sizeof (BaconNetPage) * n * BACON_ROM_TOTAL);
+  caches = bacon_newa (BaconRomCache,
+                       sizeof (BaconRomCache) * n * BACON_ROM_TOTAL);
+  parsers = bacon_newa (BaconRomParser *,
+                        sizeof (BaconRomParser *) * n * BACON_ROM_TOTAL);
+
+  now = (long) time (NULL);
+  n_pages = 0;
+  for (y = 0; y < n; ++y) {
+    lists[y] = bacon_new (BaconRomList);
+    for (x = 0; x < BACON_ROM_TOTAL; ++x) {
+      lists[y]->roms[x] = NULL;
+      if (!bacon_rom_type_wanted (types[y], x))
+        continue;
+
+      cached[n_pages] = bacon_rom_cache_lookup (&caches[n_pages],
+                                                codenames[y], x, maxes[y]);
+      if (cached[n_pages] && (now >= caches[n_pages].fetched) &&
+          ((now - caches[n_pages].fetched) < g_cache_ttl))
+      {
+        lists[y]->roms[x] = bacon_rom_list_copy (caches[n_pages].roms,
+                                                 maxes[y]);
+        bacon_romcache_clear (&caches[n_pages]);
+        continue;
+      }
+
+      memset (&pages[n_pages], 0, sizeof (BaconNetPage));
+      if (cached[n_pages]) {
+        strcpy (pages[n_pages].etag, caches[n_pages].etag);
+        strcpy (pages[n_pages].modified, caches[n_pages].modified);
+      }
+      bacon_form_request (requests[n_pages], codenames[y], x);
+      /* ROMs are picked out of each page while it is still arriving,
+         and the page is cut short once `max' of them are in */
+      parsers[n_pages] = bacon_rom_parser_new (maxes[y]);
+      pages[n_pages].request = requests[n_pages];
+      pages[n_pages].sink = &bacon_rom_page_sink;
+      pages[n_pages].user = parsers[n_pages];
+      owners[n_pages] = y;
+      ids[n_pages++] = x;
+    }
+  }
+
+  /* all of the ROM type pages are fetched at once, the results
+     still end up in the same slots as before */
+  if (n_pages > 0) {
+    bacon_net_get_pages (pages, n_pages);
+    for (x = 0; x < n_pages; ++x) {
+      y = owners[x];
+      rom = bacon_rom_parser_finish (parsers[x]);
+      if (pages[x].data && (pages[x].code == 304) && cached[x]) {
+        /* still the same, only the time it was checked changes */
+        bacon_debug ("%s: not modified", pages[x].request);
+        lists[y]->roms[ids[x]] = bacon_rom_list_copy (caches[x].roms,
+                                                      maxes[y]);
+        caches[x].fetched = now;
+        bacon_romcache_store (&caches[x], codenames[y],
+                              bacon_rom_type_format (ids[x]));
+        bacon_rom_free (rom);
+      } else if (pages[x].data) {
+        lists[y]->roms[ids[x]] = rom;
+        if (pages[x].code == 200) {
+          bacon_romcache_clear (&caches[x]);
+          caches[x].fetched = now;
+          caches[x].complete = (bacon_rom_total (rom) < maxes[y])
+                               ? BACON_TRUE : BACON_FALSE;
+          strcpy (caches[x].etag, pages[x].etag);
+          strcpy (caches[x].modified, pages[x].modified);
+          caches[x].roms = rom;
+          bacon_romcache_store (&caches[x], codenames[y],
+                                bacon_rom_type_format (ids[x]));
+          caches[x].roms = NULL; /* owned by the list */
+        }
+      } else {
+        bacon_rom_free (rom);
+        /* an old list beats none at all */
+        if (cached[x]) {
+          bacon_warn ("using the cached %s ROM list of `%s'",
+                      bacon_rom_type_str (ids[x]), codenames[y]);
+          lists[y]->roms[ids[x]] = bacon_rom_list_copy (caches[x].roms,
+                                                        maxes[y]);
+        }
+      }
+      bacon_free (pages[x].data);
+      if (cached[x])
+        bacon_romcache_clear (&caches[x]);
+    }
   }
-  return rom;
+
+  bacon_free (parsers);
+  bacon_free (caches);
+  bacon_free (pages);
+  bacon_free (cached);
+  bacon_free (requests);
+  bacon_free (owners);
+  bacon_free (ids);
+  return lists;
 }
 
 BaconRomList *
 bacon_rom_list_new (const char *codename, int type, int max)
 {
-  int x;
   BaconRomList *list;
+  BaconRomList **lists;
 
-  list = bacon_new (BaconRomList);
-
-  if (type & BACON_ROM_TYPE_ALL) {
-    for (x = 0; x < BACON_ROM_TOTAL; ++x)
-      list->roms[x] = bacon_setup_rom (codename, x, &max);
-    return list;
-  }
-
-  if (type & BACON_ROM_TYPE_NIGHTLY)
-    list->roms[BACON_ROM_NIGHTLY] =
-      bacon_setup_rom (codename, BACON_ROM_NIGHTLY, &max);
-  else
-    list->roms[BACON_ROM_NIGHTLY] = NULL;
-
-  if (type & BACON_ROM_TYPE_RC)
-    list->roms[BACON_ROM_RC] = bacon_setup_rom (codename, BACON_ROM_RC, &max);
-  else
-    list->roms[BACON_ROM_RC] = NULL;
-
-  if (type & BACON_ROM_TYPE_SNAPSHOT)
-    list->roms[BACON_ROM_SNAPSHOT] =
-      bacon_setup_rom (codename, BACON_ROM_SNAPSHOT, &max);
-  else
-    list->roms[BACON_ROM_SNAPSHOT] = NULL;
-
-  if (type & BACON_ROM_TYPE_STABLE)
-    list->roms[BACON_ROM_STABLE] =
-      bacon_setup_rom (codename, BACON_ROM_STABLE, &max);
-  else
-    list->roms[BACON_ROM_STABLE] = NULL;
-
-  if (type & BACON_ROM_TYPE_TEST)
-    list->roms[BACON_ROM_TEST] =
-      bacon_setup_rom (codename, BACON_ROM_TEST, &max);
-  else
-    list->roms[BACON_ROM_TEST] = NULL;
+  lists = bacon_rom_lists_new (&codename, &type, &max, 1);
+  list = lists[0];
+  bacon_free (lists);
   return list;
 }
 
@@ -141,15 +417,12 @@ void
 bacon_rom_list_destroy (BaconRomList *list)
 {
   int x;
-  BaconRom *rom;
 
   if (!list)
     return;
 
-  for (x = 0; x < BACON_ROM_TOTAL; ++x) {
-    rom = list->roms[x];
-    bacon_list_free (rom);
-  }
+  for (x = 0; x < BACON_ROM_TOTAL; ++x)
+    bacon_rom_free (list->roms[x]);
   bacon_free (list);
 }
 
@@ -188,46 +461,225 @@ bacon_rom_total (const BaconRom *rom)
   return total;
 }
 
+/* Sets up `ctx' and `offset' to carry on with whatever an earlier run
+   left at `dlpath'. Returns false if the file is already complete. */
+static BaconBoolean
+bacon_rom_resume_point (const BaconRom *rom,
+                        const char *dlpath,
+                        BaconHashCtx *ctx,
+                        unsigned long *offset)
+{
+  BaconHash hash;
+  BaconHashCtx prefix;
+
+  *offset = 0L;
+  if (!bacon_env_is_file (dlpath))
+    return BACON_TRUE;
+
+  if (bacon_hash_cache_lookup (&hash, ctx->type, dlpath) &&
+      bacon_hash_match (&hash, &rom->hash))
+  {
+    bacon_msg ("`%s' already exists - no need to redownload", dlpath);
+    return BACON_FALSE;
+  }
+  *offset = bacon_env_size_of_file (dlpath);
+  /* pick up the hash where an earlier run left it, and only hash
+     what reached the disk after its last checkpoint */
+  if (!bacon_hash_load_state (ctx, dlpath) ||
+      (bacon_hash_length (ctx) > *offset))
+    bacon_hash_init (ctx, ctx->type);
+  if (bacon_hash_length (ctx) < *offset)
+    bacon_hash_update_from_file (ctx, dlpath, bacon_hash_length (ctx));
+  prefix = *ctx;
+  bacon_hash_final (&prefix, &hash);
+  if (bacon_hash_match (&hash, &rom->hash)) {
+    bacon_msg ("`%s' already exists - no need to redownload", dlpath);
+    bacon_hash_delete_state (dlpath);
+    bacon_hash_cache_store (&hash, dlpath);
+    return BACON_FALSE;
+  }
+  bacon_msg ("resuming download of `%s'", dlpath);
+  return BACON_TRUE;
+}
+
+/* Checks a complete download against the hash the ROM was published
+   with */
+static BaconBoolean
+bacon_rom_check (const BaconRom *rom, const char *dlpath,
+                 const BaconHash *hash)
+{
+  bacon_hash_delete_state (dlpath);
+  if (!bacon_hash_match (hash, &rom->hash)) {
+    bacon_warn ("checksum mismatch for `%s' (possibly corrupt)", dlpath);
+    return BACON_FALSE;
+  }
+  bacon_hash_cache_store (hash, dlpath);
+  return BACON_TRUE;
+}
+
+static BaconHashType
+bacon_rom_hash_type (const BaconRom *rom)
+{
+  /* check with whatever kind of hash the ROM was published with */
+  return (rom->hash.type != BACON_HASH_NONE) ? rom->hash.type
+                                             : BACON_HASH_MD5;
+}
+
 BaconBoolean
 bacon_rom_do_download (const BaconRom *rom, char *dlpath)
 {
+  unsigned long size;
   unsigned long offset;
   BaconBoolean dlres;
+  BaconBoolean segmented;
   BaconHash hash;
+  BaconHashCtx ctx;
 
-  bacon_env_fix_download_path (&dlpath, rom->name);
+  bacon_env_fix_download_path (&dlpath, bacon_rom_name (rom));
   if (!bacon_env_ensure_path (dlpath, BACON_TRUE)) {
     bacon_error ("`%s' is an invalid path", dlpath);
     return BACON_FALSE;
   }
 
   offset = 0L;
-  if (bacon_env_is_file (dlpath)) {
-    bacon_hash_from_file (&hash, dlpath);
-    if (bacon_hash_match (&hash, &rom->hash)) {
-      bacon_msg ("`%s' already exists - no need to redownload", dlpath);
-      return BACON_TRUE;
+  segmented = BACON_FALSE;
+  bacon_hash_init (&ctx, bacon_rom_hash_type (rom));
+#ifdef HAVE_PWRITE
+  /* a file with pending segments is preallocated to its full size,
+     so neither its hash nor its size mean anything yet */
+  segmented = bacon_net_has_segments (dlpath);
+  if (segmented)
+    bacon_msg ("resuming segmented download of `%s'", dlpath);
+#endif
+  if (!segmented && !bacon_rom_resume_point (rom, dlpath, &ctx, &offset))
+    return BACON_TRUE;
+
+  size = 0L;
+#ifdef HAVE_PWRITE
+  if (segmented || (g_segments > 1)) {
+    size = bacon_net_range_size (bacon_rom_get (rom));
+    if (!size) {
+      bacon_warn ("segmented download not possible for `%s' - "
+                  "using a single connection", bacon_rom_name (rom));
+      if (segmented) {
+        bacon_net_forget_segments (dlpath);
+        offset = 0L;
+      }
     }
-    bacon_msg ("resuming download of `%s'", dlpath);
-    offset = bacon_env_size_of_file (dlpath);
   }
+#endif
 
-  dlres = BACON_TRUE;
-  if (bacon_net_init_for_rom (rom->get, offset, dlpath)) {
-    if (!bacon_net_get_file ())
-      dlres = BACON_FALSE;
+  dlres = BACON_FALSE;
+#ifdef HAVE_PWRITE
+  if (size > 0) {
+    /* ranges arrive out of order, so they are hashed once complete */
+    dlres = bacon_net_get_file_segmented (bacon_rom_get (rom), dlpath, size,
+                                          offset, g_segments);
+    if (dlres)
+      bacon_hash_from_file (&hash, ctx.type, dlpath);
+  }
+#endif
+  if (!size &&
+      bacon_net_init_for_rom (bacon_rom_get (rom), offset, dlpath, &ctx))
+  {
+    dlres = bacon_net_get_file ();
     bacon_net_deinit ();
-  } else
-    dlres = BACON_FALSE;
-
-  if (dlres) {
-    bacon_hash_from_file (&hash, dlpath);
-    if (!bacon_hash_match (&hash, &rom->hash)) {
-      bacon_warn ("checksum mismatch for `%s' (possibly corrupt)", dlpath);
-      return BACON_FALSE;
-    }
-    return BACON_TRUE;
+    if (dlres)
+      bacon_hash_final (&ctx, &hash);
+    else
+      bacon_hash_save_state (&ctx, dlpath);
   }
+
+  if (dlres)
+    return bacon_rom_check (rom, dlpath, &hash);
   return BACON_FALSE;
 }
 
+/* Downloads `n' ROMs at once, `dlpaths' are taken the same way as by
+   bacon_rom_do_download (). Every ROM is attempted even if some of
+   them fail; returns false if any did. */
+BaconBoolean
+bacon_rom_do_downloads (const BaconRom *const *roms,
+                        const char *const *dlpaths,
+                        int n)
+{
+  int x;
+  int y;
+  int m;
+  int *which;
+  char **paths;
+  BaconBoolean ret;
+  BaconHash hash;
+  BaconHashCtx *ctxs;
+  BaconNetFile *files;
+
+  ret = BACON_TRUE;
+  which = bacon_newa (int, sizeof (int) * n);
+  paths = bacon_newa (char *, sizeof (char *) * n);
+  ctxs = bacon_newa (BaconHashCtx, sizeof (BaconHashCtx) * n);
+  files = bacon_newa (BaconNetFile, sizeof (BaconNetFile) * n);
+
+  m = 0;
+  for (x = 0; x < n; ++x) {
+    paths[x] = (dlpaths[x]) ? bacon_strdup (dlpaths[x]) : NULL;
+    bacon_env_fix_download_path (&paths[x], bacon_rom_name (roms[x]));
+    if (!bacon_env_ensure_path (paths[x], BACON_TRUE)) {
+      bacon_error ("`%s' is an invalid path", paths[x]);
+      ret = BACON_FALSE;
+      continue;
+    }
+
+    /* two transfers into the same file would only spoil each other */
+    for (y = 0; y < m; ++y)
+      if (bacon_streq (paths[which[y]], paths[x]))
+        break;
+    if (y < m) {
+      bacon_warn ("skipping `%s' - `%s' is already being downloaded",
+                  bacon_rom_name (roms[x]), paths[x]);
+      continue;
+    }
+
+#ifdef HAVE_PWRITE
+    /* leftovers of a segmented download are finished the way they
+       were started */
+    if (bacon_net_has_segments (paths[x])) {
+      if (!bacon_rom_do_download (roms[x], paths[x]))
+        ret = BACON_FALSE;
+      continue;
+    }
+#endif
+
+    bacon_hash_init (&ctxs[x], bacon_rom_hash_type (roms[x]));
+    files[m].offset = 0L;
+    if (!bacon_rom_resume_point (roms[x], paths[x],
+                                 &ctxs[x], &files[m].offset))
+      continue;
+    files[m].request = bacon_rom_get (roms[x]);
+    files[m].filename = paths[x];
+    files[m].hash = &ctxs[x];
+    which[m++] = x;
+  }
+
+  if (m > 0)
+    bacon_net_get_files (files, m);
+
+  for (y = 0; y < m; ++y) {
+    x = which[y];
+    if (files[y].ok) {
+      bacon_hash_final (&ctxs[x], &hash);
+      if (!bacon_rom_check (roms[x], paths[x], &hash))
+        ret = BACON_FALSE;
+    } else {
+      bacon_hash_save_state (&ctxs[x], paths[x]);
+      ret = BACON_FALSE;
+    }
+  }
+
+  for (x = 0; x < n; ++x)
+    bacon_free (paths[x]);
+  bacon_free (files);
+  bacon_free (ctxs);
+  bacon_free (paths);
+  bacon_free (which);
+  return ret;
+}
@@ -28,10 +28,7 @@
 extern "C" {
 #endif
 
-#define BACON_ROM_NAME_MAX      128
-#define BACON_ROM_GET_MAX       8
-#define BACON_ROM_SIZE_MAX      12
-#define BACON_ROM_DATE_MAX      24
+#define BACON_ROM_FIELD_MAX     4096
 #define BACON_ROM_TYPE_NONE     0
 #define BACON_ROM_TYPE_ALL      0x0200
 #define BACON_ROM_TYPE_NIGHTLY  0x0800
@@ -49,25 +46,66 @@ extern "C" {
 typedef struct BaconRom     BaconRom;
 typedef struct BaconRomList BaconRomList;
 
+/* The text of every ROM of a list, one '\0' terminated field after
+   another. Offset 0 always holds an empty string. */
+typedef struct {
+  char *data;
+  size_t n;
+  size_t size;
+} BaconRomPool;
+
+/* A field of a ROM: `length' bytes at `offset' in the pool of its list */
+typedef struct {
+  unsigned int offset;
+  unsigned int length;
+} BaconRomView;
+
 struct BaconRom {
-  char name[BACON_ROM_NAME_MAX];
-  char get[BACON_ROM_GET_MAX];
-  char size[BACON_ROM_SIZE_MAX];
-  char date[BACON_ROM_DATE_MAX];
+  BaconRomView name;
+  BaconRomView get;
+  BaconRomView size;
+  BaconRomView date;
   BaconHash hash;
+  BaconRomPool *pool;
   BaconRom *next;
   BaconRom *prev;
 };
 
+#define bacon_rom_str(rom, view) ((rom)->pool->data + (view).offset)
+#define bacon_rom_name(rom)      bacon_rom_str (rom, (rom)->name)
+#define bacon_rom_get(rom)       bacon_rom_str (rom, (rom)->get)
+#define bacon_rom_size(rom)      bacon_rom_str (rom, (rom)->size)
+#define bacon_rom_date(rom)      bacon_rom_str (rom, (rom)->date)
+
 struct BaconRomList {
   BaconRom *roms[BACON_ROM_TOTAL];
 };
 
 BaconRomList *bacon_rom_list_new (const char *codename, int type, int max);
+BaconRomList **bacon_rom_lists_new (const char *const *codenames,
+                                    const int *types,
+                                    const int *maxes,
+                                    int n);
 void bacon_rom_list_destroy (BaconRomList *rom_list);
+BaconRomPool *bacon_rom_pool_new (void);
+void bacon_rom_pool_start (BaconRomPool *pool, BaconRomView *view);
+void bacon_rom_pool_append (BaconRomPool *pool,
+                            BaconRomView *view,
+                            const char *s,
+                            size_t n);
+void bacon_rom_pool_add (BaconRomPool *pool,
+                         BaconRomView *view,
+                         const char *s,
+                         size_t n);
+void bacon_rom_pool_trim (BaconRomPool *pool);
+BaconRom *bacon_rom_new (BaconRom **root, BaconRom **tail, BaconRomPool *pool);
+void bacon_rom_free (BaconRom *rom);
 const char *bacon_rom_type_str (int index_type);
 int bacon_rom_total (const BaconRom *rom);
 BaconBoolean bacon_rom_do_download (const BaconRom *rom, char *dlpath);
+BaconBoolean bacon_rom_do_downloads (const BaconRom *const *roms,
+                                     const char *const *dlpaths,
+                                     int n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,273 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every (device, type) ROM list page that was fetched is kept as a small
+ * text file under the program data path:
+ *
+ *   VERSION FETCHED COMPLETE
+ *   ETAG
+ *   LAST-MODIFIED
+ *   NAME<tab>GET<tab>SIZE<tab>DATE<tab>HASH-TYPE<tab>HASH   (one per ROM)
+ *
+ * FETCHED is when the server last confirmed the list (seconds since the
+ * epoch). Either validator line may be empty.
+ */
+
+#include "bacon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bacon-ctype.h"
+#include "bacon-env.h"
+#include "bacon-hash.h"
+#include "bacon-out.h"
+#include "bacon-romcache.h"
+#include "bacon-str.h"
+#include "bacon-util.h"
+
+#define BACON_ROMCACHE_VERSION  1
+#define BACON_ROMCACHE_LINE_MAX (BACON_ROM_FIELD_MAX * 4 + 128)
+#define BACON_ROMCACHE_FIELDS   6
+#define BACON_ROMCACHE_ALL      "all"
+
+extern char *g_program_data_path;
+
+static char *
+bacon_romcache_path (const char *codename, const char *type)
+{
+  size_t x;
+  char *path;
+  char *name;
+
+  /* codenames come off the network, keep them out of other directories */
+  name = bacon_strdup (codename);
+  for (x = 0; name[x]; ++x)
+    if (!bacon_isalpha (name[x]) && !bacon_isdigit (name[x]) &&
+        (name[x] != '-') && (name[x] != '_'))
+      name[x] = '_';
+
+  path = bacon_strf ("%s%c%s%c%s.%s", g_program_data_path, BACON_PATH_SEP,
+                     BACON_ROMCACHE_DIRNAME, BACON_PATH_SEP, name,
+                     (type && *type) ? type : BACON_ROMCACHE_ALL);
+  bacon_free (name);
+  return path;
+}
+
+static BaconBoolean
+bacon_romcache_read_line (FILE *fp, char *line)
+{
+  size_t n;
+
+  if (!fgets (line, BACON_ROMCACHE_LINE_MAX, fp))
+    return BACON_FALSE;
+  n = strlen (line);
+  if (!n || (line[n - 1] != '\n'))
+    return BACON_FALSE; /* cut short or too long */
+  line[--n] = '\0';
+  return BACON_TRUE;
+}
+
+static BaconBoolean
+bacon_romcache_copy_field (char *dest, size_t size, const char *src)
+{
+  size_t n;
+
+  n = strlen (src);
+  if (n >= size)
+    return BACON_FALSE;
+  memcpy (dest, src, n + 1);
+  return BACON_TRUE;
+}
+
+static BaconBoolean
+bacon_romcache_parse_rom (BaconRom *rom, char *line)
+{
+  int x;
+  char *p;
+  char *fields[BACON_ROMCACHE_FIELDS];
+  BaconHashType type;
+
+  p = line;
+  for (x = 0; x < BACON_ROMCACHE_FIELDS; ++x) {
+    fields[x] = p;
+    p = strchr (p, '\t');
+    if (x == (BACON_ROMCACHE_FIELDS - 1))
+      break;
+    if (!p)
+      return BACON_FALSE;
+    *p++ = '\0';
+  }
+  if (p)
+    return BACON_FALSE;
+
+  for (x = 0; x < 4; ++x)
+    if (strlen (fields[x]) > BACON_ROM_FIELD_MAX)
+      return BACON_FALSE;
+  bacon_rom_pool_add (rom->pool, &rom->name, fields[0], strlen (fields[0]));
+  bacon_rom_pool_add (rom->pool, &rom->get, fields[1], strlen (fields[1]));
+  bacon_rom_pool_add (rom->pool, &rom->size, fields[2], strlen (fields[2]));
+  bacon_rom_pool_add (rom->pool, &rom->date, fields[3], strlen (fields[3]));
+
+  type = bacon_hash_type_from_name (fields[4]);
+  if ((type != BACON_HASH_NONE) &&
+      !bacon_hash_from_hex (&rom->hash, type, fields[5]))
+    return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+/* Fills `cache' from disk, returns false if there is nothing usable */
+BaconBoolean
+bacon_romcache_load (BaconRomCache *cache,
+                     const char *codename,
+                     const char *type)
+{
+  int version;
+  int complete;
+  char *path;
+  char line[BACON_ROMCACHE_LINE_MAX];
+  FILE *fp;
+  BaconRom *p;
+  BaconRom *tail;
+  BaconRomPool *pool;
+
+  memset (cache, 0, sizeof (BaconRomCache));
+  if (!g_program_data_path)
+    return BACON_FALSE;
+
+  path = bacon_romcache_path (codename, type);
+  fp = fopen (path, "r");
+  bacon_free (path);
+  if (!fp)
+    return BACON_FALSE;
+
+  if (!bacon_romcache_read_line (fp, line) ||
+      (sscanf (line, "%i %ld %i", &version, &cache->fetched, &complete) != 3) ||
+      (version != BACON_ROMCACHE_VERSION) ||
+      !bacon_romcache_read_line (fp, line) ||
+      !bacon_romcache_copy_field (cache->etag, BACON_NET_VALIDATOR_MAX, line) ||
+      !bacon_romcache_read_line (fp, line) ||
+      !bacon_romcache_copy_field (cache->modified, BACON_NET_VALIDATOR_MAX,
+                                  line))
+  {
+    bacon_env_fclose (fp);
+    return BACON_FALSE;
+  }
+  cache->complete = (complete) ? BACON_TRUE : BACON_FALSE;
+
+  tail = NULL;
+  pool = NULL;
+  while (bacon_romcache_read_line (fp, line)) {
+    /* the first ROM takes ownership of the pool */
+    if (!pool)
+      pool = bacon_rom_pool_new ();
+    p = bacon_rom_new (&cache->roms, &tail, pool);
+    if (!bacon_romcache_parse_rom (p, line)) {
+      bacon_env_fclose (fp);
+      bacon_romcache_clear (cache);
+      return BACON_FALSE;
+    }
+  }
+
+  if (!feof (fp)) {
+    bacon_env_fclose (fp);
+    bacon_romcache_clear (cache);
+    return BACON_FALSE;
+  }
+  bacon_env_fclose (fp);
+  if (pool)
+    bacon_rom_pool_trim (pool);
+  return BACON_TRUE;
+}
+
+void
+bacon_romcache_store (const BaconRomCache *cache,
+                      const char *codename,
+                      const char *type)
+{
+  char hex[BACON_HASH_HEX_SIZE];
+  char *dir;
+  char *tmp;
+  char *path;
+  FILE *fp;
+  BaconBoolean ok;
+  const BaconRom *p;
+
+  if (!g_program_data_path)
+    return;
+
+  dir = bacon_strf ("%s%c%s", g_program_data_path, BACON_PATH_SEP,
+                    BACON_ROMCACHE_DIRNAME);
+  if (!bacon_env_is_directory (dir) && !bacon_env_mkpath (dir)) {
+    bacon_debug ("failed to create `%s'", dir);
+    bacon_free (dir);
+    return;
+  }
+  bacon_free (dir);
+
+  path = bacon_romcache_path (codename, type);
+  tmp = bacon_strf ("%s.tmp", path);
+  fp = fopen (tmp, "w");
+  if (!fp) {
+    bacon_debug ("failed to save `%s' (%s)", tmp, strerror (errno));
+    bacon_free (tmp);
+    bacon_free (path);
+    return;
+  }
+
+  bacon_foutln (fp, "%i %ld %i", BACON_ROMCACHE_VERSION, cache->fetched,
+                (cache->complete) ? 1 : 0);
+  bacon_foutln (fp, "%s", cache->etag);
+  bacon_foutln (fp, "%s", cache->modified);
+  for (p = cache->roms; p; p = p->next) {
+    bacon_hash_to_hex (&p->hash, hex);
+    bacon_foutln (fp, "%s\t%s\t%s\t%s\t%s\t%s", bacon_rom_name (p),
+                  bacon_rom_get (p), bacon_rom_size (p), bacon_rom_date (p),
+                  bacon_hash_name (p->hash.type), hex);
+    if (!p->next)
+      break;
+  }
+  ok = (!ferror (fp)) ? BACON_TRUE : BACON_FALSE;
+  if (fclose (fp) != 0)
+    ok = BACON_FALSE;
+#ifndef BACON_OS_UNIX
+  if (ok)
+    remove (path);
+#endif
+
+  /* readers never see a half written entry, or a truncated one */
+  if (ok && (rename (tmp, path) != 0))
+    ok = BACON_FALSE;
+  if (!ok) {
+    bacon_debug ("failed to save `%s' (%s)", path, strerror (errno));
+    remove (tmp);
+  }
+  bacon_free (tmp);
+  bacon_free (path);
+}
+
+void
+bacon_romcache_clear (BaconRomCache *cache)
+{
+  bacon_rom_free (cache->roms);
+  cache->roms = NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BACON_ROMCACHE_H
+#define BACON_ROMCACHE_H
+
+#include "bacon.h"
+#include "bacon-net.h"
+#include "bacon-rom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BACON_ROMCACHE_DIRNAME "roms"
+
+/* The parsed ROM list of one (device, type) page. `complete' is true if
+   the whole page was read, otherwise `roms' only holds its first few. */
+typedef struct {
+  long fetched;
+  BaconBoolean complete;
+  char etag[BACON_NET_VALIDATOR_MAX];
+  char modified[BACON_NET_VALIDATOR_MAX];
+  BaconRom *roms;
+} BaconRomCache;
+
+BaconBoolean bacon_romcache_load (BaconRomCache *cache,
+                                  const char *codename,
+                                  const char *type);
+void bacon_romcache_store (const BaconRomCache *cache,
+                           const char *codename,
+                           const char *type);
+void bacon_romcache_clear (BaconRomCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BACON_ROMCACHE_H */
@@ -28,6 +28,9 @@
 #include "bacon-str.h"
 #include "bacon-util.h"
 
+#define BACON_SEARCH_RADIX_BITS 12
+#define BACON_SEARCH_RADIX_SIZE (1 << BACON_SEARCH_RADIX_BITS)
+
 BaconSearchTokenList *
 bacon_search_token_list_new (const char *query)
 {
@@ -126,3 +129,360 @@ bacon_search (const char *content, BaconSearchTokenList *list)
   return BACON_SEARCH_RESULT_NO_MATCHES;
 }
 
+static unsigned int
+bacon_search_trigram_key (const char *s)
+{
+  char a;
+  char b;
+  char c;
+
+  a = bacon_tolower (s[0]);
+  b = bacon_tolower (s[1]);
+  c = bacon_tolower (s[2]);
+  return ((((unsigned int) ((unsigned char) a)) << 16) |
+          (((unsigned int) ((unsigned char) b)) << 8) |
+          ((unsigned int) ((unsigned char) c)));
+}
+
+/* Stable LSD radix sort of the 24-bit `keys', carrying `docs' along.
+   Pairs are generated in document order, so each key's documents come
+   out ascending. */
+static void
+bacon_search_sort_pairs (unsigned int *keys, unsigned int *docs, size_t n)
+{
+  size_t x;
+  size_t sum;
+  size_t t;
+  unsigned int shift;
+  unsigned int bucket;
+  unsigned int *tmp_keys;
+  unsigned int *tmp_docs;
+  size_t counts[BACON_SEARCH_RADIX_SIZE];
+
+  tmp_keys = bacon_newa (unsigned int, (n + 1) * sizeof (unsigned int));
+  tmp_docs = bacon_newa (unsigned int, (n + 1) * sizeof (unsigned int));
+
+  for (shift = 0; shift < 24; shift += BACON_SEARCH_RADIX_BITS) {
+    memset (counts, 0, sizeof (counts));
+    for (x = 0; x < n; ++x)
+      counts[(keys[x] >> shift) & (BACON_SEARCH_RADIX_SIZE - 1)]++;
+    sum = 0;
+    for (x = 0; x < BACON_SEARCH_RADIX_SIZE; ++x) {
+      t = counts[x];
+      counts[x] = sum;
+      sum += t;
+    }
+    for (x = 0; x < n; ++x) {
+      bucket = (keys[x] >> shift) & (BACON_SEARCH_RADIX_SIZE - 1);
+      tmp_keys[counts[bucket]] = keys[x];
+      tmp_docs[counts[bucket]++] = docs[x];
+    }
+    memcpy (keys, tmp_keys, n * sizeof (unsigned int));
+    memcpy (docs, tmp_docs, n * sizeof (unsigned int));
+  }
+  bacon_free (tmp_keys);
+  bacon_free (tmp_docs);
+}
+
+BaconSearchIndex *
+bacon_search_index_new (const char **documents, size_t n_documents)
+{
+  size_t d;
+  size_t x;
+  size_t n;
+  size_t len;
+  size_t n_pairs;
+  size_t n_trigrams;
+  unsigned int *keys;
+  unsigned int *docs;
+  BaconSearchTrigram *trigrams;
+  BaconSearchIndex *index;
+
+  n_pairs = 0;
+  for (d = 0; d < n_documents; ++d) {
+    len = strlen (documents[d]);
+    if (len > 2)
+      n_pairs += len - 2;
+  }
+
+  keys = bacon_newa (unsigned int, (n_pairs + 1) * sizeof (unsigned int));
+  docs = bacon_newa (unsigned int, (n_pairs + 1) * sizeof (unsigned int));
+  n = 0;
+  for (d = 0; d < n_documents; ++d) {
+    for (x = 0; documents[d][x] && documents[d][x + 1] &&
+                documents[d][x + 2]; ++x) {
+      keys[n] = bacon_search_trigram_key (documents[d] + x);
+      docs[n++] = (unsigned int) d;
+    }
+  }
+  bacon_search_sort_pairs (keys, docs, n_pairs);
+
+  n_trigrams = 0;
+  for (x = 0; x < n_pairs; ++x)
+    if (!x || (keys[x] != keys[x - 1]))
+      n_trigrams++;
+  trigrams = bacon_newa (BaconSearchTrigram,
+                         (n_trigrams + 1) * sizeof (BaconSearchTrigram));
+
+  /* postings are compacted into `docs' in place, dropping a document
+     that contains the same trigram more than once */
+  n = 0;
+  n_trigrams = 0;
+  for (x = 0; x < n_pairs; ++x) {
+    if (!x || (keys[x] != keys[x - 1])) {
+      trigrams[n_trigrams].key = keys[x];
+      trigrams[n_trigrams].offset = (unsigned int) n;
+      trigrams[n_trigrams++].count = 0;
+    } else if (docs[x] == docs[n - 1])
+      continue;
+    docs[n++] = docs[x];
+    trigrams[n_trigrams - 1].count++;
+  }
+  bacon_free (keys);
+
+  bacon_debug ("indexed %lu trigrams (%lu postings) over %lu documents",
+               (unsigned long) n_trigrams,
+               (unsigned long) n,
+               (unsigned long) n_documents);
+  index = bacon_search_index_view (documents, n_documents,
+                                   trigrams, n_trigrams, docs, n);
+  index->owned = BACON_TRUE;
+  return index;
+}
+
+BaconSearchIndex *
+bacon_search_index_view (const char **documents,
+                         size_t n_documents,
+                         const BaconSearchTrigram *trigrams,
+                         size_t n_trigrams,
+                         const unsigned int *postings,
+                         size_t n_postings)
+{
+  BaconSearchIndex *index;
+
+  index = bacon_new (BaconSearchIndex);
+  index->documents = documents;
+  index->n_documents = n_documents;
+  index->trigrams = trigrams;
+  index->n_trigrams = n_trigrams;
+  index->postings = postings;
+  index->n_postings = n_postings;
+  index->owned = BACON_FALSE;
+  return index;
+}
+
+void
+bacon_search_index_destroy (BaconSearchIndex *index)
+{
+  if (!index)
+    return;
+  /* the members are const, so they are cast and handed to free ()
+     directly; bacon_free () would need an lvalue to clear and the
+     index itself is gone right after anyway */
+  if (index->owned) {
+    free ((void *) index->trigrams);
+    free ((void *) index->postings);
+  }
+  bacon_free (index);
+}
+
+static const BaconSearchTrigram *
+bacon_search_index_lookup (const BaconSearchIndex *index, unsigned int key)
+{
+  size_t lo;
+  size_t hi;
+  size_t mid;
+
+  lo = 0;
+  hi = index->n_trigrams;
+  while (lo < hi) {
+    mid = lo + ((hi - lo) / 2);
+    if (index->trigrams[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ((lo < index->n_trigrams) && (index->trigrams[lo].key == key) &&
+      (index->trigrams[lo].offset <= index->n_postings) &&
+      (index->trigrams[lo].count <=
+       (index->n_postings - index->trigrams[lo].offset)))
+    return &index->trigrams[lo];
+  return NULL;
+}
+
+/* Keeps the candidates that also appear in `t'; both are ascending. */
+static size_t
+bacon_search_intersect (unsigned int *candidates,
+                        size_t n,
+                        const BaconSearchIndex *index,
+                        const BaconSearchTrigram *t)
+{
+  size_t x;
+  size_t y;
+  size_t kept;
+  const unsigned int *postings;
+
+  postings = index->postings + t->offset;
+  kept = 0;
+  for (x = 0, y = 0; (x < n) && (y < t->count);) {
+    if (candidates[x] < postings[y])
+      ++x;
+    else if (candidates[x] > postings[y])
+      ++y;
+    else {
+      candidates[kept++] = candidates[x++];
+      ++y;
+    }
+  }
+  return kept;
+}
+
+/* Returns the ascending numbers of the documents that contain every
+   token, ignoring case, like bacon_search() returning
+   BACON_SEARCH_RESULT_ALL_MATCHES. Tokens shorter than three characters
+   cannot narrow the candidates and are only checked on the survivors. */
+unsigned int *
+bacon_search_index_query (const BaconSearchIndex *index,
+                          BaconSearchTokenList *list,
+                          size_t *n_matches)
+{
+  size_t x;
+  size_t n;
+  size_t kept;
+  BaconBoolean matched;
+  unsigned int *candidates;
+  const BaconSearchTrigram *t;
+  const BaconSearchTrigram *shortest;
+  BaconSearchTokenList *p;
+
+  *n_matches = 0;
+  shortest = NULL;
+  for (p = list; p; p = p->next) {
+    for (x = 0; p->token[x] && p->token[x + 1] && p->token[x + 2]; ++x) {
+      t = bacon_search_index_lookup (index,
+                                     bacon_search_trigram_key (p->token + x));
+      if (!t)
+        return NULL;
+      if (!shortest || (t->count < shortest->count))
+        shortest = t;
+    }
+    if (!p->next)
+      break;
+  }
+
+  if (shortest) {
+    n = shortest->count;
+    candidates = bacon_newa (unsigned int, (n + 1) * sizeof (unsigned int));
+    memcpy (candidates, index->postings + shortest->offset,
+            n * sizeof (unsigned int));
+    for (p = list; p && n; p = p->next) {
+      for (x = 0; n && p->token[x] && p->token[x + 1] && p->token[x + 2];
+           ++x) {
+        t = bacon_search_index_lookup (index,
+                                       bacon_search_trigram_key (p->token + x));
+        if (t != shortest)
+          n = bacon_search_intersect (candidates, n, index, t);
+      }
+      if (!p->next)
+        break;
+    }
+  } else {
+    n = index->n_documents;
+    candidates = bacon_newa (unsigned int, (n + 1) * sizeof (unsigned int));
+    for (x = 0; x < n; ++x)
+      candidates[x] = (unsigned int) x;
+  }
+
+  kept = 0;
+  for (x = 0; x < n; ++x) {
+    if (candidates[x] >= index->n_documents)
+      continue;
+    matched = BACON_TRUE;
+    for (p = list; p && matched; p = p->next) {
+      if (!bacon_strstrlower (index->documents[candidates[x]], p->token))
+        matched = BACON_FALSE;
+      if (!p->next)
+        break;
+    }
+    if (matched)
+      candidates[kept++] = candidates[x];
+  }
+  *n_matches = kept;
+  return candidates;
+}
+
+/* Typos allowed in a token: none up to three characters ("s4" has to be
+   exact), one up to seven and two beyond that. */
+void
+bacon_search_pattern_init (BaconSearchPattern *pattern, const char *token)
+{
+  int c;
+  char lower;
+  size_t x;
+  unsigned long long peq[256];
+
+  pattern->length = strlen (token);
+  if (pattern->length > BACON_SEARCH_PATTERN_MAX)
+    pattern->length = BACON_SEARCH_PATTERN_MAX;
+  if (pattern->length < 4)
+    pattern->max_distance = 0;
+  else if (pattern->length < 8)
+    pattern->max_distance = 1;
+  else
+    pattern->max_distance = 2;
+
+  memset (peq, 0, sizeof (peq));
+  for (x = 0; x < pattern->length; ++x)
+    peq[(unsigned char) token[x]] |= 1ULL << x;
+  for (c = 0; c < 256; ++c) {
+    lower = bacon_tolower ((char) c);
+    pattern->peq[c] = peq[(unsigned char) lower];
+  }
+}
+
+/* Myers' bit-parallel algorithm: the smallest number of edits that turns
+   `pattern' into some substring of `text', found in one pass over `text'
+   with the whole column of the DP matrix held in a machine word. The
+   pass stops early on an exact occurrence. */
+int
+bacon_search_distance (const BaconSearchPattern *pattern, const char *text)
+{
+  int best;
+  int score;
+  unsigned long long eq;
+  unsigned long long pv;
+  unsigned long long mv;
+  unsigned long long ph;
+  unsigned long long mh;
+  unsigned long long xv;
+  unsigned long long xh;
+  unsigned long long last;
+
+  if (!pattern->length)
+    return 0;
+
+  last = 1ULL << (pattern->length - 1);
+  pv = ~0ULL;
+  mv = 0;
+  score = (int) pattern->length;
+  best = score;
+
+  for (; *text && best; ++text) {
+    eq = pattern->peq[(unsigned char) *text];
+    xv = eq | mv;
+    xh = (((eq & pv) + pv) ^ pv) | eq;
+    ph = mv | ~(xh | pv);
+    mh = pv & xh;
+    if (ph & last)
+      ++score;
+    else if (mh & last)
+      --score;
+    ph <<= 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+    if (score < best)
+      best = score;
+  }
+  return best;
+}
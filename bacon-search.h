@@ -27,9 +27,13 @@
 extern "C" {
 #endif
 
-#define BACON_SEARCH_TOKEN_MAX 256
+#define BACON_SEARCH_TOKEN_MAX   256
+#define BACON_SEARCH_PATTERN_MAX 64
 
 typedef struct BaconSearchTokenList BaconSearchTokenList;
+typedef struct BaconSearchTrigram   BaconSearchTrigram;
+typedef struct BaconSearchIndex     BaconSearchIndex;
+typedef struct BaconSearchPattern   BaconSearchPattern;
 
 struct BaconSearchTokenList {
   char token[BACON_SEARCH_TOKEN_MAX];
@@ -37,6 +41,35 @@ struct BaconSearchTokenList {
   BaconSearchTokenList *prev;
 };
 
+/* `key' packs three lowercased bytes; its documents are
+   postings[offset] ... postings[offset + count - 1], in ascending order. */
+struct BaconSearchTrigram {
+  unsigned int key;
+  unsigned int offset;
+  unsigned int count;
+};
+
+/* A trigram index over `documents', sorted by key. When `owned' is false
+   the tables belong to someone else (e.g. a mapped file). */
+struct BaconSearchIndex {
+  const char **documents;
+  size_t n_documents;
+  const BaconSearchTrigram *trigrams;
+  size_t n_trigrams;
+  const unsigned int *postings;
+  size_t n_postings;
+  BaconBoolean owned;
+};
+
+/* A token prepared for bacon_search_distance(): `peq' holds, for every
+   byte, the bit mask of the pattern positions it matches (ignoring case).
+   Only the first BACON_SEARCH_PATTERN_MAX bytes of a token are used. */
+struct BaconSearchPattern {
+  unsigned long long peq[256];
+  size_t length;
+  int max_distance;
+};
+
 typedef enum {
   BACON_SEARCH_RESULT_NO_MATCHES = -1,
   BACON_SEARCH_RESULT_PARTIAL_MATCHES,
@@ -48,6 +81,22 @@ void bacon_search_token_list_free (BaconSearchTokenList *list);
 size_t bacon_search_token_list_total (BaconSearchTokenList *list);
 BaconSearchResult bacon_search (const char *content,
                                 BaconSearchTokenList *list);
+BaconSearchIndex *bacon_search_index_new (const char **documents,
+                                          size_t n_documents);
+BaconSearchIndex *bacon_search_index_view (const char **documents,
+                                           size_t n_documents,
+                                           const BaconSearchTrigram *trigrams,
+                                           size_t n_trigrams,
+                                           const unsigned int *postings,
+                                           size_t n_postings);
+void bacon_search_index_destroy (BaconSearchIndex *index);
+void bacon_search_pattern_init (BaconSearchPattern *pattern,
+                                const char *token);
+int bacon_search_distance (const BaconSearchPattern *pattern,
+                           const char *text);
+unsigned int *bacon_search_index_query (const BaconSearchIndex *index,
+                                        BaconSearchTokenList *list,
+                                        size_t *n_matches);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,319 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The SHA-1 and SHA-256 block functions below follow FIPS 180-4. The SHA-NI
+ * variant uses the x86 SHA extensions, which do two rounds per instruction.
+ */
+
+#include "bacon.h"
+
+#ifdef HAVE_SHA_NI
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+#include "bacon-sha.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)  (((x) & (y)) ^ ((~(x)) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define PAR(x, y, z) ((x) ^ (y) ^ (z))
+
+#define BSIG0(x) (ROTR ((x), 2) ^ ROTR ((x), 13) ^ ROTR ((x), 22))
+#define BSIG1(x) (ROTR ((x), 6) ^ ROTR ((x), 11) ^ ROTR ((x), 25))
+#define SSIG0(x) (ROTR ((x), 7) ^ ROTR ((x), 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR ((x), 17) ^ ROTR ((x), 19) ^ ((x) >> 10))
+
+#define BACON_SHA_LOAD32(p)                \
+  ((((unsigned int) (p)[0]) << 24) |       \
+   (((unsigned int) (p)[1]) << 16) |       \
+   (((unsigned int) (p)[2]) << 8) |        \
+   ((unsigned int) (p)[3]))
+
+/* SHA-1's message schedule is expanded in place in a 16 word window, as
+   a separate loop over all 80 words gets vectorized into something slower */
+#define BACON_SHA1_W(i)                                                   \
+  (((i) < 16) ? w[i] :                                                    \
+   (w[(i) & 15] = ROTL (w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^          \
+                        w[((i) + 2) & 15] ^ w[(i) & 15], 1)))
+
+/* The rounds rename the working variables instead of moving them around,
+   so five SHA-1 rounds (or eight SHA-256 ones) make up a full rotation */
+#define BACON_SHA1_ROUND(a, b, c, d, e, f, k, i)                          \
+  do {                                                                    \
+    (e) += ROTL ((a), 5) + f ((b), (c), (d)) + (k) + BACON_SHA1_W (i);    \
+    (b) = ROTL ((b), 30);                                                 \
+  } while (BACON_FALSE)
+
+#define BACON_SHA1_ROUNDS(f, k)                                           \
+  do {                                                                    \
+    BACON_SHA1_ROUND (a, b, c, d, e, f, k, x);                            \
+    BACON_SHA1_ROUND (e, a, b, c, d, f, k, x + 1);                        \
+    BACON_SHA1_ROUND (d, e, a, b, c, f, k, x + 2);                        \
+    BACON_SHA1_ROUND (c, d, e, a, b, f, k, x + 3);                        \
+    BACON_SHA1_ROUND (b, c, d, e, a, f, k, x + 4);                        \
+  } while (BACON_FALSE)
+
+#define BACON_SHA256_ROUND(a, b, c, d, e, f, g, h, i)                     \
+  do {                                                                    \
+    t1 = (h) + BSIG1 (e) + CH ((e), (f), (g)) + s_sha256_k[i] + w[i];     \
+    (d) += t1;                                                            \
+    (h) = t1 + BSIG0 (a) + MAJ ((a), (b), (c));                           \
+  } while (BACON_FALSE)
+
+static const unsigned int s_sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+void
+bacon_sha1_transform (unsigned int *state,
+                      const unsigned char *blocks,
+                      size_t n_blocks)
+{
+  int x;
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int d;
+  unsigned int e;
+  unsigned int w[16];
+
+  for (; n_blocks; n_blocks--, blocks += 64) {
+    for (x = 0; x < 16; ++x)
+      w[x] = BACON_SHA_LOAD32 (blocks + x * 4);
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    /* one loop per round function keeps the branches out of the rounds */
+    for (x = 0; x < 20; x += 5)
+      BACON_SHA1_ROUNDS (CH, 0x5a827999);
+    for (; x < 40; x += 5)
+      BACON_SHA1_ROUNDS (PAR, 0x6ed9eba1);
+    for (; x < 60; x += 5)
+      BACON_SHA1_ROUNDS (MAJ, 0x8f1bbcdc);
+    for (; x < 80; x += 5)
+      BACON_SHA1_ROUNDS (PAR, 0xca62c1d6);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+void
+bacon_sha256_transform (unsigned int *state,
+                        const unsigned char *blocks,
+                        size_t n_blocks)
+{
+  int x;
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int d;
+  unsigned int e;
+  unsigned int f;
+  unsigned int g;
+  unsigned int h;
+  unsigned int t1;
+  unsigned int w[64];
+
+  for (; n_blocks; n_blocks--, blocks += 64) {
+    for (x = 0; x < 16; ++x)
+      w[x] = BACON_SHA_LOAD32 (blocks + x * 4);
+    for (x = 16; x < 64; ++x)
+      w[x] = SSIG1 (w[x - 2]) + w[x - 7] + SSIG0 (w[x - 15]) + w[x - 16];
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (x = 0; x < 64; x += 8) {
+      BACON_SHA256_ROUND (a, b, c, d, e, f, g, h, x);
+      BACON_SHA256_ROUND (h, a, b, c, d, e, f, g, x + 1);
+      BACON_SHA256_ROUND (g, h, a, b, c, d, e, f, x + 2);
+      BACON_SHA256_ROUND (f, g, h, a, b, c, d, e, x + 3);
+      BACON_SHA256_ROUND (e, f, g, h, a, b, c, d, x + 4);
+      BACON_SHA256_ROUND (d, e, f, g, h, a, b, c, x + 5);
+      BACON_SHA256_ROUND (c, d, e, f, g, h, a, b, x + 6);
+      BACON_SHA256_ROUND (b, c, d, e, f, g, h, a, x + 7);
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef HAVE_SHA_NI
+/* The SHA extensions are only there on some x86 CPUs, so it is up to the
+   caller to check for them before using bacon_sha256_transform_ni (). */
+BaconBoolean
+bacon_sha_ni_supported (void)
+{
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int d;
+
+  if (!__get_cpuid (1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+    return BACON_FALSE;
+  if (!__get_cpuid_count (7, 0, &a, &b, &c, &d))
+    return BACON_FALSE;
+  return (b & (1U << 29)) ? BACON_TRUE : BACON_FALSE;
+}
+
+/* Four rounds on the message words in `w', with the constants for group
+   `g' added on */
+#define BACON_SHA256_NI_ROUNDS(g, w)                                       \
+  do {                                                                     \
+    msg = _mm_add_epi32 ((w),                                              \
+        _mm_loadu_si128 ((const __m128i *) &s_sha256_k[(g) * 4]));         \
+    state1 = _mm_sha256rnds2_epu32 (state1, state0, msg);                  \
+    msg = _mm_shuffle_epi32 (msg, 0x0e);                                   \
+    state0 = _mm_sha256rnds2_epu32 (state0, state1, msg);                  \
+  } while (BACON_FALSE)
+
+/* Finishes the message schedule of `wn' from the two groups before it */
+#define BACON_SHA256_NI_MSG2(wn, w, wp)                                    \
+  do {                                                                     \
+    (wn) = _mm_add_epi32 ((wn), _mm_alignr_epi8 ((w), (wp), 4));           \
+    (wn) = _mm_sha256msg2_epu32 ((wn), (w));                               \
+  } while (BACON_FALSE)
+
+#define BACON_SHA256_NI_MSG1(wp, w) \
+  (wp) = _mm_sha256msg1_epu32 ((wp), (w))
+
+#define BACON_SHA256_NI_LOAD(w, i)                                         \
+  (w) = _mm_shuffle_epi8 (                                                 \
+      _mm_loadu_si128 ((const __m128i *) (blocks + (i) * 16)), mask)
+
+__attribute__ ((target ("sha,sse4.1"))) void
+bacon_sha256_transform_ni (unsigned int *state,
+                           const unsigned char *blocks,
+                           size_t n_blocks)
+{
+  int g;
+  __m128i msg;
+  __m128i tmp;
+  __m128i mask;
+  __m128i state0;
+  __m128i state1;
+  __m128i abef;
+  __m128i cdgh;
+  __m128i w0;
+  __m128i w1;
+  __m128i w2;
+  __m128i w3;
+
+  mask = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  /* the instructions want the state as ABEF/CDGH rather than ABCD/EFGH */
+  tmp = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &state[0]),
+                           0xb1);
+  state1 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &state[4]),
+                              0x1b);
+  state0 = _mm_alignr_epi8 (tmp, state1, 8);
+  state1 = _mm_blend_epi16 (state1, tmp, 0xf0);
+
+  for (; n_blocks; n_blocks--, blocks += 64) {
+    abef = state0;
+    cdgh = state1;
+
+    BACON_SHA256_NI_LOAD (w0, 0);
+    BACON_SHA256_NI_ROUNDS (0, w0);
+    BACON_SHA256_NI_LOAD (w1, 1);
+    BACON_SHA256_NI_ROUNDS (1, w1);
+    BACON_SHA256_NI_MSG1 (w0, w1);
+    BACON_SHA256_NI_LOAD (w2, 2);
+    BACON_SHA256_NI_ROUNDS (2, w2);
+    BACON_SHA256_NI_MSG1 (w1, w2);
+    BACON_SHA256_NI_LOAD (w3, 3);
+    BACON_SHA256_NI_ROUNDS (3, w3);
+    BACON_SHA256_NI_MSG2 (w0, w3, w2);
+    BACON_SHA256_NI_MSG1 (w2, w3);
+
+    for (g = 4; g < 12; g += 4) {
+      BACON_SHA256_NI_ROUNDS (g, w0);
+      BACON_SHA256_NI_MSG2 (w1, w0, w3);
+      BACON_SHA256_NI_MSG1 (w3, w0);
+      BACON_SHA256_NI_ROUNDS (g + 1, w1);
+      BACON_SHA256_NI_MSG2 (w2, w1, w0);
+      BACON_SHA256_NI_MSG1 (w0, w1);
+      BACON_SHA256_NI_ROUNDS (g + 2, w2);
+      BACON_SHA256_NI_MSG2 (w3, w2, w1);
+      BACON_SHA256_NI_MSG1 (w1, w2);
+      BACON_SHA256_NI_ROUNDS (g + 3, w3);
+      BACON_SHA256_NI_MSG2 (w0, w3, w2);
+      BACON_SHA256_NI_MSG1 (w2, w3);
+    }
+
+    BACON_SHA256_NI_ROUNDS (12, w0);
+    BACON_SHA256_NI_MSG2 (w1, w0, w3);
+    BACON_SHA256_NI_MSG1 (w3, w0);
+    BACON_SHA256_NI_ROUNDS (13, w1);
+    BACON_SHA256_NI_MSG2 (w2, w1, w0);
+    BACON_SHA256_NI_ROUNDS (14, w2);
+    BACON_SHA256_NI_MSG2 (w3, w2, w1);
+    BACON_SHA256_NI_ROUNDS (15, w3);
+
+    state0 = _mm_add_epi32 (state0, abef);
+    state1 = _mm_add_epi32 (state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32 (state0, 0x1b);
+  state1 = _mm_shuffle_epi32 (state1, 0xb1);
+  _mm_storeu_si128 ((__m128i *) &state[0],
+                    _mm_blend_epi16 (tmp, state1, 0xf0));
+  _mm_storeu_si128 ((__m128i *) &state[4],
+                    _mm_alignr_epi8 (state1, tmp, 8));
+}
+#endif
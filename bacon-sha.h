@@ -0,0 +1,47 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BACON_SHA_H
+#define BACON_SHA_H
+
+#include "bacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bacon_sha1_transform (unsigned int *state,
+                           const unsigned char *blocks,
+                           size_t n_blocks);
+void bacon_sha256_transform (unsigned int *state,
+                             const unsigned char *blocks,
+                             size_t n_blocks);
+#ifdef HAVE_SHA_NI
+BaconBoolean bacon_sha_ni_supported (void);
+void bacon_sha256_transform_ni (unsigned int *state,
+                                const unsigned char *blocks,
+                                size_t n_blocks);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BACON_SHA_H */
@@ -145,6 +145,58 @@ bacon_streqci (const char *str1, const char *str2)
   return BACON_FALSE;
 }
 
+/* Like bacon_streqci() when `lower' is already lowercase, but without
+   copying either string. */
+BaconBoolean
+bacon_streqlower (const char *lower, const char *str)
+{
+  char c;
+
+  for (; *lower && *str; ++lower, ++str) {
+    c = bacon_tolower (*str);
+    if (*lower != c)
+      return BACON_FALSE;
+  }
+  return (!*lower && !*str) ? BACON_TRUE : BACON_FALSE;
+}
+
+/* FNV-1a over the lowercased bytes of `str'. */
+unsigned int
+bacon_strhashci (const char *str)
+{
+  char c;
+  unsigned int hash;
+
+  hash = 2166136261U;
+  for (; *str; ++str) {
+    c = bacon_tolower (*str);
+    hash = (hash ^ ((unsigned char) c)) * 16777619U;
+  }
+  return hash;
+}
+
+/* Finds `lower', which must already be lowercase, in `str' ignoring case
+   and without copying `str'. */
+const char *
+bacon_strstrlower (const char *str, const char *lower)
+{
+  char c;
+  size_t x;
+
+  for (; *str; ++str) {
+    for (x = 0; lower[x]; ++x) {
+      if (!str[x])
+        return NULL;
+      c = bacon_tolower (str[x]);
+      if (c != lower[x])
+        break;
+    }
+    if (!lower[x])
+      return str;
+  }
+  return *lower ? NULL : str;
+}
+
 BaconBoolean
 bacon_strstw (const char *str, const char *pre)
 {
@@ -32,6 +32,9 @@ char *bacon_strndup (const char *str, size_t n);
 char *bacon_strf (const char *fmt, ...);
 BaconBoolean bacon_streq (const char *str1, const char *str2);
 BaconBoolean bacon_streqci (const char *str1, const char *str2);
+BaconBoolean bacon_streqlower (const char *lower, const char *str);
+unsigned int bacon_strhashci (const char *str);
+const char *bacon_strstrlower (const char *str, const char *lower);
 BaconBoolean bacon_strstw (const char *str, const char *pre);
 BaconBoolean bacon_strew (const char *str,
                           const char *suf,
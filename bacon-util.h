@@ -62,6 +62,20 @@ extern "C" {
     p->next = NULL; \
   } while (BACON_FALSE)
 
+/* Like bacon_list_append () but in constant time: `tail' tracks the last
+   node, so `root' never has to be walked (and stays the head) */
+#define bacon_list_append_tail(type, root, tail, p) \
+  do { \
+    p = bacon_new (type); \
+    p->next = NULL; \
+    p->prev = tail; \
+    if (tail) \
+      tail->next = p; \
+    else \
+      root = p; \
+    tail = p; \
+  } while (BACON_FALSE)
+
 #define bacon_list_rewind(root, p) \
   do { \
     for (; p; p = p->prev) \
@@ -0,0 +1,364 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bacon.h"
+
+#include <errno.h>
+#include <string.h>
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#endif
+#if defined (HAVE_PTHREAD) && defined (HAVE_PTHREAD_H)
+# include <pthread.h>
+# define BACON_VERIFY_USE_THREADS 1
+#endif
+
+#include "bacon-device.h"
+#include "bacon-env.h"
+#include "bacon-hash.h"
+#include "bacon-out.h"
+#include "bacon-rom.h"
+#include "bacon-str.h"
+#include "bacon-util.h"
+#include "bacon-verify.h"
+
+#define BACON_VERIFY_EXT         ".zip"
+#define BACON_VERIFY_THREADS_MAX 16
+
+typedef struct {
+  char *name;
+  char *path;
+  char codename[BACON_DEVICE_NAME_MAX];
+  unsigned long size;
+  BaconBoolean wanted;
+  BaconBoolean looked_up;
+  BaconBoolean matched;
+  BaconBoolean readable;
+  BaconHash expected;
+  BaconHash actual;
+} BaconVerifyJob;
+
+extern BaconDeviceList *g_device_list;
+
+static BaconVerifyJob *s_jobs     = NULL;
+static int             s_n_jobs   = 0;
+static int             s_next_job = 0;
+#ifdef BACON_VERIFY_USE_THREADS
+static pthread_mutex_t s_job_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int
+bacon_verify_job_cmp (const void *a, const void *b)
+{
+  return strcmp (((const BaconVerifyJob *) a)->name,
+                 ((const BaconVerifyJob *) b)->name);
+}
+
+/* ROM zips are named like `cm-10.2-20131231-NIGHTLY-mako.zip', so the
+   device codename is whatever sits between the last `-' and the
+   extension. */
+static void
+bacon_verify_codename_from_name (char *codename, const char *name)
+{
+  size_t n;
+  const char *p;
+
+  *codename = '\0';
+  n = strlen (name) - strlen (BACON_VERIFY_EXT);
+  for (p = name + n; (p > name) && (*(p - 1) != '-'); --p)
+    ;
+  if ((p == name) || ((size_t) ((name + n) - p) >= BACON_DEVICE_NAME_MAX))
+    return;
+  memcpy (codename, p, (name + n) - p);
+  codename[(name + n) - p] = '\0';
+}
+
+static BaconBoolean
+bacon_verify_scan_dir (const char *dir)
+{
+#ifdef HAVE_DIRENT_H
+  int max;
+  size_t n;
+  DIR *dp;
+  struct dirent *ep;
+  BaconVerifyJob *job;
+
+  dp = opendir (dir);
+  if (!dp) {
+    bacon_error ("failed to open directory `%s' (%s)", dir, strerror (errno));
+    return BACON_FALSE;
+  }
+
+  max = 0;
+  while ((ep = readdir (dp))) {
+    n = strlen (ep->d_name);
+    if ((n <= strlen (BACON_VERIFY_EXT)) ||
+        !bacon_streq (ep->d_name + n - strlen (BACON_VERIFY_EXT),
+                      BACON_VERIFY_EXT))
+      continue;
+
+    if (s_n_jobs == max) {
+      max = max ? (max * 2) : 64;
+      s_jobs = (BaconVerifyJob *) bacon_realloc (s_jobs,
+                                                 sizeof (BaconVerifyJob) * max);
+    }
+    job = &s_jobs[s_n_jobs];
+    memset (job, 0, sizeof (BaconVerifyJob));
+    job->path = bacon_strf ("%s%c%s", dir, BACON_PATH_SEP, ep->d_name);
+    if (!bacon_env_is_file (job->path)) {
+      bacon_free (job->path);
+      continue;
+    }
+    job->name = bacon_strdup (ep->d_name);
+    job->size = bacon_env_size_of_file (job->path);
+    bacon_verify_codename_from_name (job->codename, job->name);
+    s_n_jobs++;
+  }
+  closedir (dp);
+
+  if (s_n_jobs > 1)
+    qsort (s_jobs, s_n_jobs, sizeof (BaconVerifyJob), bacon_verify_job_cmp);
+  return BACON_TRUE;
+#else
+  bacon_error ("reading directories is not supported on this system");
+  return BACON_FALSE;
+#endif
+}
+
+/* Fetches the ROM list of every device the files belong to (once per
+   device) and picks up the remote hash of each file found in it. */
+static void
+bacon_verify_match_remote (int type, int max)
+{
+  int x;
+  int y;
+  int z;
+  BaconRom *rom;
+  BaconRomList *list;
+
+  for (x = 0; x < s_n_jobs; ++x) {
+    if (!s_jobs[x].wanted || s_jobs[x].looked_up)
+      continue;
+    if (!bacon_device_is_valid_id (g_device_list, s_jobs[x].codename)) {
+      s_jobs[x].looked_up = BACON_TRUE;
+      continue;
+    }
+
+    list = bacon_rom_list_new (s_jobs[x].codename, type, max);
+    for (y = x; y < s_n_jobs; ++y) {
+      if (!s_jobs[y].wanted ||
+          !bacon_streqci (s_jobs[y].codename, s_jobs[x].codename))
+        continue;
+      s_jobs[y].looked_up = BACON_TRUE;
+      for (z = 0; list && (z < BACON_ROM_TOTAL) && !s_jobs[y].matched; ++z) {
+        for (rom = list->roms[z]; rom; rom = rom->next) {
+          if (bacon_streq (bacon_rom_name (rom), s_jobs[y].name)) {
+            s_jobs[y].expected = rom->hash;
+            s_jobs[y].matched = (rom->hash.type != BACON_HASH_NONE)
+                                ? BACON_TRUE : BACON_FALSE;
+            break;
+          }
+          if (!rom->next)
+            break;
+        }
+      }
+    }
+    if (list)
+      bacon_rom_list_destroy (list);
+  }
+}
+
+static BaconVerifyJob *
+bacon_verify_next_job (void)
+{
+  BaconVerifyJob *job;
+
+  job = NULL;
+#ifdef BACON_VERIFY_USE_THREADS
+  pthread_mutex_lock (&s_job_lock);
+#endif
+  while (s_next_job < s_n_jobs) {
+    job = &s_jobs[s_next_job++];
+    if (job->matched)
+      break;
+    job = NULL;
+  }
+#ifdef BACON_VERIFY_USE_THREADS
+  pthread_mutex_unlock (&s_job_lock);
+#endif
+  return job;
+}
+
+static void *
+bacon_verify_worker (void *unused)
+{
+  BaconVerifyJob *job;
+
+  /* nothing in here may print: the output helpers aren't thread safe */
+  while ((job = bacon_verify_next_job ()))
+    job->readable = bacon_hash_from_file_quiet (&job->actual,
+                                                job->expected.type,
+                                                job->path);
+  return unused;
+}
+
+static int
+bacon_verify_n_threads (int n_jobs)
+{
+  int n;
+
+  n = 1;
+#if defined (BACON_VERIFY_USE_THREADS) && defined (_SC_NPROCESSORS_ONLN)
+  n = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (n > BACON_VERIFY_THREADS_MAX)
+    n = BACON_VERIFY_THREADS_MAX;
+#endif
+  if (n > n_jobs)
+    n = n_jobs;
+  return (n < 1) ? 1 : n;
+}
+
+/* Hashes every matched file on as many threads as there are CPUs */
+static int
+bacon_verify_hash_all (int n_jobs)
+{
+  int n;
+#ifdef BACON_VERIFY_USE_THREADS
+  int x;
+  int started;
+  pthread_t threads[BACON_VERIFY_THREADS_MAX];
+#endif
+
+  s_next_job = 0;
+  n = bacon_verify_n_threads (n_jobs);
+#ifdef BACON_VERIFY_USE_THREADS
+  started = 0;
+  for (x = 1; x < n; ++x) {
+    if (pthread_create (&threads[started], NULL,
+                        bacon_verify_worker, NULL) != 0)
+    {
+      bacon_debug ("%s", "failed to start worker thread");
+      break;
+    }
+    started++;
+  }
+  bacon_verify_worker (NULL);
+  for (x = 0; x < started; ++x)
+    pthread_join (threads[x], NULL);
+  return started + 1;
+#else
+  bacon_verify_worker (NULL);
+  return n;
+#endif
+}
+
+static void
+bacon_verify_free (void)
+{
+  int x;
+
+  for (x = 0; x < s_n_jobs; ++x) {
+    bacon_free (s_jobs[x].name);
+    bacon_free (s_jobs[x].path);
+  }
+  bacon_free (s_jobs);
+  s_jobs = NULL;
+  s_n_jobs = 0;
+}
+
+/* Checks the ROM zips in `dir' against their remote hashes. Only the
+   devices in `codenames' are considered, or every device the file names
+   point at if it is NULL or empty. Returns false if any file failed. */
+BaconBoolean
+bacon_verify_dir (const char *dir,
+                  const char *const *codenames,
+                  int type,
+                  int max)
+{
+  int x;
+  int y;
+  int n_threads;
+  int n_ok;
+  int n_failed;
+  int n_unknown;
+  long millis;
+  unsigned long bytes;
+  struct timeval s;
+  struct timeval e;
+
+  if (!bacon_verify_scan_dir (dir))
+    return BACON_FALSE;
+
+  for (x = 0; x < s_n_jobs; ++x) {
+    if (!codenames || !codenames[0])
+      s_jobs[x].wanted = BACON_TRUE;
+    for (y = 0; codenames && codenames[y]; ++y)
+      if (bacon_streqci (codenames[y], s_jobs[x].codename))
+        s_jobs[x].wanted = BACON_TRUE;
+  }
+  bacon_verify_match_remote (type, max);
+
+  bytes = 0;
+  n_ok = 0;
+  for (x = 0; x < s_n_jobs; ++x) {
+    if (s_jobs[x].matched) {
+      bytes += s_jobs[x].size;
+      n_ok++;
+    }
+  }
+
+  bacon_get_time_of_day (&s);
+  n_threads = bacon_verify_hash_all (n_ok);
+  bacon_get_time_of_day (&e);
+  millis = bacon_get_millis (&s, &e);
+
+  n_ok = 0;
+  n_failed = 0;
+  n_unknown = 0;
+  for (x = 0; x < s_n_jobs; ++x) {
+    if (!s_jobs[x].wanted)
+      continue;
+    if (!s_jobs[x].matched) {
+      bacon_outln ("%s: no remote hash", s_jobs[x].name);
+      n_unknown++;
+    } else if (!s_jobs[x].readable) {
+      bacon_outln ("%s: FAILED (unreadable)", s_jobs[x].name);
+      n_failed++;
+    } else if (bacon_hash_match (&s_jobs[x].actual, &s_jobs[x].expected)) {
+      bacon_outln ("%s: OK", s_jobs[x].name);
+      bacon_hash_cache_store (&s_jobs[x].actual, s_jobs[x].path);
+      n_ok++;
+    } else {
+      bacon_outln ("%s: FAILED", s_jobs[x].name);
+      n_failed++;
+    }
+  }
+
+  bacon_outln ("%i OK, %i FAILED, %i without a remote hash",
+               n_ok, n_failed, n_unknown);
+  bacon_outln ("hashed %.1f MiB in %.2fs (%.1f MB/s, %i thread%s)",
+               ((double) bytes) / (1024.0 * 1024.0),
+               ((double) millis) / 1000.0,
+               (millis > 0) ? (((double) bytes) / (1000.0 * millis)) : 0.0,
+               n_threads, (n_threads == 1) ? "" : "s");
+
+  bacon_verify_free ();
+  return (n_failed == 0) ? BACON_TRUE : BACON_FALSE;
+}
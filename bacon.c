@@ -20,6 +20,7 @@
 
 #include "bacon.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -27,6 +28,7 @@
 #include "bacon-ctype.h"
 #include "bacon-device.h"
 #include "bacon-env.h"
+#include "bacon-hash.h"
 #ifdef BACON_GTK
 # include "bacon-gtk.h"
 #endif
@@ -37,10 +39,15 @@
 #include "bacon-search.h"
 #include "bacon-str.h"
 #include "bacon-util.h"
+#include "bacon-verify.h"
 
-#define BACON_DEFAULT_MAX_ROMS 3
-#define BACON_DEVICES_MAX      512
-#define BACON_OPT_MAX          1024
+#define BACON_DEFAULT_MAX_ROMS  3
+#define BACON_DEFAULT_JOBS      8
+#define BACON_DEFAULT_HOST_JOBS 4
+#define BACON_DEFAULT_CACHE_TTL 300
+#define BACON_FUZZY_RESULTS     10
+#define BACON_MANIFEST_LINE_MAX 1024
+#define BACON_OPT_MAX           1024
 
 #define BACON_DEVICE_FULLNAME_TYPE 0
 #define BACON_DEVICE_CODENAME_TYPE 1
@@ -60,10 +67,16 @@ typedef enum {
   BACON_OT_RC,
   BACON_OT_STABLE,
   BACON_OT_OUTPUT,
+  BACON_OT_SEGMENTS,
   BACON_OT_HASH,
   BACON_OT_LATEST,
   BACON_OT_MAX,
-  BACON_OT_URL
+  BACON_OT_URL,
+  BACON_OT_VERIFY,
+  BACON_OT_MANIFEST,
+  BACON_OT_JOBS,
+  BACON_OT_HOST_JOBS,
+  BACON_OT_CACHE_TTL
 } BaconOptionType;
 
 typedef struct {
@@ -71,16 +84,33 @@ typedef struct {
   char *token;
 } BaconTokenPosition;
 
+/* A DEVICE to work on; a `type' of BACON_ROM_TYPE_NONE and a `max'
+   of 0 stand for whatever the command line says, `output' may be
+   NULL */
+typedef struct {
+  char *id;
+  int type;
+  int max;
+  char *output;
+} BaconTarget;
+
 extern char *       g_program_data_path;
 char *              g_program_name       = NULL;
 BaconDeviceList *   g_device_list        = NULL;
 char *              g_out_path           = NULL;
 int                 g_max_roms           = BACON_DEFAULT_MAX_ROMS;
 int                 g_rom_type           = BACON_ROM_TYPE_NONE;
+int                 g_segments           = 1;
+int                 g_cache_ttl          = BACON_DEFAULT_CACHE_TTL;
 BaconBoolean        g_show_progress      = BACON_TRUE;
 BaconBoolean        g_use_color          = BACON_FALSE;
 static char *       s_query              = NULL;
+static char *       s_verify_path        = NULL;
+static char *       s_manifest_path      = NULL;
+static int          s_jobs               = 0;
+static int          s_host_jobs          = 0;
 static BaconBoolean s_find_device        = BACON_FALSE;
+static BaconBoolean s_fuzzy_find         = BACON_FALSE;
 static BaconBoolean s_list_all_devices   = BACON_FALSE;
 static BaconBoolean s_update_device_list = BACON_FALSE;
 static BaconBoolean s_latest             = BACON_FALSE;
@@ -90,12 +120,11 @@ static BaconBoolean s_show_hash          = BACON_FALSE;
 static BaconBoolean s_show_url           = BACON_FALSE;
 static BaconBoolean s_interactive        = BACON_FALSE;
 static size_t       s_opt_pos            = 0;
+static size_t       s_n_devices          = 0;
+static size_t       s_devices_size       = 0;
+static BaconTarget *s_devices            = NULL;
 static char *       s_opt                [BACON_OPT_MAX];
 
-static struct {
-  char id[BACON_DEVICE_NAME_MAX];
-} s_devices[BACON_DEVICES_MAX];
-
 static void
 bacon_usage (BaconBoolean error)
 {
@@ -111,6 +140,10 @@ bacon_help (void)
   /* each item in array gets its own line */
   static const char *const help[] = {
     "General Options:",
+    "  --cache-ttl=SECONDS        Use cached ROM lists for up to SECONDS",
+    "                             before asking the server whether they",
+    "                             have changed (default: 300, 0 always",
+    "                             asks)",
     "  -c, --color                Enable colored output",
     "  -d, --download             Download the latest ROM for DEVICE",
     "                             Requires specific ROM type option",
@@ -120,6 +153,12 @@ bacon_help (void)
     "                             and print the results.",
     "                             This can be useful for identifying the",
     "                             codename of a particular device.",
+    "  -F PATTERN, --fuzzy-find=PATTERN",
+    "                             Like `--find-device', but each word of",
+    "                             PATTERN may contain a typo or two.",
+    "                             Results are ranked by the number of",
+    "                             edits needed; the best 10 are printed",
+    "                             (or the best N with `--max=N').",
 #ifdef BACON_GTK
     "  --gtk                      Launch the GTK+ user interface",
     "                             NOTE: when this option is used, it MUST be",
@@ -128,12 +167,36 @@ bacon_help (void)
     "                             after this one on the command line)",
 #endif
     "  -i, --interactive          Interactive mode",
+    "  --jobs=N                   Run at most N transfers at once",
+    "                             (default: 8 with --manifest, no limit",
+    "                             otherwise)",
+    "  --host-jobs=N              Open at most N connections to any one",
+    "                             host (default: 4 with --manifest, no",
+    "                             limit otherwise)",
     "  -l, --list-devices         List all available DEVICEs",
+    "  --manifest=FILE            Work on the DEVICEs listed in FILE, one",
+    "                             per line as:",
+    "                               DEVICE [TYPES [MAX [OUTPUT]]]",
+    "                             TYPES is a comma separated list of all,",
+    "                             experimental, snapshot, nightly, rc and",
+    "                             stable, MAX is the number of ROMs per",
+    "                             type and OUTPUT is the directory to",
+    "                             download them to. A field of '-' takes",
+    "                             the value from the command line. Blank",
+    "                             lines and lines starting with '#' are",
+    "                             ignored. All ROM lists and downloads",
+    "                             share one pool of transfers (see --jobs",
+    "                             and --host-jobs).",
     "  -p, --no-progress          Do not show any progress when retrieving",
     "                             data from the internet (this includes the",
     "                             progress bar during ROM downloads)",
     "  -s, --show                 Show ROMs for DEVICE (no downloading)",
     "  -u, --update-device-list   Update the local DEVICE list",
+    "  --verify=DIR               Check the ROM zips in DIR against their",
+    "                             remote MD5 hashes and print a summary.",
+    "                             Only DEVICEs that are given are checked,",
+    "                             otherwise the DEVICE is taken from each",
+    "                             file name.",
     "  -?, -h, --help             Display this help text and exit",
     "  -v, --version              Display version information and exit",
     "ROM Type Options:",
@@ -163,6 +226,10 @@ bacon_help (void)
     "                             - If PATH exists and its MD5 hash matches",
     "                               the remote ROM MD5 hash, then nothing",
     "                               will be done.",
+    "  --segments=N               Download each ROM as N byte ranges over",
+    "                             N parallel connections (at most 16).",
+    "                             An interrupted segmented download is",
+    "                             resumed range by range.",
     "Show Options:",
     "  -H, --hash                 Show remote MD5 hash for each ROM",
     "                             displayed",
@@ -257,9 +324,20 @@ bacon_set_program_name (const char *argv0)
 static void
 bacon_cleanup (void)
 {
+  size_t x;
+
+  for (x = 0; x < s_n_devices; ++x) {
+    bacon_free (s_devices[x].id);
+    bacon_free (s_devices[x].output);
+  }
+  bacon_free (s_devices);
   if (g_device_list)
     bacon_device_list_destroy (g_device_list);
+  bacon_net_cleanup ();
+  bacon_hash_cache_cleanup ();
   bacon_free (g_out_path);
+  bacon_free (s_verify_path);
+  bacon_free (s_manifest_path);
   bacon_free (g_program_data_path);
   bacon_free (g_program_name);
 }
@@ -304,6 +382,175 @@ bacon_set_max_roms_from_arg (const char *arg)
   return BACON_TRUE;
 }
 
+static BaconBoolean
+bacon_set_segments_from_arg (const char *arg)
+{
+  size_t x;
+
+  for (x = 0; arg[x]; ++x)
+    if (!bacon_isdigit (arg[x]))
+      return BACON_FALSE;
+  g_segments = bacon_strtoint (arg);
+  if ((g_segments <= 0) || (g_segments > BACON_NET_SEGMENTS_MAX))
+    return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+static BaconBoolean
+bacon_count_from_arg (const char *arg, int *count)
+{
+  size_t x;
+
+  for (x = 0; arg[x]; ++x)
+    if (!bacon_isdigit (arg[x]))
+      return BACON_FALSE;
+  *count = bacon_strtoint (arg);
+  if (*count <= 0)
+    return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+static BaconBoolean
+bacon_set_jobs_from_arg (const char *arg, int *jobs)
+{
+  if (!bacon_count_from_arg (arg, jobs) || (*jobs > BACON_NET_JOBS_MAX))
+    return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+static BaconBoolean
+bacon_set_cache_ttl_from_arg (const char *arg)
+{
+  size_t x;
+
+  if (!*arg)
+    return BACON_FALSE;
+  for (x = 0; arg[x]; ++x)
+    if (!bacon_isdigit (arg[x]))
+      return BACON_FALSE;
+  g_cache_ttl = bacon_strtoint (arg);
+  if (g_cache_ttl < 0)
+    return BACON_FALSE;
+  return BACON_TRUE;
+}
+
+static void
+bacon_add_device (const char *id, int type, int max, const char *output)
+{
+  if (s_n_devices == s_devices_size) {
+    s_devices_size = (s_devices_size) ? (s_devices_size * 2) : 16;
+    s_devices = (BaconTarget *) bacon_realloc (s_devices,
+                                               sizeof (BaconTarget) *
+                                               s_devices_size);
+  }
+  s_devices[s_n_devices].id = bacon_strdup (id);
+  s_devices[s_n_devices].type = type;
+  s_devices[s_n_devices].max = max;
+  s_devices[s_n_devices].output = (output) ? bacon_strdup (output) : NULL;
+  s_n_devices++;
+}
+
+static BaconBoolean
+bacon_rom_types_from_arg (char *arg, int *type)
+{
+  char *name;
+  char *next;
+
+  *type = BACON_ROM_TYPE_NONE;
+  if (bacon_streq (arg, "-"))
+    return BACON_TRUE;
+
+  for (name = arg; name; name = next) {
+    next = strchr (name, ',');
+    if (next)
+      *next++ = '\0';
+    if (bacon_streqci (name, "all"))
+      *type |= BACON_ROM_TYPE_ALL;
+    else if (bacon_streqci (name, "experimental") ||
+             bacon_streqci (name, "test"))
+      *type |= BACON_ROM_TYPE_TEST;
+    else if (bacon_streqci (name, "snapshot"))
+      *type |= BACON_ROM_TYPE_SNAPSHOT;
+    else if (bacon_streqci (name, "nightly"))
+      *type |= BACON_ROM_TYPE_NIGHTLY;
+    else if (bacon_streqci (name, "rc"))
+      *type |= BACON_ROM_TYPE_RC;
+    else if (bacon_streqci (name, "stable"))
+      *type |= BACON_ROM_TYPE_STABLE;
+    else
+      return BACON_FALSE;
+  }
+  return BACON_TRUE;
+}
+
+/* Reads `DEVICE [TYPES [MAX [OUTPUT]]]' lines from `path', OUTPUT is
+   the rest of the line so it may contain blanks */
+static void
+bacon_read_manifest (const char *path)
+{
+  int c;
+  int n;
+  int x;
+  int max;
+  int type;
+  size_t len;
+  char *p;
+  char *output;
+  char *fields[3];
+  char line[BACON_MANIFEST_LINE_MAX];
+  FILE *fp;
+
+  fp = bacon_env_fopen (path, "r");
+  for (n = 1; fgets (line, BACON_MANIFEST_LINE_MAX, fp); ++n) {
+    len = strlen (line);
+    /* the rest of a line that does not fit would pass for another one */
+    if (len && (line[len - 1] != '\n') &&
+        ((c = fgetc (fp)) != EOF) && (c != '\n'))
+    {
+      bacon_error ("%s:%i: line is longer than %i characters",
+                   path, n, BACON_MANIFEST_LINE_MAX - 1);
+      exit (EXIT_FAILURE);
+    }
+    while (len && bacon_isspace (line[len - 1]))
+      line[--len] = '\0';
+    for (p = line; bacon_isspace (*p); ++p)
+      ;
+    if (!*p || (*p == '#'))
+      continue;
+
+    memset (fields, 0, sizeof (fields));
+    for (x = 0; *p && (x < 3); ++x) {
+      fields[x] = p;
+      while (*p && !bacon_isspace (*p))
+        ++p;
+      if (*p)
+        *p++ = '\0';
+      while (bacon_isspace (*p))
+        ++p;
+    }
+    output = (*p) ? p : NULL;
+
+    type = BACON_ROM_TYPE_NONE;
+    if (fields[1] && !bacon_rom_types_from_arg (fields[1], &type)) {
+      bacon_error ("%s:%i: '%s' is not a valid ROM type", path, n, fields[1]);
+      exit (EXIT_FAILURE);
+    }
+
+    max = 0;
+    if (fields[2] && !bacon_streq (fields[2], "-") &&
+        !bacon_count_from_arg (fields[2], &max))
+    {
+      bacon_error ("%s:%i: '%s' is not a valid maximum", path, n, fields[2]);
+      exit (EXIT_FAILURE);
+    }
+    if (output && bacon_streq (output, "-"))
+      output = NULL;
+
+    bacon_add_device (fields[0], type, max, output);
+  }
+  bacon_env_fclose (fp);
+}
+
 static char *
 bacon_get_specific_option (BaconOptionType otype)
 {
@@ -323,7 +570,9 @@ bacon_get_specific_option (BaconOptionType otype)
       break;
     case BACON_OT_FIND_DEVICE:
       if (bacon_streq (s_opt[x], "-f") ||
-          bacon_streq (s_opt[x], "--find-device"))
+          bacon_streq (s_opt[x], "--find-device") ||
+          bacon_streq (s_opt[x], "-F") ||
+          bacon_streq (s_opt[x], "--fuzzy-find"))
         return s_opt[x];
       break;
     case BACON_OT_INTERACTIVE:
@@ -375,6 +624,10 @@ bacon_get_specific_option (BaconOptionType otype)
       if (bacon_streq (s_opt[x], "-o") || bacon_strstw (s_opt[x], "--output"))
         return s_opt[x];
       break;
+    case BACON_OT_SEGMENTS:
+      if (bacon_strstw (s_opt[x], "--segments"))
+        return s_opt[x];
+      break;
     case BACON_OT_HASH:
       if (bacon_streq (s_opt[x], "-H") || bacon_streq (s_opt[x], "--hash"))
         return s_opt[x];
@@ -391,6 +644,26 @@ bacon_get_specific_option (BaconOptionType otype)
       if (bacon_streq (s_opt[x], "-U") || bacon_streq (s_opt[x], "--url"))
         return s_opt[x];
       break;
+    case BACON_OT_VERIFY:
+      if (bacon_strstw (s_opt[x], "--verify"))
+        return s_opt[x];
+      break;
+    case BACON_OT_MANIFEST:
+      if (bacon_strstw (s_opt[x], "--manifest"))
+        return s_opt[x];
+      break;
+    case BACON_OT_JOBS:
+      if (bacon_strstw (s_opt[x], "--jobs"))
+        return s_opt[x];
+      break;
+    case BACON_OT_HOST_JOBS:
+      if (bacon_strstw (s_opt[x], "--host-jobs"))
+        return s_opt[x];
+      break;
+    case BACON_OT_CACHE_TTL:
+      if (bacon_strstw (s_opt[x], "--cache-ttl"))
+        return s_opt[x];
+      break;
     default:
       ;
     }
@@ -401,7 +674,7 @@ bacon_get_specific_option (BaconOptionType otype)
 static void
 bacon_check_opts (void)
 {
-  if (!s_opt[0] && !*s_devices[0].id) {
+  if (!s_opt[0] && !s_n_devices) {
     bacon_error ("nothing to do");
     goto error;
   }
@@ -425,6 +698,39 @@ bacon_check_opts (void)
   if (s_find_device)
     return;
 
+  if (s_manifest_path && (s_verify_path || s_interactive || (g_segments > 1)))
+  {
+    if (s_verify_path)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_MANIFEST),
+                   bacon_get_specific_option (BACON_OT_VERIFY));
+    if (s_interactive)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_MANIFEST),
+                   bacon_get_specific_option (BACON_OT_INTERACTIVE));
+    if (g_segments > 1)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_MANIFEST),
+                   bacon_get_specific_option (BACON_OT_SEGMENTS));
+    goto error;
+  }
+
+  if (s_verify_path && (s_downloading || s_showing || s_interactive)) {
+    if (s_downloading)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_VERIFY),
+                   bacon_get_specific_option (BACON_OT_DOWNLOAD));
+    if (s_showing)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_VERIFY),
+                   bacon_get_specific_option (BACON_OT_SHOW));
+    if (s_interactive)
+      bacon_error ("`%s' and `%s' are mutually exclusive",
+                   bacon_get_specific_option (BACON_OT_VERIFY),
+                   bacon_get_specific_option (BACON_OT_INTERACTIVE));
+    goto error;
+  }
+
   if (s_interactive && (g_rom_type != BACON_ROM_TYPE_NONE)) {
     if (g_rom_type & BACON_ROM_TYPE_ALL)
       bacon_error ("ROM type option `%s' cannot be used with `%s'",
@@ -513,11 +819,18 @@ bacon_check_opts (void)
     goto error;
   }
 
-  if (!s_downloading && !s_showing &&
+  if ((g_segments > 1) && !s_downloading && !s_interactive) {
+    bacon_error ("`%s' can only be used with `-d'/`--download' "
+                 "or `-i'/`--interactive'",
+                 bacon_get_specific_option (BACON_OT_SEGMENTS));
+    goto error;
+  }
+
+  if (!s_downloading && !s_showing && !s_verify_path &&
       !s_list_all_devices && !s_update_device_list)
     s_showing = BACON_TRUE;
 
-  if (!*s_devices[0].id &&
+  if (!s_n_devices &&
       ((s_downloading || s_showing) &&
        (!s_list_all_devices && !s_update_device_list)))
   {
@@ -530,6 +843,16 @@ bacon_check_opts (void)
 
   if (s_latest)
     g_max_roms = 1;
+  else if (s_verify_path && !bacon_get_specific_option (BACON_OT_MAX))
+    g_max_roms = INT_MAX; /* a mirror may hold any ROM that is listed */
+
+  /* a manifest can queue hundreds of transfers, keep them civil */
+  if (s_manifest_path) {
+    if (!s_jobs)
+      s_jobs = BACON_DEFAULT_JOBS;
+    if (!s_host_jobs)
+      s_host_jobs = BACON_DEFAULT_HOST_JOBS;
+  }
 
   return;
 
@@ -548,6 +871,7 @@ bacon_parse_string_for_short_opts (const char *s)
     case '?':
     case 'h':
     case 'f':
+    case 'F':
     case 'M':
     case 'v':
     case 'o':
@@ -628,12 +952,10 @@ static void
 bacon_parse_opt (int c, char **v)
 {
   size_t x;
-  size_t n;
-  size_t pos;
   BaconBoolean addopt;
   char *o;
+  char *n;
 
-  pos = 0;
   bacon_set_program_name (v[0]);
 
 #ifdef BACON_GTK
@@ -679,6 +1001,30 @@ bacon_parse_opt (int c, char **v)
       s_query = o;
       s_opt[s_opt_pos++] = "--find-device";
       addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "-F") ||
+               bacon_streq (v[x], "--fuzzy-find"))
+    {
+      if (!v[x + 1]) {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      s_query = v[++x];
+      addopt = BACON_FALSE;
+      s_find_device = BACON_TRUE;
+      s_fuzzy_find = BACON_TRUE;
+    } else if (bacon_strstw (v[x], "--fuzzy-find=")) {
+      o = strchr (v[x], '=');
+      ++o;
+      if (!o || !*o) {
+        bacon_error ("`--fuzzy-find' requires an argument (try `--help')");
+        exit (EXIT_FAILURE);
+      }
+      s_find_device = BACON_TRUE;
+      s_fuzzy_find = BACON_TRUE;
+      s_query = o;
+      s_opt[s_opt_pos++] = "--fuzzy-find";
+      addopt = BACON_FALSE;
     } else if (bacon_streq (v[x], "-l") ||
                bacon_streq (v[x], "--list-devices"))
       s_list_all_devices = BACON_TRUE;
@@ -725,6 +1071,32 @@ bacon_parse_opt (int c, char **v)
       }
       s_opt[s_opt_pos++] = "--max";
       addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "--segments")) {
+      if (!v[x + 1]) {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      addopt = BACON_FALSE;
+      if (!bacon_set_segments_from_arg (v[++x])) {
+        bacon_error ("'%s' is not a valid argument for `%s' (try `--help')",
+                     v[x], v[x - 1]);
+        exit (EXIT_FAILURE);
+      }
+    } else if (bacon_strstw (v[x], "--segments=")) {
+      o = strchr (v[x], '=');
+      ++o;
+      if (!o || !*o) {
+        bacon_error ("`--segments' requires an argument (try `--help')");
+        exit (EXIT_FAILURE);
+      }
+      if (!bacon_set_segments_from_arg (o)) {
+        bacon_error ("'%s' is not a valid argument for `--segments' "
+                     "(try `--help')", o);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = "--segments";
+      addopt = BACON_FALSE;
     } else if (bacon_streq (v[x], "-p") ||
                bacon_streq (v[x], "--no-progress"))
       g_show_progress = BACON_FALSE;
@@ -771,6 +1143,104 @@ bacon_parse_opt (int c, char **v)
       g_out_path = bacon_strdup (o);
       s_opt[s_opt_pos++] = "--output";
       addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "--manifest")) {
+      if (!v[x + 1] || v[x + 1][0] == '-') {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      addopt = BACON_FALSE;
+      s_manifest_path = bacon_strdup (v[++x]);
+      bacon_read_manifest (s_manifest_path);
+    } else if (bacon_strstw (v[x], "--manifest=")) {
+      o = strchr (v[x], '=');
+      ++o;
+      if (!o || !*o) {
+        bacon_error ("`--manifest' requires an argument (try `--help')");
+        exit (EXIT_FAILURE);
+      }
+      s_manifest_path = bacon_strdup (o);
+      bacon_read_manifest (s_manifest_path);
+      s_opt[s_opt_pos++] = "--manifest";
+      addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "--jobs") ||
+               bacon_streq (v[x], "--host-jobs"))
+    {
+      if (!v[x + 1]) {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      addopt = BACON_FALSE;
+      if (!bacon_set_jobs_from_arg (v[x + 1],
+                                    bacon_streq (v[x], "--jobs")
+                                    ? &s_jobs : &s_host_jobs))
+      {
+        bacon_error ("'%s' is not a valid argument for `%s' (try `--help')",
+                     v[x + 1], v[x]);
+        exit (EXIT_FAILURE);
+      }
+      ++x;
+    } else if (bacon_strstw (v[x], "--jobs=") ||
+               bacon_strstw (v[x], "--host-jobs="))
+    {
+      n = (bacon_strstw (v[x], "--jobs=")) ? "--jobs" : "--host-jobs";
+      o = strchr (v[x], '=');
+      ++o;
+      if (!*o) {
+        bacon_error ("`%s' requires an argument (try `--help')", n);
+        exit (EXIT_FAILURE);
+      }
+      if (!bacon_set_jobs_from_arg (o, bacon_streq (n, "--jobs")
+                                       ? &s_jobs : &s_host_jobs))
+      {
+        bacon_error ("'%s' is not a valid argument for `%s' "
+                     "(try `--help')", o, n);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = n;
+      addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "--cache-ttl")) {
+      if (!v[x + 1]) {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      addopt = BACON_FALSE;
+      if (!bacon_set_cache_ttl_from_arg (v[x + 1])) {
+        bacon_error ("'%s' is not a valid argument for `%s' (try `--help')",
+                     v[x + 1], v[x]);
+        exit (EXIT_FAILURE);
+      }
+      ++x;
+    } else if (bacon_strstw (v[x], "--cache-ttl=")) {
+      o = strchr (v[x], '=');
+      ++o;
+      if (!bacon_set_cache_ttl_from_arg (o)) {
+        bacon_error ("'%s' is not a valid argument for `--cache-ttl' "
+                     "(try `--help')", o);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = "--cache-ttl";
+      addopt = BACON_FALSE;
+    } else if (bacon_streq (v[x], "--verify")) {
+      if (!v[x + 1] || v[x + 1][0] == '-') {
+        bacon_error ("`%s' requires an argument (try `--help')", v[x]);
+        exit (EXIT_FAILURE);
+      }
+      s_opt[s_opt_pos++] = v[x];
+      addopt = BACON_FALSE;
+      s_verify_path = bacon_strdup (v[++x]);
+    } else if (bacon_strstw (v[x], "--verify=")) {
+      o = strchr (v[x], '=');
+      ++o;
+      if (!o || !*o) {
+        bacon_error ("`--verify' requires an argument (try `--help')");
+        exit (EXIT_FAILURE);
+      }
+      s_verify_path = bacon_strdup (o);
+      s_opt[s_opt_pos++] = "--verify";
+      addopt = BACON_FALSE;
     } else if (v[x][0] == '-') {
       if (!v[x][1] || v[x][1] == '-') {
         bacon_error ("`%s' is an unrecognized option (try `--help')", v[x]);
@@ -778,10 +1248,8 @@ bacon_parse_opt (int c, char **v)
       }
       bacon_parse_string_for_short_opts (v[x]);
       addopt = BACON_FALSE;
-    } else if (pos < BACON_DEVICES_MAX) {
-      n = strlen (v[x]);
-      strncpy (s_devices[pos].id, v[x], n);
-      s_devices[pos++].id[n] = '\0';
+    } else {
+      bacon_add_device (v[x], BACON_ROM_TYPE_NONE, 0, NULL);
       addopt = BACON_FALSE;
     }
     if (addopt)
@@ -789,7 +1257,6 @@ bacon_parse_opt (int c, char **v)
   }
 
   s_opt[s_opt_pos] = NULL;
-  s_devices[pos].id[0] = '\0';
   bacon_check_opts ();
 }
 
@@ -870,15 +1337,10 @@ bacon_find_device_pattern_and_show_results (void)
 {
   int i;
   int n_total_digits;
-  int total_results;
+  size_t total_results;
   size_t results_pos;
-  BaconDeviceList *p;
   BaconSearchTokenList *list;
-  struct {
-    BaconDevice *device;
-    BaconBoolean fullname_match;
-    BaconBoolean codename_match;
-  } results[BACON_DEVICES_MAX];
+  BaconDeviceMatch *results;
 
   list = bacon_search_token_list_new (s_query);
   if (!list) {
@@ -886,35 +1348,16 @@ bacon_find_device_pattern_and_show_results (void)
     exit (EXIT_FAILURE);
   }
 
-  results_pos = 0;
-  for (p = g_device_list; p; p = p->next) {
-    if (bacon_search (p->device->fullname, list) ==
-        BACON_SEARCH_RESULT_ALL_MATCHES)
-      results[results_pos].fullname_match = BACON_TRUE;
-    else
-      results[results_pos].fullname_match = BACON_FALSE;
-    if (bacon_search (p->device->codename, list) ==
-        BACON_SEARCH_RESULT_ALL_MATCHES)
-      results[results_pos].codename_match = BACON_TRUE;
-    else
-      results[results_pos].codename_match = BACON_FALSE;
-    if (results[results_pos].fullname_match ||
-        results[results_pos].codename_match)
-      results[results_pos++].device = p->device;
-    if (!p->next)
-      break;
-  }
-  results[results_pos].device = NULL;
-  total_results = ((int) results_pos);
+  results = bacon_device_find (g_device_list, list, &total_results);
 
   bacon_outln ("Device search results for '%s':",
                BACON_COLOR_S (BACON_FIND_PATTERN_COLOR, s_query));
 
-  if (!results[0].device)
+  if (!total_results)
     bacon_outln ("   %s", BACON_COLOR_S (BACON_BLUE, "None"));
   else {
-    n_total_digits = bacon_ndigits (total_results);
-    for (results_pos = 0; results[results_pos].device; ++results_pos) {
+    n_total_digits = bacon_ndigits ((int) total_results);
+    for (results_pos = 0; results_pos < total_results; ++results_pos) {
       bacon_outi (1, NULL);
       for (i = bacon_ndigits (((int) (results_pos + 1)));
            i < n_total_digits;
@@ -945,6 +1388,60 @@ bacon_find_device_pattern_and_show_results (void)
       bacon_outln ("]");
     }
   }
+  bacon_free (results);
+  bacon_search_token_list_free (list);
+}
+
+static void
+bacon_fuzzy_find_device_and_show_results (void)
+{
+  int i;
+  int n_total_digits;
+  size_t max;
+  size_t total_results;
+  size_t results_pos;
+  BaconSearchTokenList *list;
+  BaconDeviceMatch *results;
+
+  list = bacon_search_token_list_new (s_query);
+  if (!list) {
+    bacon_error ("failed to create token list from search '%s'", s_query);
+    exit (EXIT_FAILURE);
+  }
+
+  max = BACON_FUZZY_RESULTS;
+  if (bacon_get_specific_option (BACON_OT_MAX))
+    max = (size_t) g_max_roms;
+  results = bacon_device_fuzzy_find (g_device_list, list, max,
+                                     &total_results);
+
+  bacon_outln ("Fuzzy device search results for '%s':",
+               BACON_COLOR_S (BACON_FIND_PATTERN_COLOR, s_query));
+
+  if (!total_results)
+    bacon_outln ("   %s", BACON_COLOR_S (BACON_BLUE, "None"));
+  else {
+    n_total_digits = bacon_ndigits ((int) total_results);
+    for (results_pos = 0; results_pos < total_results; ++results_pos) {
+      bacon_outi (1, NULL);
+      for (i = bacon_ndigits (((int) (results_pos + 1)));
+           i < n_total_digits;
+           ++i)
+        bacon_outc (' ');
+      bacon_out ("%s) ",
+                 BACON_COLOR_I (BACON_NUMBER_LIST_COLOR,
+                                ((int) (results_pos + 1))));
+      bacon_out ("%s",
+                 BACON_COLOR_S (BACON_FULLNAME_COLOR,
+                                results[results_pos].device->fullname));
+      bacon_out (" [%s]",
+                 BACON_COLOR_S (BACON_CODENAME_COLOR,
+                                results[results_pos].device->codename));
+      bacon_outln (" (%i %s)", results[results_pos].distance,
+                   (results[results_pos].distance == 1) ? "edit" : "edits");
+    }
+  }
+  bacon_free (results);
   bacon_search_token_list_free (list);
 }
 
@@ -953,6 +1450,7 @@ bacon_show_rom_list (const BaconDevice *device, const BaconRomList *list)
 {
   int n;
   int x;
+  char hex[BACON_HASH_HEX_SIZE];
   BaconRom *rom;
 
   bacon_outln ("%s [%s]:",
@@ -973,26 +1471,33 @@ bacon_show_rom_list (const BaconDevice *device, const BaconRomList *list)
       if (!s_latest) {
         bacon_outlni (2, "%s) %s",
                       BACON_COLOR_I (BACON_NUMBER_LIST_COLOR, n + 1),
-                      BACON_COLOR_S (BACON_ROM_NAME_COLOR, rom->name));
+                      BACON_COLOR_S (BACON_ROM_NAME_COLOR,
+                                     bacon_rom_name (rom)));
       } else
         bacon_outlni (2, "%s",
-                      BACON_COLOR_S (BACON_ROM_NAME_COLOR, rom->name));
+                      BACON_COLOR_S (BACON_ROM_NAME_COLOR,
+                                     bacon_rom_name (rom)));
       bacon_outlni (3, "%s: %s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "released"),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->date));
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR,
+                                   bacon_rom_date (rom)));
       bacon_outlni (3, "%s:     %s",
                     BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "size"),
-                    BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->size));
-      if (s_show_hash)
+                    BACON_COLOR_S (BACON_ROM_INFO_COLOR,
+                                   bacon_rom_size (rom)));
+      if (s_show_hash) {
+        bacon_hash_to_hex (&rom->hash, hex);
         bacon_outlni (3, "%s:     %s",
                       BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "hash"),
-                      BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->hash.hash));
+                      BACON_COLOR_S (BACON_ROM_INFO_COLOR, hex));
+      }
       if (s_show_url)
         bacon_outlni (3, "%s:      %s%s%s",
                       BACON_COLOR_S (BACON_ROM_INFO_TAG_COLOR, "url"),
                       BACON_COLOR_S (BACON_ROM_INFO_COLOR, BACON_GET_CM_URL),
                       BACON_COLOR_C (BACON_ROM_INFO_COLOR, '/'),
-                      BACON_COLOR_S (BACON_ROM_INFO_COLOR, rom->get));
+                      BACON_COLOR_S (BACON_ROM_INFO_COLOR,
+                                     bacon_rom_get (rom)));
       if (!rom->next)
         break;
       ++n;
@@ -1000,11 +1505,81 @@ bacon_show_rom_list (const BaconDevice *device, const BaconRomList *list)
   }
 }
 
+/* Downloads every ROM in `lists' (one list per DEVICE) */
 static void
-bacon_download_rom (const BaconDevice *device, const BaconRom *rom)
+bacon_download_roms (BaconRomList **lists)
 {
-  if (rom && !bacon_rom_do_download (rom, g_out_path))
+  int n;
+  int x;
+  size_t pos;
+  const char **paths;
+  const BaconRom **roms;
+  BaconRom *rom;
+
+  n = 0;
+  for (pos = 0; pos < s_n_devices; ++pos) {
+    /* a manifest OUTPUT is always a directory */
+    if (s_devices[pos].output &&
+        !bacon_env_ensure_path (s_devices[pos].output, BACON_FALSE))
+    {
+      bacon_error ("`%s' is an invalid path", s_devices[pos].output);
+      exit (EXIT_FAILURE);
+    }
+    for (x = 0; x < BACON_ROM_TOTAL; ++x)
+      n += bacon_rom_total (lists[pos]->roms[x]);
+  }
+  if (!n)
+    return;
+
+  roms = bacon_newa (const BaconRom *, sizeof (const BaconRom *) * n);
+  paths = bacon_newa (const char *, sizeof (const char *) * n);
+
+  n = 0;
+  for (pos = 0; pos < s_n_devices; ++pos) {
+    for (x = 0; x < BACON_ROM_TOTAL; ++x) {
+      for (rom = lists[pos]->roms[x]; rom; rom = rom->next) {
+        roms[n] = rom;
+        paths[n++] = (s_devices[pos].output) ? s_devices[pos].output
+                                             : g_out_path;
+        if (!rom->next)
+          break;
+      }
+    }
+  }
+
+  /* only a manifest puts every download in one pool, otherwise they
+     run one ROM at a time (bacon_rom_do_download () takes its path) */
+  if (!s_manifest_path) {
+    for (x = 0; x < n; ++x)
+      if (!bacon_rom_do_download (roms[x],
+                                  (paths[x]) ? bacon_strdup (paths[x]) : NULL))
+        exit (EXIT_FAILURE);
+  } else if (!bacon_rom_do_downloads (roms, paths, n))
+    exit (EXIT_FAILURE);
+
+  bacon_free (paths);
+  bacon_free (roms);
+}
+
+static void
+bacon_verify (void)
+{
+  size_t pos;
+  const char **codenames;
+  BaconDevice *device;
+
+  codenames = bacon_newa (const char *,
+                          sizeof (const char *) * (s_n_devices + 1));
+  for (pos = 0; pos < s_n_devices; ++pos) {
+    device = bacon_device_get_device_from_id (g_device_list,
+                                              s_devices[pos].id);
+    codenames[pos] = device->codename;
+  }
+  codenames[pos] = NULL;
+
+  if (!bacon_verify_dir (s_verify_path, codenames, g_rom_type, g_max_roms))
     exit (EXIT_FAILURE);
+  bacon_free (codenames);
 }
 
 static void
@@ -1014,7 +1589,7 @@ bacon_check_given_devices (void)
   BaconBoolean bad_device;
 
   bad_device = BACON_FALSE;
-  for (x = 0; *s_devices[x].id; ++x) {
+  for (x = 0; x < s_n_devices; ++x) {
     if (!bacon_device_is_valid_id (g_device_list, s_devices[x].id)) {
       bacon_error ("'%s' is not a valid device", s_devices[x].id);
       if (!bad_device)
@@ -1032,16 +1607,21 @@ bacon_check_given_devices (void)
 static void
 bacon_perform (void)
 {
-  int x;
   size_t pos;
-  BaconDevice *device;
-  BaconRomList *rom_list;
+  int *maxes;
+  int *types;
+  const char **codenames;
+  BaconDevice **devices;
+  BaconRomList **rom_lists;
 
   if (!g_device_list)
     g_device_list = bacon_device_list_new (s_update_device_list);
 
   if (s_find_device) {
-    bacon_find_device_pattern_and_show_results ();
+    if (s_fuzzy_find)
+      bacon_fuzzy_find_device_and_show_results ();
+    else
+      bacon_find_device_pattern_and_show_results ();
     return;
   }
 
@@ -1053,20 +1633,49 @@ bacon_perform (void)
   if (s_list_all_devices)
     bacon_list_all_devices ();
 
-  if (*s_devices[0].id)
+  if (s_n_devices)
     bacon_check_given_devices ();
 
-  for (pos = 0; *s_devices[pos].id; ++pos) {
-    device = bacon_device_get_device_from_id (g_device_list,
-                                              s_devices[pos].id);
-    rom_list = bacon_rom_list_new (device->codename, g_rom_type, g_max_roms);
-    if (s_showing)
-      bacon_show_rom_list (device, rom_list);
-    else if (s_downloading && s_latest)
-      for (x = 0; x < BACON_ROM_TOTAL; ++x)
-        bacon_download_rom (device, rom_list->roms[x]);
-    bacon_rom_list_destroy (rom_list);
+  if (s_verify_path) {
+    bacon_verify ();
+    return;
   }
+
+  if (!s_n_devices)
+    return;
+
+  maxes = bacon_newa (int, sizeof (int) * s_n_devices);
+  types = bacon_newa (int, sizeof (int) * s_n_devices);
+  codenames = bacon_newa (const char *, sizeof (const char *) * s_n_devices);
+  devices = bacon_newa (BaconDevice *, sizeof (BaconDevice *) * s_n_devices);
+  for (pos = 0; pos < s_n_devices; ++pos) {
+    devices[pos] = bacon_device_get_device_from_id (g_device_list,
+                                                    s_devices[pos].id);
+    codenames[pos] = devices[pos]->codename;
+    types[pos] = (s_devices[pos].type != BACON_ROM_TYPE_NONE)
+                 ? s_devices[pos].type : g_rom_type;
+    maxes[pos] = s_devices[pos].max;
+    if (!maxes[pos] || (s_latest && !s_downloading))
+      maxes[pos] = g_max_roms;
+  }
+
+  /* the ROM lists of all DEVICEs and then all of their downloads go
+     through the same bounded pool of transfers */
+  bacon_net_set_limits (s_jobs, s_host_jobs);
+  rom_lists = bacon_rom_lists_new (codenames, types, maxes, s_n_devices);
+  if (s_showing)
+    for (pos = 0; pos < s_n_devices; ++pos)
+      bacon_show_rom_list (devices[pos], rom_lists[pos]);
+  else if (s_downloading && s_latest)
+    bacon_download_roms (rom_lists);
+
+  for (pos = 0; pos < s_n_devices; ++pos)
+    bacon_rom_list_destroy (rom_lists[pos]);
+  bacon_free (rom_lists);
+  bacon_free (devices);
+  bacon_free (codenames);
+  bacon_free (types);
+  bacon_free (maxes);
 }
 
 int
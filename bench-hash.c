@@ -0,0 +1,474 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Times the MD5 of a file through bacon_hash_update_from_file () against
+ * a copy of the path it replaced (1 KiB fread () chunks, a byte by byte
+ * decode of every block and one sprintf () per digest byte). Not
+ * installed, build it with `make bench-hash' and run it as
+ *
+ *   ./bench-hash [FILE | SIZE_MB [RUNS]]
+ *
+ * Without FILE, SIZE_MB of generated data is written to a scratch file
+ * first and removed afterwards. The best time of RUNS runs is printed for
+ * each path.
+ */
+
+#include "bacon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bacon-device.h"
+#include "bacon-env.h"
+#include "bacon-hash.h"
+#include "bacon-rom.h"
+#include "bacon-util.h"
+
+#define BENCH_SIZE_MB     2048
+#define BENCH_RUNS        3
+#define BENCH_CHUNK       (1024 * 1024)
+#define BENCH_SCRATCH     "bench-hash.dat"
+#define BENCH_DIGEST_SIZE 16
+
+#define S11 7
+#define S12 12
+#define S13 17
+#define S14 22
+#define S21 5
+#define S22 9
+#define S23 14
+#define S24 20
+#define S31 4
+#define S32 11
+#define S33 16
+#define S34 23
+#define S41 6
+#define S42 10
+#define S43 15
+#define S44 21
+
+#define F(x, y, z)        (((x) & (y)) | ((~x) & (z)))
+#define G(x, y, z)        (((x) & (z)) | ((y) & (~z)))
+#define H(x, y, z)        ((x) ^ (y) ^ (z))
+#define I(x, y, z)        ((y) ^ ((x) | (~z)))
+#define ROTATE_LEFT(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define FF(a, b, c, d, x, s, ac)           \
+  do {                                     \
+    (a) += F ((b), (c), (d)) + (x) + (ac); \
+    (a) = ROTATE_LEFT ((a), (s));          \
+    (a) += (b);                            \
+  } while (BACON_FALSE)
+
+#define GG(a, b, c, d, x, s, ac)           \
+  do {                                     \
+    (a) += G ((b), (c), (d)) + (x) + (ac); \
+    (a) = ROTATE_LEFT ((a), (s));          \
+    (a) += (b);                            \
+  } while (BACON_FALSE)
+
+#define HH(a, b, c, d, x, s, ac)           \
+  do {                                     \
+    (a) += H ((b), (c), (d)) + (x) + (ac); \
+    (a) = ROTATE_LEFT ((a), (s));          \
+    (a) += (b);                            \
+  } while (BACON_FALSE)
+
+#define II(a, b, c, d, x, s, ac)           \
+  do {                                     \
+    (a) += I ((b), (c), (d)) + (x) + (ac); \
+    (a) = ROTATE_LEFT ((a), (s));          \
+    (a) += (b);                            \
+  } while (BACON_FALSE)
+
+/* the MD5 context as it was before the digests were made pluggable */
+typedef struct {
+  unsigned int state[4];
+  unsigned int count[2];
+  unsigned char buffer[64];
+} BenchOldCtx;
+
+/* what bacon.c would otherwise provide */
+char *              g_program_name       = "bench-hash";
+BaconDeviceList *   g_device_list        = NULL;
+char *              g_out_path           = NULL;
+int                 g_max_roms           = 0;
+int                 g_rom_type           = BACON_ROM_TYPE_NONE;
+int                 g_segments           = 1;
+int                 g_cache_ttl          = 0;
+BaconBoolean        g_show_progress      = BACON_FALSE;
+BaconBoolean        g_use_color          = BACON_FALSE;
+
+static unsigned char s_padding[64] = {
+  0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static double
+bench_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (tv.tv_sec * 1e3) + (tv.tv_usec / 1e3);
+}
+
+static void
+bench_old_encode (unsigned char *o, unsigned int *i, unsigned int n)
+{
+  unsigned int x;
+  unsigned int y;
+
+  for (x = 0, y = 0; y < n; x++, y += 4) {
+    o[y] = (unsigned char) (i[x] & 0xff);
+    o[y + 1] = (unsigned char) ((i[x] >> 8) & 0xff);
+    o[y + 2] = (unsigned char) ((i[x] >> 16) & 0xff);
+    o[y + 3] = (unsigned char) ((i[x] >> 24) & 0xff);
+  }
+}
+
+static void
+bench_old_decode (unsigned int *o, const unsigned char *i, unsigned int n)
+{
+  unsigned int x;
+  unsigned int y;
+
+  for (x = 0, y = 0; y < n; x++, y += 4)
+    o[x] = ((unsigned int) i[y]) |
+           (((unsigned int) i[y + 1]) << 8) |
+           (((unsigned int) i[y + 2]) << 16) |
+           (((unsigned int) i[y + 3]) << 24);
+}
+
+static void
+bench_old_transform (unsigned int state[4], const unsigned char block[64])
+{
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int d;
+  unsigned int x[16];
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+
+  bench_old_decode (x, block, 64);
+
+  FF (a, b, c, d, x[0], S11, 0xd76aa478);
+  FF (d, a, b, c, x[1], S12, 0xe8c7b756);
+  FF (c, d, a, b, x[2], S13, 0x242070db);
+  FF (b, c, d, a, x[3], S14, 0xc1bdceee);
+  FF (a, b, c, d, x[4], S11, 0xf57c0faf);
+  FF (d, a, b, c, x[5], S12, 0x4787c62a);
+  FF (c, d, a, b, x[6], S13, 0xa8304613);
+  FF (b, c, d, a, x[7], S14, 0xfd469501);
+  FF (a, b, c, d, x[8], S11, 0x698098d8);
+  FF (d, a, b, c, x[9], S12, 0x8b44f7af);
+  FF (c, d, a, b, x[10], S13, 0xffff5bb1);
+  FF (b, c, d, a, x[11], S14, 0x895cd7be);
+  FF (a, b, c, d, x[12], S11, 0x6b901122);
+  FF (d, a, b, c, x[13], S12, 0xfd987193);
+  FF (c, d, a, b, x[14], S13, 0xa679438e);
+  FF (b, c, d, a, x[15], S14, 0x49b40821);
+
+  GG (a, b, c, d, x[1], S21, 0xf61e2562);
+  GG (d, a, b, c, x[6], S22, 0xc040b340);
+  GG (c, d, a, b, x[11], S23, 0x265e5a51);
+  GG (b, c, d, a, x[0], S24, 0xe9b6c7aa);
+  GG (a, b, c, d, x[5], S21, 0xd62f105d);
+  GG (d, a, b, c, x[10], S22,  0x2441453);
+  GG (c, d, a, b, x[15], S23, 0xd8a1e681);
+  GG (b, c, d, a, x[4], S24, 0xe7d3fbc8);
+  GG (a, b, c, d, x[9], S21, 0x21e1cde6);
+  GG (d, a, b, c, x[14], S22, 0xc33707d6);
+  GG (c, d, a, b, x[3], S23, 0xf4d50d87);
+  GG (b, c, d, a, x[8], S24, 0x455a14ed);
+  GG (a, b, c, d, x[13], S21, 0xa9e3e905);
+  GG (d, a, b, c, x[2], S22, 0xfcefa3f8);
+  GG (c, d, a, b, x[7], S23, 0x676f02d9);
+  GG (b, c, d, a, x[12], S24, 0x8d2a4c8a);
+
+  HH (a, b, c, d, x[5], S31, 0xfffa3942);
+  HH (d, a, b, c, x[8], S32, 0x8771f681);
+  HH (c, d, a, b, x[11], S33, 0x6d9d6122);
+  HH (b, c, d, a, x[14], S34, 0xfde5380c);
+  HH (a, b, c, d, x[1], S31, 0xa4beea44);
+  HH (d, a, b, c, x[4], S32, 0x4bdecfa9);
+  HH (c, d, a, b, x[7], S33, 0xf6bb4b60);
+  HH (b, c, d, a, x[10], S34, 0xbebfbc70);
+  HH (a, b, c, d, x[13], S31, 0x289b7ec6);
+  HH (d, a, b, c, x[0], S32, 0xeaa127fa);
+  HH (c, d, a, b, x[3], S33, 0xd4ef3085);
+  HH (b, c, d, a, x[6], S34,  0x4881d05);
+  HH (a, b, c, d, x[9], S31, 0xd9d4d039);
+  HH (d, a, b, c, x[12], S32, 0xe6db99e5);
+  HH (c, d, a, b, x[15], S33, 0x1fa27cf8);
+  HH (b, c, d, a, x[2], S34, 0xc4ac5665);
+
+  II (a, b, c, d, x[0], S41, 0xf4292244);
+  II (d, a, b, c, x[7], S42, 0x432aff97);
+  II (c, d, a, b, x[14], S43, 0xab9423a7);
+  II (b, c, d, a, x[5], S44, 0xfc93a039);
+  II (a, b, c, d, x[12], S41, 0x655b59c3);
+  II (d, a, b, c, x[3], S42, 0x8f0ccc92);
+  II (c, d, a, b, x[10], S43, 0xffeff47d);
+  II (b, c, d, a, x[1], S44, 0x85845dd1);
+  II (a, b, c, d, x[8], S41, 0x6fa87e4f);
+  II (d, a, b, c, x[15], S42, 0xfe2ce6e0);
+  II (c, d, a, b, x[6], S43, 0xa3014314);
+  II (b, c, d, a, x[13], S44, 0x4e0811a1);
+  II (a, b, c, d, x[4], S41, 0xf7537e82);
+  II (d, a, b, c, x[11], S42, 0xbd3af235);
+  II (c, d, a, b, x[2], S43, 0x2ad7d2bb);
+  II (b, c, d, a, x[9], S44, 0xeb86d391);
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  memset ((unsigned char *) x, 0, sizeof (x));
+}
+
+static void
+bench_old_init (BenchOldCtx *ctx)
+{
+  memset (ctx, 0, sizeof (BenchOldCtx));
+
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+}
+
+static void
+bench_old_update (BenchOldCtx *ctx,
+                  const unsigned char *input,
+                  unsigned int n)
+{
+  unsigned int i;
+  unsigned int index;
+  unsigned int n_part;
+
+  index = ((ctx->count[0] >> 3) & 0x3F);
+  if ((ctx->count[0] += (n << 3)) < (n << 3))
+    ctx->count[1]++;
+
+  ctx->count[1] += (n >> 29);
+  n_part = 64 - index;
+
+  if (n >= n_part) {
+    memcpy (&ctx->buffer[index], input, n_part);
+    bench_old_transform (ctx->state, ctx->buffer);
+    for (i = n_part; i + 63 < n; i += 64)
+      bench_old_transform (ctx->state, &input[i]);
+    index = 0;
+  } else
+    i = 0;
+  memcpy (&ctx->buffer[index], &input[i], n - i);
+}
+
+static void
+bench_old_update_from_file (BenchOldCtx *ctx, const char *filename)
+{
+  unsigned char buffer[1024];
+  unsigned int n;
+  FILE *fp;
+
+  fp = bacon_env_fopen (filename, "rb");
+  while (BACON_TRUE) {
+    n = fread (buffer, 1, 1024, fp);
+    if (!n)
+      break;
+    bench_old_update (ctx, buffer, n);
+  }
+  bacon_env_fclose (fp);
+}
+
+static void
+bench_old_final (BenchOldCtx *ctx, char hash[BACON_HASH_HEX_SIZE])
+{
+  unsigned char bits[8];
+  unsigned char digest[BENCH_DIGEST_SIZE];
+  unsigned int i;
+  unsigned int index;
+  unsigned int n_pad;
+
+  bench_old_encode (bits, ctx->count, 8);
+  index = ((ctx->count[0] >> 3) & 0x3f);
+  n_pad = (index < 56) ? (56 - index) : (120 - index);
+
+  bench_old_update (ctx, s_padding, n_pad);
+  bench_old_update (ctx, bits, 8);
+
+  bench_old_encode (digest, ctx->state, BENCH_DIGEST_SIZE);
+  memset ((unsigned char *) ctx, 0, sizeof (*ctx));
+  for (i = 0; i < BENCH_DIGEST_SIZE; i++)
+    sprintf (hash + i * 2, "%02x", digest[i]);
+  hash[BENCH_DIGEST_SIZE * 2] = '\0';
+}
+
+static double
+bench_old (const char *filename, int runs, char hex[BACON_HASH_HEX_SIZE])
+{
+  int r;
+  double t;
+  double best;
+  BenchOldCtx ctx;
+
+  best = 0.0;
+  for (r = 0; r < runs; ++r) {
+    t = bench_now ();
+    bench_old_init (&ctx);
+    bench_old_update_from_file (&ctx, filename);
+    bench_old_final (&ctx, hex);
+    t = bench_now () - t;
+    if (!r || (t < best))
+      best = t;
+  }
+  return best;
+}
+
+static double
+bench_current (const char *filename, int runs, char hex[BACON_HASH_HEX_SIZE])
+{
+  int r;
+  double t;
+  double best;
+  BaconHash hash;
+  BaconHashCtx ctx;
+
+  best = 0.0;
+  for (r = 0; r < runs; ++r) {
+    t = bench_now ();
+    bacon_hash_init (&ctx, BACON_HASH_MD5);
+    bacon_hash_update_from_file (&ctx, filename, 0);
+    bacon_hash_final (&ctx, &hash);
+    bacon_hash_to_hex (&hash, hex);
+    t = bench_now () - t;
+    if (!r || (t < best))
+      best = t;
+  }
+  return best;
+}
+
+/* incompressible enough that nothing along the way can shortcut it */
+static BaconBoolean
+bench_scratch (const char *filename, long size_mb)
+{
+  long x;
+  size_t y;
+  unsigned int seed;
+  unsigned int *chunk;
+  FILE *fp;
+
+  fp = fopen (filename, "wb");
+  if (!fp)
+    return BACON_FALSE;
+
+  seed = 2463534242U;
+  chunk = bacon_newa (unsigned int, BENCH_CHUNK);
+  for (x = 0; x < size_mb; ++x) {
+    for (y = 0; y < (BENCH_CHUNK / sizeof (*chunk)); ++y) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      chunk[y] = seed;
+    }
+    if (fwrite (chunk, 1, BENCH_CHUNK, fp) != BENCH_CHUNK) {
+      bacon_free (chunk);
+      fclose (fp);
+      remove (filename);
+      return BACON_FALSE;
+    }
+  }
+  bacon_free (chunk);
+  if (fclose (fp)) {
+    remove (filename);
+    return BACON_FALSE;
+  }
+  return BACON_TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  int runs;
+  long size_mb;
+  double t;
+  double size;
+  char *end;
+  BaconBoolean scratch;
+  const char *filename;
+  char old_hex[BACON_HASH_HEX_SIZE];
+  char cur_hex[BACON_HASH_HEX_SIZE];
+
+  filename = NULL;
+  scratch = BACON_FALSE;
+  size_mb = BENCH_SIZE_MB;
+  if (argc > 1) {
+    size_mb = strtol (argv[1], &end, 10);
+    if (*end || (end == argv[1]))
+      filename = argv[1];
+  }
+  runs = (argc > 2) ? atoi (argv[2]) : BENCH_RUNS;
+  if ((!filename && (size_mb < 1)) || (runs < 1)) {
+    fprintf (stderr, "usage: %s [FILE | SIZE_MB [RUNS]]\n", g_program_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!filename) {
+    filename = BENCH_SCRATCH;
+    scratch = BACON_TRUE;
+    if (!bench_scratch (filename, size_mb)) {
+      fprintf (stderr, "%s: failed to write %li MB to `%s'\n",
+               g_program_name, size_mb, filename);
+      return EXIT_FAILURE;
+    }
+  }
+  size = (double) bacon_env_size_of_file (filename);
+
+  /* one untimed pass so both paths read from the page cache */
+  bench_old (filename, 1, old_hex);
+
+  t = bench_old (filename, runs, old_hex);
+  printf ("old fread path: %.1f MB, %.2f ms (%.0f MB/s)\n",
+          size / 1e6, t, (size / 1e3) / t);
+  t = bench_current (filename, runs, cur_hex);
+  printf ("current path:   %.1f MB, %.2f ms (%.0f MB/s)\n",
+          size / 1e6, t, (size / 1e3) / t);
+
+  if (scratch)
+    remove (filename);
+  if (strcmp (old_hex, cur_hex)) {
+    fprintf (stderr, "%s: digests differ (%s != %s)\n",
+             g_program_name, old_hex, cur_hex);
+    return EXIT_FAILURE;
+  }
+  printf ("md5: %s\n", cur_hex);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/*
+ * bacon - A command line tool for viewing/downloading CyanogenMod ROMs
+ *         for Android devices.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Times the device list and ROM page parsers over synthetic pages laid
+ * out like the ones get.cm and the wiki serve. Not installed, build it
+ * with `make bench-parse' and run it as
+ *
+ *   ./bench-parse [DEVICES [ROMS [RUNS]]]
+ *
+ * The best time of RUNS runs is printed for each page.
+ */
+
+#include "bacon.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bacon-device.h"
+#include "bacon-net.h"
+#include "bacon-parse.h"
+#include "bacon-rom.h"
+#include "bacon-util.h"
+
+#define BENCH_DEVICES     40000
+#define BENCH_ROMS        20000
+#define BENCH_RUNS        8
+#define BENCH_LINE_MAX    512
+#define BENCH_CHUNK       16384
+
+/* what bacon.c would otherwise provide */
+char *              g_program_name       = "bench-parse";
+BaconDeviceList *   g_device_list        = NULL;
+char *              g_out_path           = NULL;
+int                 g_max_roms           = 0;
+int                 g_rom_type           = BACON_ROM_TYPE_NONE;
+int                 g_segments           = 1;
+int                 g_cache_ttl          = 0;
+BaconBoolean        g_show_progress      = BACON_FALSE;
+BaconBoolean        g_use_color          = BACON_FALSE;
+
+static double
+bench_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (tv.tv_sec * 1e3) + (tv.tv_usec / 1e3);
+}
+
+static char *
+bench_device_page (int n, size_t *size)
+{
+  int x;
+  size_t len;
+  char *page;
+
+  page = bacon_newa (char, ((size_t) n * BENCH_LINE_MAX) + BENCH_LINE_MAX);
+  len = sprintf (page, "<html><head><title>Devices</title></head>"
+                 "<body><div><ul>\n");
+  for (x = 0; x < n; ++x)
+    len += sprintf (page + len,
+                    "<li class=\"device\"><a href=\"/w/Dev%i\">"
+                    "<img src=\"//wiki.cyanogenmod.org/images/thumb/%i.png\""
+                    " alt=\"\"/></a><span class=\"codename\">dev%05i</span> "
+                    "<span class=\"fullname\">Vendor Model %i (Variant)"
+                    "</span></li>\n", x, x, x, x);
+  len += sprintf (page + len, "</ul></div></body></html>\n");
+  *size = len;
+  return page;
+}
+
+static char *
+bench_rom_page (int n, size_t *size)
+{
+  int x;
+  size_t len;
+  char *page;
+
+  page = bacon_newa (char, ((size_t) n * BENCH_LINE_MAX) + BENCH_LINE_MAX);
+  len = sprintf (page, "<html><body><table class=\"table\">\n");
+  for (x = 0; x < n; ++x)
+    len += sprintf (page + len,
+                    "<tr class=\"%s\"><td class=\"name\"><a href=\""
+                    BACON_GET_CM_URL "/get/jenkins/%i/"
+                    "cm-11-2014%04i-NIGHTLY-device%i.zip\">"
+                    "cm-11-2014%04i-NIGHTLY-device%i.zip</a><br/>"
+                    "<small class=\"md5\">md5sum: %08x%08x%08x%08x </small>"
+                    "</td><td><a href=\"" BACON_GET_CM_URL "/get/%i\">get</a>"
+                    "</td><td>%i MB</td><td>2014-01-%02i 10:00:00</td>"
+                    "</tr>\n", (x & 1) ? "odd" : "even", x, x % 10000, x,
+                    x % 10000, x, (unsigned int) x,
+                    (unsigned int) x * 7, (unsigned int) x * 13,
+                    (unsigned int) x * 31, x,
+                    150 + (x % 100), 1 + (x % 28));
+  len += sprintf (page + len, "</table></body></html>\n");
+  *size = len;
+  return page;
+}
+
+static double
+bench_device_list (const char *page, int runs, int *total)
+{
+  int r;
+  double t;
+  double best;
+  BaconDeviceList *list;
+
+  best = 0.0;
+  for (r = 0; r < runs; ++r) {
+    t = bench_now ();
+    list = bacon_parse_for_device_list (page, BACON_FALSE);
+    t = bench_now () - t;
+    if (!r || (t < best))
+      best = t;
+    *total = bacon_device_list_total (list);
+    bacon_device_list_destroy (list);
+  }
+  return best;
+}
+
+static double
+bench_roms (const char *page, size_t size, int runs, int *total)
+{
+  int r;
+  size_t x;
+  size_t n;
+  double t;
+  double best;
+  BaconRom *roms;
+  BaconRomParser *parser;
+
+  best = 0.0;
+  for (r = 0; r < runs; ++r) {
+    t = bench_now ();
+    /* fed in pieces the way curl hands them over */
+    parser = bacon_rom_parser_new (INT_MAX);
+    for (x = 0; x < size; x += n) {
+      n = ((size - x) < BENCH_CHUNK) ? (size - x) : BENCH_CHUNK;
+      bacon_rom_parser_feed (parser, page + x, n);
+    }
+    roms = bacon_rom_parser_finish (parser);
+    t = bench_now () - t;
+    if (!r || (t < best))
+      best = t;
+    *total = bacon_rom_total (roms);
+    bacon_rom_free (roms);
+  }
+  return best;
+}
+
+int
+main (int argc, char **argv)
+{
+  int runs;
+  int n_devices;
+  int n_roms;
+  int total;
+  size_t size;
+  double t;
+  char *page;
+
+  n_devices = (argc > 1) ? atoi (argv[1]) : BENCH_DEVICES;
+  n_roms = (argc > 2) ? atoi (argv[2]) : BENCH_ROMS;
+  runs = (argc > 3) ? atoi (argv[3]) : BENCH_RUNS;
+  if ((n_devices < 1) || (n_roms < 1) || (runs < 1)) {
+    fprintf (stderr, "usage: %s [DEVICES [ROMS [RUNS]]]\n", g_program_name);
+    return EXIT_FAILURE;
+  }
+
+  page = bench_device_page (n_devices, &size);
+  t = bench_device_list (page, runs, &total);
+  printf ("device page: %.1f MB, %i devices, %.2f ms (%.0f MB/s)\n",
+          size / 1e6, total, t, (size / 1e3) / t);
+  bacon_free (page);
+
+  page = bench_rom_page (n_roms, &size);
+  t = bench_roms (page, size, runs, &total);
+  printf ("ROM page:    %.1f MB, %i ROMs, %.2f ms (%.0f MB/s)\n",
+          size / 1e6, total, t, (size / 1e3) / t);
+  bacon_free (page);
+  return EXIT_SUCCESS;
+}